@@ -0,0 +1,159 @@
+#include "BlockDevice.h"
+#include <cstring>
+
+namespace EmbeddedFS {
+
+AsyncBlockAdapter::AsyncBlockAdapter(IAsyncBlockDevice& device, uint8_t* staging, size_t staging_size,
+                                     uint32_t sector_size)
+    : device_(device), staging_(staging), staging_size_(staging ? staging_size : 0),
+      sector_size_(sector_size), write_pending_(false), deferred_error_(FSResult::OK),
+      wait_hook_(nullptr), wait_context_(nullptr) {
+}
+
+void AsyncBlockAdapter::attach(lfs_config_t& config) {
+    config.context = this;
+    config.read = lfs_read;
+    config.prog = lfs_prog;
+    config.erase = lfs_erase;
+    config.sync = lfs_sync;
+}
+
+// Wait for the outstanding request and collect its result
+FSResult AsyncBlockAdapter::wait() {
+    while (request_.status == FSResult::IN_PROGRESS) {
+        stats_.idle_calls++;
+        if (wait_hook_) {
+            wait_hook_(wait_context_);
+        }
+        device_.idle();
+    }
+    
+    FSResult result = request_.status;
+    if (write_pending_) {
+        write_pending_ = false;
+        if (result != FSResult::OK && deferred_error_ == FSResult::OK) {
+            deferred_error_ = result;
+        }
+    }
+    return result;
+}
+
+// Run one request to completion, except programs that fit the staging
+// buffer: those are left in flight
+FSResult AsyncBlockAdapter::transfer(BlockOp op, uint64_t address, void* buffer, uint32_t size) {
+    wait();
+    
+    // Report a failed deferred program before accepting more work
+    if (deferred_error_ != FSResult::OK) {
+        FSResult result = deferred_error_;
+        deferred_error_ = FSResult::OK;
+        return result;
+    }
+    
+    bool deferred = op == BlockOp::PROGRAM && size <= staging_size_;
+    if (deferred) {
+        memcpy(staging_, buffer, size);
+        buffer = staging_;
+    }
+    
+    request_.op = op;
+    request_.address = address;
+    request_.buffer = buffer;
+    request_.size = size;
+    request_.status = FSResult::IN_PROGRESS;
+    stats_.requests++;
+    
+    FSResult result = device_.submit(request_);
+    if (result != FSResult::OK) {
+        request_.status = result;
+        return result;
+    }
+    
+    if (deferred) {
+        write_pending_ = true;
+        stats_.deferred_writes++;
+        return FSResult::OK;
+    }
+    return wait();
+}
+
+FSResult AsyncBlockAdapter::flush() {
+    wait();
+    FSResult result = deferred_error_;
+    deferred_error_ = FSResult::OK;
+    return result;
+}
+
+DRESULT AsyncBlockAdapter::disk_read(BYTE* buff, LBA_t sector, UINT count) {
+    FSResult result = transfer(BlockOp::READ, static_cast<uint64_t>(sector) * sector_size_, buff, count * sector_size_);
+    return result == FSResult::OK ? RES_OK : RES_ERROR;
+}
+
+DRESULT AsyncBlockAdapter::disk_write(const BYTE* buff, LBA_t sector, UINT count) {
+    FSResult result = transfer(BlockOp::PROGRAM, static_cast<uint64_t>(sector) * sector_size_,
+                               const_cast<BYTE*>(buff), count * sector_size_);
+    return result == FSResult::OK ? RES_OK : RES_ERROR;
+}
+
+DRESULT AsyncBlockAdapter::disk_ioctl(BYTE cmd, void* buff) {
+    switch (cmd) {
+        case CTRL_SYNC: {
+            FSResult result = flush();
+            if (result == FSResult::OK) {
+                result = transfer(BlockOp::SYNC, 0, nullptr, 0);
+            }
+            return result == FSResult::OK ? RES_OK : RES_ERROR;
+        }
+        case GET_SECTOR_COUNT:
+            *static_cast<LBA_t*>(buff) = static_cast<LBA_t>(device_.capacity() / sector_size_);
+            return RES_OK;
+        case GET_SECTOR_SIZE:
+            *static_cast<WORD*>(buff) = static_cast<WORD>(sector_size_);
+            return RES_OK;
+        case GET_BLOCK_SIZE:
+            *static_cast<DWORD*>(buff) = device_.erase_size() / sector_size_;
+            return RES_OK;
+        default:
+            return RES_PARERR;
+    }
+}
+
+int AsyncBlockAdapter::lfs_read(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size) {
+    AsyncBlockAdapter* self = static_cast<AsyncBlockAdapter*>(c->context);
+    uint64_t address = static_cast<uint64_t>(block) * c->block_size + off;
+    return to_lfs_error(self->transfer(BlockOp::READ, address, buffer, size));
+}
+
+int AsyncBlockAdapter::lfs_prog(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, const void* buffer, lfs_size_t size) {
+    AsyncBlockAdapter* self = static_cast<AsyncBlockAdapter*>(c->context);
+    uint64_t address = static_cast<uint64_t>(block) * c->block_size + off;
+    return to_lfs_error(self->transfer(BlockOp::PROGRAM, address, const_cast<void*>(buffer), size));
+}
+
+int AsyncBlockAdapter::lfs_erase(const struct lfs_config* c, lfs_block_t block) {
+    AsyncBlockAdapter* self = static_cast<AsyncBlockAdapter*>(c->context);
+    uint64_t address = static_cast<uint64_t>(block) * c->block_size;
+    return to_lfs_error(self->transfer(BlockOp::ERASE, address, nullptr, c->block_size));
+}
+
+int AsyncBlockAdapter::lfs_sync(const struct lfs_config* c) {
+    AsyncBlockAdapter* self = static_cast<AsyncBlockAdapter*>(c->context);
+    FSResult result = self->flush();
+    if (result == FSResult::OK) {
+        result = self->transfer(BlockOp::SYNC, 0, nullptr, 0);
+    }
+    return to_lfs_error(result);
+}
+
+int AsyncBlockAdapter::to_lfs_error(FSResult result) {
+    switch (result) {
+        case FSResult::OK:
+            return LFS_ERR_OK;
+        case FSResult::ERROR_CORRUPT:
+            return LFS_ERR_CORRUPT;
+        default:
+            return LFS_ERR_IO;
+    }
+}
+
+} // namespace EmbeddedFS
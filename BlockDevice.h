@@ -0,0 +1,123 @@
+#ifndef BLOCK_DEVICE_H
+#define BLOCK_DEVICE_H
+
+#include "FileSys.h"
+#include "diskio.h"
+
+namespace EmbeddedFS {
+
+// Block device operations
+enum class BlockOp : uint8_t {
+    READ,
+    PROGRAM,
+    ERASE,
+    SYNC
+};
+
+// One transfer handed to an IAsyncBlockDevice. Addresses are linear byte
+// offsets on the device, so LittleFS (block, offset) and FatFS sectors map
+// onto the same request.
+struct BlockRequest {
+    BlockOp op;
+    uint64_t address;
+    void* buffer;               // Destination for READ, source for PROGRAM
+    uint32_t size;
+    volatile FSResult status;   // IN_PROGRESS until the device completes the request (see submit)
+    
+    BlockRequest() : op(BlockOp::READ), address(0), buffer(nullptr), size(0), status(FSResult::OK) {}
+};
+
+// Block device that starts a transfer and reports completion later,
+// typically from a DMA interrupt. A device without DMA may simply complete
+// the request inside submit.
+class IAsyncBlockDevice {
+public:
+    virtual ~IAsyncBlockDevice() = default;
+    
+    // Start the request; the device sets request.status once it is done.
+    // Only one request is outstanding at a time. volatile suits a status
+    // set by an interrupt handler on the polling core; a device finishing
+    // on another thread must set it from idle() instead (as
+    // ThreadBlockDevice does), since volatile does not order the accesses.
+    virtual FSResult submit(BlockRequest& request) = 0;
+    
+    // Called repeatedly while a request is outstanding (poll the
+    // controller, sleep until the next interrupt, ...)
+    virtual void idle() {}
+    
+    virtual uint32_t erase_size() const = 0;    // Bytes per erase unit
+    virtual uint64_t capacity() const = 0;      // Bytes
+};
+
+// Overlap counters of an AsyncBlockAdapter
+struct AsyncBlockStats {
+    uint32_t requests;
+    uint32_t deferred_writes;   // Programs that returned before the transfer finished
+    uint32_t idle_calls;        // Times the CPU had to wait for the device
+    
+    AsyncBlockStats() : requests(0), deferred_writes(0), idle_calls(0) {}
+};
+
+// Drives an IAsyncBlockDevice from the synchronous LittleFS callbacks and
+// FatFS diskio functions.
+//
+// Programs up to the staging buffer's size are copied there, submitted and
+// acknowledged at once, so the backend carries on (allocating, building the
+// next page, running the caller's code) while the transfer is in flight.
+// The next device call waits for it first, which keeps every read ordered
+// after the writes before it. An error of a deferred program is reported
+// by that next call, or by sync. Other requests wait for completion; the
+// optional wait hook runs application work in that time.
+//
+// LittleFS: adapter.attach(lfs_cfg) fills in context and the callbacks.
+// FatFS: forward disk_read/disk_write/disk_ioctl of the drive in diskio.c
+// to the adapter's methods of the same name.
+class AsyncBlockAdapter {
+public:
+    AsyncBlockAdapter(IAsyncBlockDevice& device, uint8_t* staging, size_t staging_size,
+                      uint32_t sector_size = 512);
+    
+    // Called while waiting for the device, in addition to device.idle()
+    void set_wait_hook(void (*hook)(void* context), void* context) {
+        wait_hook_ = hook;
+        wait_context_ = context;
+    }
+    
+    void attach(lfs_config_t& config);
+    
+    DRESULT disk_read(BYTE* buff, LBA_t sector, UINT count);
+    DRESULT disk_write(const BYTE* buff, LBA_t sector, UINT count);
+    DRESULT disk_ioctl(BYTE cmd, void* buff);
+    
+    FSResult flush();               // Wait for a deferred program
+    const AsyncBlockStats& stats() const { return stats_; }
+
+private:
+    IAsyncBlockDevice& device_;
+    uint8_t* staging_;
+    size_t staging_size_;
+    uint32_t sector_size_;
+    BlockRequest request_;
+    bool write_pending_;
+    FSResult deferred_error_;
+    void (*wait_hook_)(void* context);
+    void* wait_context_;
+    AsyncBlockStats stats_;
+    
+    FSResult transfer(BlockOp op, uint64_t address, void* buffer, uint32_t size);
+    FSResult wait();
+    
+    static int lfs_read(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size);
+    static int lfs_prog(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, const void* buffer, lfs_size_t size);
+    static int lfs_erase(const struct lfs_config* c, lfs_block_t block);
+    static int lfs_sync(const struct lfs_config* c);
+    static int to_lfs_error(FSResult result);
+    
+    // Disable copy construction and assignment
+    AsyncBlockAdapter(const AsyncBlockAdapter&) = delete;
+    AsyncBlockAdapter& operator=(const AsyncBlockAdapter&) = delete;
+};
+
+} // namespace EmbeddedFS
+
+#endif // BLOCK_DEVICE_H
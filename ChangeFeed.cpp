@@ -0,0 +1,125 @@
+#include "ChangeFeed.h"
+#include <cstring>
+
+namespace EmbeddedFS {
+
+ChangeFeed::ChangeFeed(ChangeEvent* slots, size_t slot_count, void (*notify)(void* context), void* notify_context)
+    : slots_(slot_count ? slots : nullptr), mask_(0), notify_(notify), notify_context_(notify_context), head_(0),
+      tail_(0), total_lost_(0), next_sequence_(0), pending_lost_(0) {
+    size_t capacity = 1;
+    while (capacity * 2 <= slot_count) {
+        capacity *= 2;
+    }
+    mask_ = static_cast<uint32_t>(capacity - 1);
+    memset(writers_, 0, sizeof(writers_));
+}
+
+bool ChangeFeed::pop(ChangeEvent& event) {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) {
+        return false;
+    }
+    
+    event = slots_[tail & mask_];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+// Make room for count events, writing a pending OVERFLOW event first; on
+// failure the events are counted as lost instead
+bool ChangeFeed::reserve(uint32_t count) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    uint32_t used = head - tail_.load(std::memory_order_acquire);
+    uint32_t needed = count + (pending_lost_ ? 1 : 0);
+    
+    if (!slots_ || mask_ + 1 - used < needed) {
+        pending_lost_ += count;
+        next_sequence_ += count;
+        total_lost_.fetch_add(count, std::memory_order_relaxed);
+        return false;
+    }
+    
+    if (pending_lost_) {
+        fill(0, ChangeType::OVERFLOW, "", false, pending_lost_);
+        publish(1);
+        pending_lost_ = 0;
+    }
+    return true;
+}
+
+void ChangeFeed::fill(uint32_t index, ChangeType type, const char* path, bool is_directory, uint32_t lost) {
+    ChangeEvent& event = slots_[(head_.load(std::memory_order_relaxed) + index) & mask_];
+    event.sequence = next_sequence_++;
+    event.lost = lost;
+    event.type = type;
+    event.is_directory = is_directory;
+    strncpy(event.path, path, MAX_PATH_LENGTH - 1);
+    event.path[MAX_PATH_LENGTH - 1] = '\0';
+}
+
+// Hand filled slots to the consumer; the release store orders the slot contents before it
+void ChangeFeed::publish(uint32_t count) {
+    head_.store(head_.load(std::memory_order_relaxed) + count, std::memory_order_release);
+}
+
+void ChangeFeed::post(ChangeType type, const char* path, bool is_directory) {
+    if (!reserve(1)) {
+        return;
+    }
+    fill(0, type, path, is_directory, 0);
+    publish(1);
+    if (notify_) {
+        notify_(notify_context_);
+    }
+}
+
+// Both halves are published together, so the consumer never sees one alone
+void ChangeFeed::post_rename(const char* old_path, const char* new_path, bool is_directory) {
+    if (!reserve(2)) {
+        return;
+    }
+    fill(0, ChangeType::RENAMED_FROM, old_path, is_directory, 0);
+    fill(1, ChangeType::RENAMED_TO, new_path, is_directory, 0);
+    publish(2);
+    if (notify_) {
+        notify_(notify_context_);
+    }
+}
+
+// Remember a file opened for writing; if every slot is taken the change is
+// reported right away instead of at close
+void ChangeFeed::opened(const FileHandle& handle, const char* path, bool modified) {
+    for (Writer& writer : writers_) {
+        if (!writer.handle) {
+            writer.handle = &handle;
+            writer.modified = modified;
+            strncpy(writer.path, path, MAX_PATH_LENGTH - 1);
+            writer.path[MAX_PATH_LENGTH - 1] = '\0';
+            return;
+        }
+    }
+    post(ChangeType::MODIFIED, path, false);
+}
+
+void ChangeFeed::written(const FileHandle& handle) {
+    for (Writer& writer : writers_) {
+        if (writer.handle == &handle) {
+            writer.modified = true;
+            return;
+        }
+    }
+}
+
+void ChangeFeed::closed(const FileHandle& handle) {
+    for (Writer& writer : writers_) {
+        if (writer.handle == &handle) {
+            writer.handle = nullptr;
+            if (writer.modified) {
+                post(ChangeType::MODIFIED, writer.path, false);
+            }
+            return;
+        }
+    }
+}
+
+} // namespace EmbeddedFS
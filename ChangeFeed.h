@@ -0,0 +1,91 @@
+#ifndef CHANGE_FEED_H
+#define CHANGE_FEED_H
+
+#include "FileSys.h"
+#include <atomic>
+
+namespace EmbeddedFS {
+
+enum class ChangeType : uint8_t {
+    CREATED,            // File or directory created
+    MODIFIED,           // File closed after being written, truncated or replaced
+    REMOVED,
+    RENAMED_FROM,       // Always followed by RENAMED_TO with the next sequence number
+    RENAMED_TO,
+    OVERFLOW            // Events were dropped here because the feed was full; rescan
+};
+
+struct ChangeEvent {
+    uint32_t sequence;          // Counts every change, dropped ones included
+    uint32_t lost;              // OVERFLOW: number of events dropped
+    ChangeType type;
+    bool is_directory;
+    char path[MAX_PATH_LENGTH];
+};
+
+// Change notifications from one FileSys (see FileSys::set_change_feed),
+// delivered through a single-producer single-consumer ring in caller
+// storage. The FileSys posts under its own lock; one consumer task drains
+// the ring with pop() without taking that lock. When the ring is full new
+// events are dropped and the next one that fits is preceded by an OVERFLOW
+// event, after which the consumer should rescan what it watches.
+//
+// Usage:
+//   static ChangeEvent slots[16];
+//   static ChangeFeed feed(slots, 16, give_semaphore, &sem);
+//   fs.set_change_feed(&feed);
+//   ...
+//   ChangeEvent event;
+//   while (feed.pop(event)) { handle(event); }
+class ChangeFeed {
+public:
+    // slot_count is rounded down to a power of two; notify, if given, is
+    // called by the producer after each post (e.g. to wake the consumer)
+    ChangeFeed(ChangeEvent* slots, size_t slot_count, void (*notify)(void* context) = nullptr,
+               void* notify_context = nullptr);
+    
+    // Consumer side
+    bool pop(ChangeEvent& event);
+    bool empty() const { return tail_.load(std::memory_order_relaxed) == head_.load(std::memory_order_acquire); }
+    uint32_t total_lost() const { return total_lost_.load(std::memory_order_relaxed); }
+
+private:
+    friend class FileSys;
+    
+    // Open writable file whose close may report MODIFIED
+    struct Writer {
+        const FileHandle* handle;   // nullptr for a free slot
+        bool modified;
+        char path[MAX_PATH_LENGTH];
+    };
+    
+    // Producer side, called by FileSys with its lock held
+    void post(ChangeType type, const char* path, bool is_directory);
+    void post_rename(const char* old_path, const char* new_path, bool is_directory);
+    void opened(const FileHandle& handle, const char* path, bool modified);
+    void written(const FileHandle& handle);
+    void closed(const FileHandle& handle);
+    
+    bool reserve(uint32_t count);
+    void fill(uint32_t index, ChangeType type, const char* path, bool is_directory, uint32_t lost);
+    void publish(uint32_t count);
+    
+    ChangeEvent* slots_;
+    uint32_t mask_;
+    void (*notify_)(void* context);
+    void* notify_context_;
+    std::atomic<uint32_t> head_;        // Next slot to fill, written by the producer only
+    std::atomic<uint32_t> tail_;        // Next slot to read, written by the consumer only
+    std::atomic<uint32_t> total_lost_;
+    uint32_t next_sequence_;
+    uint32_t pending_lost_;             // Dropped since the last OVERFLOW event
+    Writer writers_[MAX_OPEN_FILES];
+    
+    // Disable copy construction and assignment
+    ChangeFeed(const ChangeFeed&) = delete;
+    ChangeFeed& operator=(const ChangeFeed&) = delete;
+};
+
+} // namespace EmbeddedFS
+
+#endif // CHANGE_FEED_H
@@ -1,9 +1,118 @@
 #include "FileSys.h"
+#include "diskio.h"
 #include <cstring>
 #include <cctype>
 
 namespace EmbeddedFS {
 
+// Directory index slot states
+static constexpr uint8_t DIR_INDEX_EMPTY = 0;
+static constexpr uint8_t DIR_INDEX_VALID = 1;       // Metadata matches the volume
+static constexpr uint8_t DIR_INDEX_STALE = 2;       // Exists, metadata must be re-read
+static constexpr uint8_t DIR_INDEX_DELETED = 3;
+
+// Short directory entry layout
+static constexpr size_t DIR_ENTRY_SIZE = 32;
+static constexpr size_t DIR_ENTRY_ATTR = 11;
+static constexpr size_t DIR_ENTRY_CRT_TIME = 13;    // Tenths, time and date up to byte 17
+static constexpr size_t DIR_ENTRY_CLUST_HI = 20;
+static constexpr size_t DIR_ENTRY_MOD_TIME = 22;
+static constexpr size_t DIR_ENTRY_CLUST_LO = 26;
+static constexpr size_t DIR_ENTRY_SIZE_FIELD = 28;
+static constexpr BYTE ENTRY_FREE = 0x00;
+static constexpr BYTE ENTRY_DELETED = 0xE5;
+static constexpr BYTE ATTR_VOLUME = 0x08;
+static constexpr BYTE ATTR_LFN = 0x0F;
+
+// Hash of the 11-byte short name and the creation time of a directory
+// entry. The first cluster is left out: it changes when an empty file is
+// first written and when atomic_replace or swap_contents moves a chain.
+static uint32_t entry_tag(const BYTE* entry) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < 11; i++) {
+        hash = (hash ^ entry[i]) * 16777619u;
+    }
+    for (size_t i = DIR_ENTRY_CRT_TIME; i < DIR_ENTRY_CRT_TIME + 5; i++) {
+        hash = (hash ^ entry[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// True if every byte of a name is 7-bit ASCII
+static bool ascii_name(const char* name) {
+    while (*name) {
+        if (static_cast<uint8_t>(*name++) >= 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Name key, ignoring ASCII case (see ascii_name): FNV-1a for placement
+// plus an independent 16-bit check so two names practically never share a key
+static uint32_t hash_name(const char* name, uint16_t& check) {
+    uint32_t hash = 2166136261u;
+    uint32_t sum = 5381;
+    while (*name) {
+        uint8_t c = static_cast<uint8_t>(toupper(static_cast<unsigned char>(*name++)));
+        hash = (hash ^ c) * 16777619u;
+        sum = sum * 33 + c;
+    }
+    check = static_cast<uint16_t>(sum ^ (sum >> 16));
+    return hash;
+}
+
+// Case-insensitive comparison of the first length characters of two paths
+static bool same_path_prefix(const char* a, const char* b, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (toupper(static_cast<unsigned char>(a[i])) != toupper(static_cast<unsigned char>(b[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// True for the one spelling the directory indexes key paths by: absolute,
+// '/'-separated, no drive prefix, no empty, "." or ".." components, none
+// with the leading spaces or trailing dots and spaces FatFS strips, and no
+// generated short names ("LONGNA~1"). Checks the first length characters.
+static bool canonical_path(const char* path, size_t length) {
+    if (path[0] != '/') {
+        return false;
+    }
+    
+    size_t start = 1;
+    for (size_t i = 1; i <= length; i++) {
+        char c = i < length ? path[i] : '/';
+        if (c == '\\' || c == ':') {
+            return false;
+        }
+        if (c == '~' && i + 1 < length && isdigit(static_cast<unsigned char>(path[i + 1]))) {
+            return false;
+        }
+        if (c != '/') {
+            continue;
+        }
+        if (i == start) {
+            return length <= 1; // Only the root itself may end in '/'
+        }
+        if (path[start] == ' ' || path[i - 1] == '.' || path[i - 1] == ' ') {
+            return false;
+        }
+        start = i + 1;
+    }
+    return true;
+}
+
+// Length of a directory path without trailing slashes ("/" becomes "")
+static size_t dir_path_length(const char* path) {
+    size_t length = strlen(path);
+    while (length > 0 && path[length - 1] == '/') {
+        length--;
+    }
+    return length;
+}
+
 // Constructor
 FatFSImpl::FatFSImpl(const char* drive_path) : mounted_(false) {
     // Copy and validate drive path
@@ -15,6 +124,7 @@ FatFSImpl::FatFSImpl(const char* drive_path) : mounted_(false) {
     
     // Initialize FATFS structure
     memset(&fatfs_, 0, sizeof(FATFS));
+    memset(dir_indexes_, 0, sizeof(dir_indexes_));
 }
 
 // Destructor
@@ -33,6 +143,7 @@ FSResult FatFSImpl::mount() {
     FRESULT res = f_mount(&fatfs_, drive_path_, 1); // Force mount
     if (res == FR_OK) {
         mounted_ = true;
+        invalidate_dir_indexes(nullptr);
         return FSResult::OK;
     }
     
@@ -62,11 +173,42 @@ FSResult FatFSImpl::open(FileHandle& handle, const char* path, OpenMode mode) {
     }
     
     BYTE fat_mode = convert_open_mode(mode);
+    bool creates = (fat_mode & (FA_CREATE_NEW | FA_CREATE_ALWAYS | FA_OPEN_ALWAYS)) != 0;
+    
+    // A complete directory index answers "no such file" without a scan
+    uint32_t name_hash;
+    uint16_t name_check;
+    uint8_t slot = locate_dir_index(path, name_hash, name_check);
+    DirIndexEntry* entry = nullptr;
+    if (slot != NO_DIR_INDEX) {
+        entry = lookup_dir_index(dir_indexes_[slot], name_hash, name_check);
+        if (!entry && !creates) {
+            return FSResult::ERROR_NO_ENT;
+        }
+    }
+    
     FRESULT res = f_open(&handle.fat_file, path, fat_mode);
     
     if (res == FR_OK) {
         handle.is_open = true;
         handle.fs_impl = this;
+        handle.dir_index = NO_DIR_INDEX;
+        
+        if (slot != NO_DIR_INDEX && (fat_mode & FA_WRITE)) {
+            // Size and timestamp are refreshed from the entry after sync/close
+            DirIndex& index = dir_indexes_[slot];
+            if (!entry) {
+                insert_dir_index(index, name_hash, name_check, DIR_INDEX_STALE, nullptr);
+            } else if (entry->state == DIR_INDEX_VALID) {
+                entry->state = DIR_INDEX_STALE;
+            }
+            handle.dir_index = slot;
+            handle.name_hash = name_hash;
+            handle.name_check = name_check;
+        } else if ((fat_mode & FA_WRITE) && !canonical_path(path, strlen(path))) {
+            // An index rebuilt while the file is open would keep its old size
+            handle.dir_index = ALL_DIR_INDEXES;
+        }
         return FSResult::OK;
     }
     
@@ -83,6 +225,10 @@ FSResult FatFSImpl::close(FileHandle& handle) {
     handle.is_open = false;
     handle.fs_impl = nullptr;
     
+    // f_close flushed the directory entry; re-read it on the next stat
+    mark_dir_index_stale(handle);
+    handle.dir_index = NO_DIR_INDEX;
+    
     return convert_fatfs_error(res);
 }
 
@@ -170,6 +316,9 @@ FSResult FatFSImpl::sync(FileHandle& handle) {
     }
     
     FRESULT res = f_sync(&handle.fat_file);
+    if (res == FR_OK) {
+        mark_dir_index_stale(handle);
+    }
     return convert_fatfs_error(res);
 }
 
@@ -209,6 +358,16 @@ FSResult FatFSImpl::remove(const char* path) {
     }
     
     FRESULT res = f_unlink(path);
+    if (res == FR_OK) {
+        uint32_t name_hash;
+        uint16_t name_check;
+        uint8_t slot = locate_dir_index(path, name_hash, name_check);
+        if (slot != NO_DIR_INDEX) {
+            erase_dir_index(dir_indexes_[slot], name_hash, name_check);
+        }
+        note_dir_removal(path);
+        invalidate_dir_indexes(path);
+    }
     return convert_fatfs_error(res);
 }
 
@@ -219,9 +378,53 @@ FSResult FatFSImpl::rename(const char* old_path, const char* new_path) {
     }
     
     FRESULT res = f_rename(old_path, new_path);
+    if (res == FR_OK) {
+        uint32_t name_hash;
+        uint16_t name_check;
+        uint8_t slot = locate_dir_index(old_path, name_hash, name_check);
+        if (slot != NO_DIR_INDEX) {
+            erase_dir_index(dir_indexes_[slot], name_hash, name_check);
+        }
+        note_dir_removal(old_path);
+        slot = locate_dir_index(new_path, name_hash, name_check);
+        if (slot != NO_DIR_INDEX) {
+            insert_dir_index(dir_indexes_[slot], name_hash, name_check, DIR_INDEX_STALE, nullptr);
+        }
+        invalidate_dir_indexes(old_path);
+        invalidate_dir_indexes(new_path);
+    }
     return convert_fatfs_error(res);
 }
 
+// f_stat, answered from the directory index when one covers the path
+FRESULT FatFSImpl::stat_entry(const char* path, FILINFO& fno) {
+    uint32_t name_hash;
+    uint16_t name_check;
+    uint8_t slot = locate_dir_index(path, name_hash, name_check);
+    DirIndexEntry* entry = nullptr;
+    if (slot != NO_DIR_INDEX) {
+        entry = lookup_dir_index(dir_indexes_[slot], name_hash, name_check);
+        if (!entry) {
+            return FR_NO_FILE;
+        }
+    }
+    
+    if (entry && entry->state == DIR_INDEX_VALID) {
+        // Served from RAM, no directory scan
+        fno.fsize = entry->size;
+        fno.fattrib = entry->attr;
+        fno.fdate = entry->fdate;
+        fno.ftime = entry->ftime;
+        return FR_OK;
+    }
+    
+    FRESULT res = f_stat(path, &fno);
+    if (res == FR_OK && entry && entry->state == DIR_INDEX_STALE) {
+        insert_dir_index(dir_indexes_[slot], name_hash, name_check, DIR_INDEX_VALID, &fno);
+    }
+    return res;
+}
+
 // Get file/directory information
 FSResult FatFSImpl::stat(const char* path, FileInfo& info) {
     if (!mounted_) {
@@ -229,7 +432,7 @@ FSResult FatFSImpl::stat(const char* path, FileInfo& info) {
     }
     
     FILINFO fno;
-    FRESULT res = f_stat(path, &fno);
+    FRESULT res = stat_entry(path, fno);
     
     if (res == FR_OK) {
         // Copy filename (extract from path if needed)
@@ -246,9 +449,7 @@ FSResult FatFSImpl::stat(const char* path, FileInfo& info) {
         info.size = static_cast<uint32_t>(fno.fsize);
         info.is_directory = (fno.fattrib & AM_DIR) != 0;
         
-        // Convert FatFS date/time to Unix timestamp (simplified)
-        // FatFS stores date/time in a packed format
-        info.modified_time = static_cast<uint32_t>(fno.fdate) << 16 | fno.ftime;
+        info.modified_time = FileSys::fat_to_unix(static_cast<uint32_t>(fno.fdate) << 16 | fno.ftime);
         
         return FSResult::OK;
     }
@@ -256,6 +457,89 @@ FSResult FatFSImpl::stat(const char* path, FileInfo& info) {
     return convert_fatfs_error(res);
 }
 
+// Check that a path exists
+FSResult FatFSImpl::exists(const char* path) {
+    if (!mounted_) {
+        return FSResult::ERROR_NOT_MOUNTED;
+    }
+    
+    // An index entry answers on its own, even one whose metadata is stale
+    uint32_t name_hash;
+    uint16_t name_check;
+    uint8_t slot = locate_dir_index(path, name_hash, name_check);
+    if (slot != NO_DIR_INDEX) {
+        bool found = lookup_dir_index(dir_indexes_[slot], name_hash, name_check) != nullptr;
+        return found ? FSResult::OK : FSResult::ERROR_NO_ENT;
+    }
+    
+    FILINFO fno;
+    return convert_fatfs_error(f_stat(path, &fno));
+}
+
+// Size of a file by path
+FSResult FatFSImpl::file_size(const char* path, uint32_t& size) {
+    if (!mounted_) {
+        return FSResult::ERROR_NOT_MOUNTED;
+    }
+    
+    FILINFO fno;
+    FRESULT res = stat_entry(path, fno);
+    if (res != FR_OK) {
+        return convert_fatfs_error(res);
+    }
+    if (fno.fattrib & AM_DIR) {
+        return FSResult::ERROR_IS_DIR;
+    }
+    
+    size = static_cast<uint32_t>(fno.fsize);
+    return FSResult::OK;
+}
+
+// Size of an open file, from the handle alone
+FSResult FatFSImpl::file_size(FileHandle& handle, uint32_t& size) {
+    if (!handle.is_open || handle.fs_impl != this) {
+        return FSResult::ERROR_BAD_FILE;
+    }
+    
+    size = static_cast<uint32_t>(f_size(&handle.fat_file));
+    return FSResult::OK;
+}
+
+// FAT entries always carry a time, so there is nothing to turn on
+FSResult FatFSImpl::enable_modified_times(bool enable) {
+    return enable ? FSResult::OK : FSResult::ERROR_NOT_SUPPORTED;
+}
+
+// Set the timestamp of a file or directory (Unix seconds, stored to 2 s)
+FSResult FatFSImpl::set_modified_time(const char* path, uint32_t modified_time) {
+    if (!mounted_) {
+        return FSResult::ERROR_NOT_MOUNTED;
+    }
+    
+    uint32_t fat_time = FileSys::unix_to_fat(modified_time);
+    if (fat_time == 0) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    FILINFO fno;
+    fno.fdate = static_cast<WORD>(fat_time >> 16);
+    fno.ftime = static_cast<WORD>(fat_time);
+    
+    FRESULT res = f_utime(path, &fno);
+    if (res == FR_OK) {
+        uint32_t name_hash;
+        uint16_t name_check;
+        uint8_t slot = locate_dir_index(path, name_hash, name_check);
+        if (slot != NO_DIR_INDEX) {
+            DirIndexEntry* entry = lookup_dir_index(dir_indexes_[slot], name_hash, name_check);
+            if (entry && entry->state == DIR_INDEX_VALID) {
+                entry->state = DIR_INDEX_STALE;
+            }
+        }
+    }
+    return convert_fatfs_error(res);
+}
+
 // Create a directory
 FSResult FatFSImpl::mkdir(const char* path) {
     if (!mounted_) {
@@ -263,6 +547,14 @@ FSResult FatFSImpl::mkdir(const char* path) {
     }
     
     FRESULT res = f_mkdir(path);
+    if (res == FR_OK) {
+        uint32_t name_hash;
+        uint16_t name_check;
+        uint8_t slot = locate_dir_index(path, name_hash, name_check);
+        if (slot != NO_DIR_INDEX) {
+            insert_dir_index(dir_indexes_[slot], name_hash, name_check, DIR_INDEX_STALE, nullptr);
+        }
+    }
     return convert_fatfs_error(res);
 }
 
@@ -273,9 +565,228 @@ FSResult FatFSImpl::rmdir(const char* path) {
     }
     
     FRESULT res = f_unlink(path); // f_unlink works for directories too
+    if (res == FR_OK) {
+        uint32_t name_hash;
+        uint16_t name_check;
+        uint8_t slot = locate_dir_index(path, name_hash, name_check);
+        if (slot != NO_DIR_INDEX) {
+            erase_dir_index(dir_indexes_[slot], name_hash, name_check);
+        }
+        note_dir_removal(path);
+        invalidate_dir_indexes(path);
+    }
     return convert_fatfs_error(res);
 }
 
+// Replace a file's content atomically. The new content is written and
+// synced under a temp name first; the commit point is then a single
+// directory sector write that points the original entry at the new
+// cluster chain. The old chain is handed to the temp entry and freed with it.
+FSResult FatFSImpl::atomic_replace(const char* path, ReplaceWriter writer, void* context) {
+    if (!mounted_) {
+        return FSResult::ERROR_NOT_MOUNTED;
+    }
+    
+    if (!writer) {
+        return FSResult::ERROR_INVALID;
+    }
+
+#if FF_FS_EXFAT
+    // exFAT keeps the chain in a stream extension entry swap_chain does not parse
+    if (fatfs_.fs_type == FS_EXFAT) {
+        return FSResult::ERROR_NOT_SUPPORTED;
+    }
+#endif
+    
+    char temp_path[MAX_PATH_LENGTH];
+    if (!FileSys::sibling_path(temp_path, sizeof(temp_path), path, REPLACE_TEMP_NAME)) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    // A temp left by a replacement interrupted by a reset holds either the
+    // unpublished new data or the old chain, never one the file still uses
+    FSResult result = remove(temp_path);
+    if (result != FSResult::OK && result != FSResult::ERROR_NO_ENT) {
+        return result;
+    }
+    
+    FileHandle temp;
+    result = open(temp, temp_path, OpenMode::WRITE | OpenMode::CREATE | OpenMode::TRUNC);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    result = writer(temp, context);
+    if (result == FSResult::OK) {
+        // New data and its FAT chain must be on the medium before the swap
+        result = sync(temp);
+    }
+    if (result != FSResult::OK) {
+        close(temp);
+        remove(temp_path);
+        return result;
+    }
+    
+    FileHandle target;
+    result = open(target, path, OpenMode::WRITE);
+    if (result == FSResult::ERROR_NO_ENT) {
+        // Nothing to replace: the rename's directory write publishes the file
+        close(temp);
+        return rename(temp_path, path);
+    }
+    
+    FileId target_id;
+    FileId temp_id;
+    if (result == FSResult::OK) {
+        result = get_handle_id(target, target_id);
+    }
+    if (result == FSResult::OK) {
+        result = get_handle_id(temp, temp_id);
+    }
+    if (result == FSResult::OK) {
+        // Both handles are clean, so closing them writes nothing
+        result = swap_chain(target_id, temp_id);
+        mark_dir_index_stale(target);
+    }
+    if (target.is_open) {
+        close(target);
+    }
+    close(temp);
+    
+    if (result != FSResult::OK) {
+        remove(temp_path);
+        return result;
+    }
+    
+    // The temp entry now owns the old chain
+    return remove(temp_path);
+}
+
+// Copy start cluster, size and modification time from one 32-byte
+// directory entry to another (bytes 20-21 and 22-31)
+static void copy_entry_chain(BYTE* to, const BYTE* from) {
+    memcpy(to + DIR_ENTRY_CLUST_HI, from + DIR_ENTRY_CLUST_HI, 2);
+    memcpy(to + DIR_ENTRY_MOD_TIME, from + DIR_ENTRY_MOD_TIME, DIR_ENTRY_SIZE - DIR_ENTRY_MOD_TIME);
+}
+
+// Exchange the cluster chains of the target and temp entries. When both
+// sit in one sector, one write swaps them. Otherwise the temp entry is
+// emptied first, then the target takes the new chain (the commit point),
+// then the temp takes the old one: a reset between those writes strands
+// one chain until a disk check, but never leaves two entries sharing one.
+FSResult FatFSImpl::swap_chain(const FileId& target, const FileId& temp) {
+    BYTE target_entry[DIR_ENTRY_SIZE];
+    BYTE temp_entry[DIR_ENTRY_SIZE];
+    FSResult result = read_dir_entry(target.sector, target.offset, target_entry);
+    if (result == FSResult::OK) {
+        result = read_dir_entry(temp.sector, temp.offset, temp_entry);
+    }
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    BYTE new_target[DIR_ENTRY_SIZE];
+    memcpy(new_target, target_entry, DIR_ENTRY_SIZE);
+    copy_entry_chain(new_target, temp_entry);
+    new_target[DIR_ENTRY_ATTR] |= AM_ARC;
+    
+    BYTE old_temp[DIR_ENTRY_SIZE];
+    memcpy(old_temp, temp_entry, DIR_ENTRY_SIZE);
+    copy_entry_chain(old_temp, target_entry);
+    
+    if (target.sector == temp.sector) {
+        return write_dir_entries(target.sector, target.offset, new_target, temp.offset, old_temp);
+    }
+    
+    BYTE empty_temp[DIR_ENTRY_SIZE];
+    memcpy(empty_temp, temp_entry, DIR_ENTRY_SIZE);
+    memset(empty_temp + DIR_ENTRY_CLUST_HI, 0, 2);
+    memset(empty_temp + DIR_ENTRY_CLUST_LO, 0, DIR_ENTRY_SIZE - DIR_ENTRY_CLUST_LO);
+    
+    result = write_dir_entries(temp.sector, temp.offset, empty_temp);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    result = write_dir_entries(target.sector, target.offset, new_target);
+    if (result != FSResult::OK) {
+        // Give the new chain back so removing the temp frees it
+        write_dir_entries(temp.sector, temp.offset, temp_entry);
+        return result;
+    }
+    return write_dir_entries(temp.sector, temp.offset, old_temp);
+}
+
+// Exchange the chains of every pair with a single directory sector write.
+// All entries must share one sector; a 512-byte sector holds 16, so this
+// covers a handful of short-named files in a small directory.
+FSResult FatFSImpl::swap_contents(const char* const* paths, const char* const* others, size_t count) {
+    if (!mounted_) {
+        return FSResult::ERROR_NOT_MOUNTED;
+    }
+    
+    static constexpr size_t MAX_PAIRS = FF_MAX_SS / DIR_ENTRY_SIZE / 2;
+    if (count == 0) {
+        return FSResult::OK;
+    }
+    if (!paths || !others) {
+        return FSResult::ERROR_INVALID;
+    }
+    if (count > MAX_PAIRS) {
+        return FSResult::ERROR_NOT_SUPPORTED;
+    }
+    
+    FileId ids[2 * MAX_PAIRS];
+    for (size_t i = 0; i < 2 * count; i++) {
+        const char* path = (i % 2 == 0) ? paths[i / 2] : others[i / 2];
+        FSResult result = get_file_id(path, ids[i]);
+        if (result != FSResult::OK) {
+            return result;
+        }
+        if (ids[i].sector != ids[0].sector) {
+            return FSResult::ERROR_NOT_SUPPORTED;
+        }
+        for (size_t j = 0; j < i; j++) {
+            if (ids[j].offset == ids[i].offset) {
+                return FSResult::ERROR_INVALID;
+            }
+        }
+    }
+    
+    BYTE entries[2 * MAX_PAIRS][DIR_ENTRY_SIZE];
+    uint16_t offsets[2 * MAX_PAIRS];
+    for (size_t i = 0; i < 2 * count; i++) {
+        offsets[i] = ids[i].offset;
+        FSResult result = read_dir_entry(ids[i].sector, ids[i].offset, entries[i]);
+        if (result != FSResult::OK) {
+            return result;
+        }
+    }
+    for (size_t i = 0; i < 2 * count; i += 2) {
+        BYTE first[DIR_ENTRY_SIZE];
+        memcpy(first, entries[i], DIR_ENTRY_SIZE);
+        copy_entry_chain(entries[i], entries[i + 1]);
+        copy_entry_chain(entries[i + 1], first);
+        entries[i][DIR_ENTRY_ATTR] |= AM_ARC;
+        entries[i + 1][DIR_ENTRY_ATTR] |= AM_ARC;
+    }
+    
+    FSResult result = write_dir_sector(ids[0].sector, offsets, entries[0], 2 * count);
+    
+    // Sizes and times changed under every name, whichever way the write went
+    for (size_t i = 0; i < 2 * count; i++) {
+        uint32_t name_hash;
+        uint16_t name_check;
+        uint8_t slot = locate_dir_index((i % 2 == 0) ? paths[i / 2] : others[i / 2], name_hash, name_check);
+        if (slot != NO_DIR_INDEX) {
+            DirIndexEntry* entry = lookup_dir_index(dir_indexes_[slot], name_hash, name_check);
+            if (entry && entry->state == DIR_INDEX_VALID) {
+                entry->state = DIR_INDEX_STALE;
+            }
+        }
+    }
+    return result;
+}
+
 // Open a directory
 FSResult FatFSImpl::opendir(DirHandle& handle, const char* path) {
     if (!mounted_) {
@@ -331,7 +842,7 @@ FSResult FatFSImpl::readdir(DirHandle& handle, FileInfo& info) {
         
         info.size = static_cast<uint32_t>(fno.fsize);
         info.is_directory = (fno.fattrib & AM_DIR) != 0;
-        info.modified_time = static_cast<uint32_t>(fno.fdate) << 16 | fno.ftime;
+        info.modified_time = FileSys::fat_to_unix(static_cast<uint32_t>(fno.fdate) << 16 | fno.ftime);
         
         return FSResult::OK;
     }
@@ -349,6 +860,616 @@ FSResult FatFSImpl::rewinddir(DirHandle& handle) {
     return convert_fatfs_error(res);
 }
 
+// Start a filtered directory search
+FSResult FatFSImpl::findfirst(DirHandle& handle, const char* path, const FindFilter& filter, FileInfo& info) {
+    if (!mounted_) {
+        return FSResult::ERROR_NOT_MOUNTED;
+    }
+    
+    if (handle.is_open) {
+        return FSResult::ERROR_BAD_FILE;
+    }
+    
+    FILINFO fno;
+#if FF_USE_FIND
+    // Let FatFS match the name pattern while it scans the directory entries
+    FRESULT res = f_findfirst(&handle.fat_dir, &fno, path, filter.pattern ? filter.pattern : "*");
+#else
+    FRESULT res = f_opendir(&handle.fat_dir, path);
+    if (res == FR_OK) {
+        res = f_readdir(&handle.fat_dir, &fno);
+        if (res != FR_OK) {
+            f_closedir(&handle.fat_dir);
+        }
+    }
+#endif
+    
+    if (res != FR_OK) {
+        return convert_fatfs_error(res);
+    }
+    
+    handle.is_open = true;
+    handle.fs_impl = this;
+    handle.filter = filter;
+    
+    return find_match(handle, fno, info);
+}
+
+// Continue a filtered directory search
+FSResult FatFSImpl::findnext(DirHandle& handle, FileInfo& info) {
+    if (!handle.is_open || handle.fs_impl != this) {
+        return FSResult::ERROR_BAD_FILE;
+    }
+    
+    FILINFO fno;
+#if FF_USE_FIND
+    FRESULT res = f_findnext(&handle.fat_dir, &fno);
+#else
+    FRESULT res = f_readdir(&handle.fat_dir, &fno);
+#endif
+    
+    if (res != FR_OK) {
+        return convert_fatfs_error(res);
+    }
+    
+    return find_match(handle, fno, info);
+}
+
+// Skip entries rejected by the filter, then fill in the first accepted one
+FSResult FatFSImpl::find_match(DirHandle& handle, FILINFO& fno, FileInfo& info) {
+    const FindFilter& filter = handle.filter;
+    
+    while (fno.fname[0] != '\0') {
+        bool is_directory = (fno.fattrib & AM_DIR) != 0;
+        uint32_t modified_time = FileSys::fat_to_unix(static_cast<uint32_t>(fno.fdate) << 16 | fno.ftime);
+        
+        if (
+#if !FF_USE_FIND
+            FileSys::match_pattern(filter.pattern, fno.fname) &&
+#endif
+            filter.accepts(static_cast<uint32_t>(fno.fsize), is_directory, modified_time)) {
+            strncpy(info.name, fno.fname, MAX_FILENAME_LENGTH - 1);
+            info.name[MAX_FILENAME_LENGTH - 1] = '\0';
+            
+            info.size = static_cast<uint32_t>(fno.fsize);
+            info.is_directory = is_directory;
+            info.modified_time = modified_time;
+            
+            return FSResult::OK;
+        }
+
+#if FF_USE_FIND
+        FRESULT res = f_findnext(&handle.fat_dir, &fno);
+#else
+        FRESULT res = f_readdir(&handle.fat_dir, &fno);
+#endif
+        if (res != FR_OK) {
+            return convert_fatfs_error(res);
+        }
+    }
+    
+    // End of directory
+    info.name[0] = '\0';
+    return FSResult::OK;
+}
+
+// Register a caller-owned index for one directory
+FSResult FatFSImpl::enable_dir_index(const char* dir_path, DirIndexEntry* slots, size_t slot_count) {
+    if (!dir_path || !slots || slot_count < 2 || (slot_count & (slot_count - 1)) != 0) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    size_t length = dir_path_length(dir_path);
+    if (length >= MAX_PATH_LENGTH || !canonical_path(dir_path, length)) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    DirIndex* target = nullptr;
+    for (size_t i = 0; i < MAX_DIR_INDEXES; i++) {
+        DirIndex& index = dir_indexes_[i];
+        if (index.slots && strlen(index.path) == length && same_path_prefix(index.path, dir_path, length)) {
+            target = &index; // Re-registering replaces the storage
+            break;
+        }
+        if (!index.slots && !target) {
+            target = &index;
+        }
+    }
+    if (!target) {
+        return FSResult::ERROR_NO_MEM;
+    }
+    
+    memcpy(target->path, dir_path, length);
+    target->path[length] = '\0';
+    target->slots = slots;
+    target->slot_count = slot_count;
+    target->used = 0;
+    target->deleted = 0;
+    target->excess = 0;
+    target->built = false; // Built on first lookup
+    target->overflowed = false;
+    
+    return FSResult::OK;
+}
+
+// Drop the index for a directory
+FSResult FatFSImpl::disable_dir_index(const char* dir_path) {
+    if (!dir_path) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    size_t length = dir_path_length(dir_path);
+    for (size_t i = 0; i < MAX_DIR_INDEXES; i++) {
+        DirIndex& index = dir_indexes_[i];
+        if (index.slots && strlen(index.path) == length && same_path_prefix(index.path, dir_path, length)) {
+            index.slots = nullptr;
+            index.built = false;
+            return FSResult::OK;
+        }
+    }
+    
+    return FSResult::ERROR_NO_ENT;
+}
+
+// Find the index covering a path's parent directory and key its leaf name.
+// Builds the index on first use; returns NO_DIR_INDEX when none applies.
+uint8_t FatFSImpl::locate_dir_index(const char* path, uint32_t& name_hash, uint16_t& name_check) {
+    // Any other spelling of an indexed entry ("0:/d/f", "/d//f", "d/f.", a
+    // relative path) would get past the upkeep callers do with the slot, so
+    // drop every index and let the next canonical lookup rebuild
+    if (!canonical_path(path, strlen(path))) {
+        invalidate_dir_indexes(nullptr);
+        return NO_DIR_INDEX;
+    }
+    
+    const char* leaf = strrchr(path, '/');
+    size_t dir_length = leaf ? static_cast<size_t>(leaf - path) : 0;
+    leaf = leaf ? leaf + 1 : path;
+    
+    // Generated short names ("LONGNA~1.TXT") may alias entries we only know
+    // by their long name, so never answer for them from the index. Nor for
+    // names beyond ASCII, which FatFS compares with its own case folding.
+    if (*leaf == '\0' || strchr(leaf, '~') || !ascii_name(leaf)) {
+        return NO_DIR_INDEX;
+    }
+    
+    for (size_t i = 0; i < MAX_DIR_INDEXES; i++) {
+        DirIndex& index = dir_indexes_[i];
+        if (!index.slots || index.overflowed || strlen(index.path) != dir_length ||
+            !same_path_prefix(index.path, path, dir_length)) {
+            continue;
+        }
+        
+        if (!index.built && build_dir_index(index) != FSResult::OK) {
+            return NO_DIR_INDEX;
+        }
+        
+        name_hash = hash_name(leaf, name_check);
+        return static_cast<uint8_t>(i);
+    }
+    
+    return NO_DIR_INDEX;
+}
+
+// Find the slot holding a name key (open addressing, linear probing)
+DirIndexEntry* FatFSImpl::lookup_dir_index(DirIndex& index, uint32_t name_hash, uint16_t name_check) {
+    size_t mask = index.slot_count - 1;
+    size_t i = name_hash & mask;
+    
+    for (size_t probe = 0; probe < index.slot_count; probe++, i = (i + 1) & mask) {
+        DirIndexEntry& entry = index.slots[i];
+        if (entry.state == DIR_INDEX_EMPTY) {
+            return nullptr;
+        }
+        if (entry.state != DIR_INDEX_DELETED && entry.name_hash == name_hash && entry.name_check == name_check) {
+            return &entry;
+        }
+    }
+    
+    return nullptr;
+}
+
+// Add or refresh an entry. Tombstones are reclaimed when the table fills;
+// returns false if the live entries alone are too many to keep probe chains
+// short, after which the index is off until enough entries are removed.
+bool FatFSImpl::insert_dir_index(DirIndex& index, uint32_t name_hash, uint16_t name_check,
+                                 uint8_t state, const FILINFO* fno) {
+    DirIndexEntry* entry = lookup_dir_index(index, name_hash, name_check);
+    
+    if (!entry) {
+        if ((index.used + 1) * 4 > index.slot_count * 3 && index.deleted != 0) {
+            compact_dir_index(index);
+        }
+        if ((index.used + 1) * 4 > index.slot_count * 3) {
+            index.overflowed = true;
+            index.excess = 1;
+            return false;
+        }
+        
+        size_t mask = index.slot_count - 1;
+        size_t i = name_hash & mask;
+        while (index.slots[i].state != DIR_INDEX_EMPTY && index.slots[i].state != DIR_INDEX_DELETED) {
+            i = (i + 1) & mask;
+        }
+        if (index.slots[i].state == DIR_INDEX_EMPTY) {
+            index.used++;
+        } else {
+            index.deleted--;
+        }
+        entry = &index.slots[i];
+        entry->name_hash = name_hash;
+        entry->name_check = name_check;
+    }
+    
+    entry->state = state;
+    if (fno) {
+        entry->size = static_cast<uint32_t>(fno->fsize);
+        entry->attr = fno->fattrib;
+        entry->fdate = fno->fdate;
+        entry->ftime = fno->ftime;
+    }
+    return true;
+}
+
+// Forget a name, leaving a tombstone so later probe chains stay intact.
+// Once tombstones take a quarter of the table they cost every miss a
+// longer probe, so the table is rehashed without them.
+void FatFSImpl::erase_dir_index(DirIndex& index, uint32_t name_hash, uint16_t name_check) {
+    DirIndexEntry* entry = lookup_dir_index(index, name_hash, name_check);
+    if (entry) {
+        entry->state = DIR_INDEX_DELETED;
+        if (++index.deleted * 4 > index.slot_count) {
+            compact_dir_index(index);
+        }
+    }
+}
+
+// Rehash the live entries in place, dropping tombstones. Live entries are
+// first flagged as unplaced; each is then moved to the first free or
+// unplaced slot on its probe path, displacing an unplaced entry there to
+// be placed next. Placed slots never move again, so every probe path only
+// crosses placed entries and lookups stay correct.
+void FatFSImpl::compact_dir_index(DirIndex& index) {
+    static constexpr uint8_t UNPLACED = 0x80;
+    size_t mask = index.slot_count - 1;
+    
+    for (size_t i = 0; i < index.slot_count; i++) {
+        DirIndexEntry& slot = index.slots[i];
+        if (slot.state == DIR_INDEX_DELETED) {
+            slot.state = DIR_INDEX_EMPTY;
+        } else if (slot.state != DIR_INDEX_EMPTY) {
+            slot.state |= UNPLACED;
+        }
+    }
+    
+    index.used = 0;
+    index.deleted = 0;
+    for (size_t i = 0; i < index.slot_count; i++) {
+        if (!(index.slots[i].state & UNPLACED)) {
+            continue;
+        }
+        DirIndexEntry moving = index.slots[i];
+        index.slots[i].state = DIR_INDEX_EMPTY;
+        for (;;) {
+            moving.state &= static_cast<uint8_t>(~UNPLACED);
+            size_t j = moving.name_hash & mask;
+            while (index.slots[j].state != DIR_INDEX_EMPTY && !(index.slots[j].state & UNPLACED)) {
+                j = (j + 1) & mask;
+            }
+            DirIndexEntry displaced = index.slots[j];
+            index.slots[j] = moving;
+            index.used++;
+            if (displaced.state == DIR_INDEX_EMPTY) {
+                break;
+            }
+            moving = displaced;
+        }
+    }
+}
+
+// An entry left path's parent directory. An index that overflowed there
+// is rebuilt on its next lookup once as many entries have gone as did not
+// fit, so a directory that shrinks gets its index back.
+void FatFSImpl::note_dir_removal(const char* path) {
+    const char* leaf = strrchr(path, '/');
+    size_t dir_length = leaf ? static_cast<size_t>(leaf - path) : 0;
+    
+    for (size_t i = 0; i < MAX_DIR_INDEXES; i++) {
+        DirIndex& index = dir_indexes_[i];
+        if (index.slots && index.overflowed && strlen(index.path) == dir_length &&
+            same_path_prefix(index.path, path, dir_length) && --index.excess == 0) {
+            index.built = false;
+            index.overflowed = false;
+        }
+    }
+}
+
+// Force a rebuild of indexes whose directory is path or lies beneath it
+// (nullptr matches all), e.g. after a directory was removed or renamed
+void FatFSImpl::invalidate_dir_indexes(const char* path) {
+    size_t length = path ? dir_path_length(path) : 0;
+    
+    for (size_t i = 0; i < MAX_DIR_INDEXES; i++) {
+        DirIndex& index = dir_indexes_[i];
+        if (!index.slots) {
+            continue;
+        }
+        if (path && !(strlen(index.path) >= length && same_path_prefix(index.path, path, length) &&
+                      (index.path[length] == '\0' || index.path[length] == '/'))) {
+            continue;
+        }
+        index.built = false;
+        index.overflowed = false;
+    }
+}
+
+// Fill an index from one pass over the directory
+FSResult FatFSImpl::build_dir_index(DirIndex& index) {
+    memset(index.slots, 0, index.slot_count * sizeof(DirIndexEntry));
+    index.used = 0;
+    index.deleted = 0;
+    index.excess = 0;
+    index.overflowed = false;
+    
+    DIR dir;
+    FRESULT res = f_opendir(&dir, index.path[0] ? index.path : "/");
+    if (res != FR_OK) {
+        return convert_fatfs_error(res);
+    }
+    
+    // Past overflow, keep reading to count the entries that did not fit
+    FILINFO fno;
+    size_t excess = 0;
+    while ((res = f_readdir(&dir, &fno)) == FR_OK && fno.fname[0] != '\0') {
+        if (!ascii_name(fno.fname)) {
+            continue; // Never looked up (see locate_dir_index)
+        }
+        uint16_t name_check;
+        uint32_t name_hash = hash_name(fno.fname, name_check);
+        if (index.overflowed || !insert_dir_index(index, name_hash, name_check, DIR_INDEX_VALID, &fno)) {
+            excess++;
+        }
+    }
+    f_closedir(&dir);
+    index.excess = excess;
+    
+    if (res != FR_OK) {
+        return convert_fatfs_error(res);
+    }
+    if (index.overflowed) {
+        return FSResult::ERROR_NO_MEM;
+    }
+    
+    index.built = true;
+    return FSResult::OK;
+}
+
+// Flag the index entry of a file whose directory entry was just written
+void FatFSImpl::mark_dir_index_stale(FileHandle& handle) {
+    if (handle.dir_index == ALL_DIR_INDEXES) {
+        // Opened by ID or by another spelling: the name is unknown, so
+        // rescan lazily
+        invalidate_dir_indexes(nullptr);
+    } else if (handle.dir_index != NO_DIR_INDEX) {
+        DirIndexEntry* entry = lookup_dir_index(dir_indexes_[handle.dir_index], handle.name_hash, handle.name_check);
+        if (entry && entry->state == DIR_INDEX_VALID) {
+            entry->state = DIR_INDEX_STALE;
+        }
+    }
+}
+
+// Resolve a path once and return the ID of its directory entry
+FSResult FatFSImpl::get_file_id(const char* path, FileId& id) {
+    if (!mounted_) {
+        return FSResult::ERROR_NOT_MOUNTED;
+    }
+    
+    // A read-only open records the entry location; closing it writes nothing
+    FileHandle handle;
+    FSResult result = open(handle, path, OpenMode::READ);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    result = get_handle_id(handle, id);
+    close(handle);
+    
+    return result;
+}
+
+// Return the ID of an open file's directory entry
+FSResult FatFSImpl::get_handle_id(FileHandle& handle, FileId& id) {
+    if (!handle.is_open || handle.fs_impl != this) {
+        return FSResult::ERROR_BAD_FILE;
+    }
+
+#if FF_FS_EXFAT
+    if (fatfs_.fs_type == FS_EXFAT) {
+        return FSResult::ERROR_NOT_SUPPORTED;
+    }
+#endif
+    
+    uint32_t sector = static_cast<uint32_t>(handle.fat_file.dir_sect);
+    uint16_t offset = static_cast<uint16_t>(handle.fat_file.dir_ptr - fatfs_.win);
+    
+    BYTE entry[DIR_ENTRY_SIZE];
+    FSResult result = read_dir_entry(sector, offset, entry);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    id.sector = sector;
+    id.offset = offset;
+    id.reserved = 0;
+    id.tag = entry_tag(entry);
+    
+    return FSResult::OK;
+}
+
+// Open a file straight from its directory entry, skipping path resolution.
+// The FIL is filled in exactly as f_open leaves it after finding the entry.
+FSResult FatFSImpl::open_by_id(FileHandle& handle, const FileId& id, OpenMode mode) {
+    if (!mounted_) {
+        return FSResult::ERROR_NOT_MOUNTED;
+    }
+    
+    if (handle.is_open) {
+        return FSResult::ERROR_BAD_FILE;
+    }
+
+#if FF_FS_LOCK
+    // The open-file lock table is private to ff.c
+    return FSResult::ERROR_NOT_SUPPORTED;
+#else
+#if FF_FS_EXFAT
+    if (fatfs_.fs_type == FS_EXFAT) {
+        return FSResult::ERROR_NOT_SUPPORTED;
+    }
+#endif
+    
+    uint8_t mode_bits = static_cast<uint8_t>(mode);
+    if (mode_bits & (static_cast<uint8_t>(OpenMode::CREATE) | static_cast<uint8_t>(OpenMode::EXCL))) {
+        return FSResult::ERROR_INVALID;
+    }
+    bool write_flag = (mode_bits & static_cast<uint8_t>(OpenMode::WRITE)) != 0;
+    
+    BYTE entry[DIR_ENTRY_SIZE];
+    FSResult result = read_dir_entry(id.sector, id.offset, entry);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    // Stale IDs: slot freed, reused by another name, or not a plain file
+    BYTE attr = entry[DIR_ENTRY_ATTR];
+    if (entry[0] == ENTRY_FREE || entry[0] == ENTRY_DELETED || (attr & ATTR_LFN) == ATTR_LFN ||
+        (attr & ATTR_VOLUME) || entry_tag(entry) != id.tag) {
+        return FSResult::ERROR_NO_ENT;
+    }
+    if (attr & AM_DIR) {
+        return FSResult::ERROR_IS_DIR;
+    }
+    if (write_flag && (attr & AM_RDO)) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    DWORD cluster = static_cast<DWORD>(entry[DIR_ENTRY_CLUST_LO]) | static_cast<DWORD>(entry[DIR_ENTRY_CLUST_LO + 1]) << 8;
+    if (fatfs_.fs_type == FS_FAT32) {
+        cluster |= (static_cast<DWORD>(entry[DIR_ENTRY_CLUST_HI]) | static_cast<DWORD>(entry[DIR_ENTRY_CLUST_HI + 1]) << 8) << 16;
+    }
+    DWORD size = static_cast<DWORD>(entry[DIR_ENTRY_SIZE_FIELD]) |
+                 static_cast<DWORD>(entry[DIR_ENTRY_SIZE_FIELD + 1]) << 8 |
+                 static_cast<DWORD>(entry[DIR_ENTRY_SIZE_FIELD + 2]) << 16 |
+                 static_cast<DWORD>(entry[DIR_ENTRY_SIZE_FIELD + 3]) << 24;
+    
+    FIL& fp = handle.fat_file;
+    memset(&fp, 0, sizeof(FIL));
+    fp.obj.fs = &fatfs_;
+    fp.obj.id = fatfs_.id;
+    fp.obj.attr = attr;
+    fp.obj.sclust = cluster;
+    fp.obj.objsize = size;
+    fp.flag = static_cast<BYTE>((mode_bits & static_cast<uint8_t>(OpenMode::READ) ? FA_READ : 0) |
+                                (write_flag ? FA_WRITE : 0));
+    fp.dir_sect = id.sector;
+    fp.dir_ptr = fatfs_.win + id.offset;
+    
+    handle.is_open = true;
+    handle.fs_impl = this;
+    // The entry's name is unknown here, so writes refresh every index
+    handle.dir_index = write_flag ? ALL_DIR_INDEXES : NO_DIR_INDEX;
+    
+    FRESULT res = FR_OK;
+    if (write_flag && (mode_bits & static_cast<uint8_t>(OpenMode::TRUNC))) {
+        res = f_truncate(&fp);
+    } else if (mode_bits & static_cast<uint8_t>(OpenMode::APPEND)) {
+        res = f_lseek(&fp, f_size(&fp));
+    }
+    if (res != FR_OK) {
+        close(handle);
+    }
+    
+    return convert_fatfs_error(res);
+#endif
+}
+
+// Check that a sector/offset pair addresses one 32-byte directory entry
+bool FatFSImpl::valid_dir_entry(uint32_t sector, uint16_t offset) {
+#if FF_MAX_SS == FF_MIN_SS
+    UINT sector_size = FF_MAX_SS;
+#else
+    UINT sector_size = fatfs_.ssize;
+#endif
+    
+    // Directory sectors live in the FAT12/16 root area or the data area
+    LBA_t first = (fatfs_.fs_type == FS_FAT32) ? fatfs_.database : fatfs_.dirbase;
+    LBA_t last = fatfs_.database + static_cast<LBA_t>(fatfs_.n_fatent - 2) * fatfs_.csize;
+    return (offset % DIR_ENTRY_SIZE) == 0 && offset + DIR_ENTRY_SIZE <= sector_size &&
+           sector >= first && sector < last;
+}
+
+// Read one 32-byte directory entry, through the volume window when it
+// already holds the sector (it may carry unwritten changes)
+FSResult FatFSImpl::read_dir_entry(uint32_t sector, uint16_t offset, BYTE* entry) {
+    if (!valid_dir_entry(sector, offset)) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    if (fatfs_.winsect == sector) {
+        memcpy(entry, fatfs_.win + offset, DIR_ENTRY_SIZE);
+        return FSResult::OK;
+    }
+    
+    BYTE buffer[FF_MAX_SS];
+    if (disk_read(fatfs_.pdrv, buffer, static_cast<LBA_t>(sector), 1) != RES_OK) {
+        return FSResult::ERROR_IO;
+    }
+    memcpy(entry, buffer + offset, DIR_ENTRY_SIZE);
+    
+    return FSResult::OK;
+}
+
+// Store one or two entries of a directory sector with a single sector write
+FSResult FatFSImpl::write_dir_entries(uint32_t sector, uint16_t offset, const BYTE* entry,
+                                      uint16_t second_offset, const BYTE* second_entry) {
+    uint16_t offsets[2] = { offset, second_offset };
+    BYTE entries[2][DIR_ENTRY_SIZE];
+    memcpy(entries[0], entry, DIR_ENTRY_SIZE);
+    if (second_entry) {
+        memcpy(entries[1], second_entry, DIR_ENTRY_SIZE);
+    }
+    return write_dir_sector(sector, offsets, entries[0], second_entry ? 2 : 1);
+}
+
+// Store count consecutive 32-byte entries at the given offsets of one
+// directory sector with a single sector write and flush the device. The
+// volume window is patched along with it when it holds the sector, so
+// FatFS keeps seeing the current entries.
+FSResult FatFSImpl::write_dir_sector(uint32_t sector, const uint16_t* offsets, const BYTE* entries, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (!valid_dir_entry(sector, offsets[i])) {
+            return FSResult::ERROR_INVALID;
+        }
+    }
+    
+    BYTE buffer[FF_MAX_SS];
+    BYTE* data = buffer;
+    if (fatfs_.winsect == sector) {
+        data = fatfs_.win;
+    } else if (disk_read(fatfs_.pdrv, buffer, static_cast<LBA_t>(sector), 1) != RES_OK) {
+        return FSResult::ERROR_IO;
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        memcpy(data + offsets[i], entries + i * DIR_ENTRY_SIZE, DIR_ENTRY_SIZE);
+    }
+    if (disk_write(fatfs_.pdrv, data, static_cast<LBA_t>(sector), 1) != RES_OK ||
+        disk_ioctl(fatfs_.pdrv, CTRL_SYNC, nullptr) != RES_OK) {
+        return FSResult::ERROR_IO;
+    }
+    
+    return FSResult::OK;
+}
+
 // Get free space
 FSResult FatFSImpl::get_free_space(uint64_t& free_bytes) {
     if (!mounted_) {
@@ -455,4 +1576,13 @@ BYTE FatFSImpl::convert_open_mode(OpenMode mode) {
     return fat_mode;
 }
 
-} // namespace EmbeddedFS
\ No newline at end of file
+} // namespace EmbeddedFS
+
+#if !FF_FS_READONLY && !FF_FS_NORTC
+// FatFS timestamp callback, fed by FileSys::set_time_source; without a
+// clock new entries get the FAT epoch, 1980-01-01 00:00:00
+extern "C" DWORD get_fattime(void) {
+    uint32_t fat_time = EmbeddedFS::FileSys::unix_to_fat(EmbeddedFS::FileSys::current_time());
+    return fat_time ? fat_time : (1u << 21) | (1u << 16);
+}
+#endif
\ No newline at end of file
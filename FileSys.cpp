@@ -0,0 +1,1109 @@
+#include "FileSys.h"
+#include "ChangeFeed.h"
+#include <atomic>
+#include <cstring>
+
+namespace EmbeddedFS {
+
+static char fold_ascii(char c) {
+    return c >= 'a' && c <= 'z' ? static_cast<char>(c - 'a' + 'A') : c;
+}
+
+// Match a name against a glob pattern ('*' any run, '?' any single
+// character), ignoring ASCII case like FAT name lookups
+bool FileSys::match_pattern(const char* pattern, const char* name) {
+    if (!pattern) {
+        return true;
+    }
+    
+    const char* star = nullptr;
+    const char* resume = nullptr;
+    
+    while (*name) {
+        if (*pattern == '*') {
+            // Remember the star and first try matching an empty run
+            star = pattern++;
+            resume = name;
+        } else if (*pattern == '?' || fold_ascii(*pattern) == fold_ascii(*name)) {
+            pattern++;
+            name++;
+        } else if (star) {
+            // Backtrack: let the last star swallow one more character
+            pattern = star + 1;
+            name = ++resume;
+        } else {
+            return false;
+        }
+    }
+    
+    // Only trailing stars may remain
+    while (*pattern == '*') {
+        pattern++;
+    }
+    
+    return *pattern == '\0';
+}
+
+// Join a directory and an entry name; out may be the same buffer as dir
+bool FileSys::join_path(char* out, size_t out_size, const char* dir, const char* name) {
+    size_t dir_length = strlen(dir);
+    size_t name_length = strlen(name);
+    bool needs_slash = dir_length > 0 && dir[dir_length - 1] != '/';
+    size_t total = dir_length + (needs_slash ? 1 : 0) + name_length;
+    
+    if (total >= out_size) {
+        return false;
+    }
+    
+    if (out != dir) {
+        memcpy(out, dir, dir_length);
+    }
+    if (needs_slash) {
+        out[dir_length++] = '/';
+    }
+    memcpy(out + dir_length, name, name_length + 1);
+    
+    return true;
+}
+
+// Build the path of another entry in the same directory as path
+bool FileSys::sibling_path(char* out, size_t out_size, const char* path, const char* name) {
+    const char* slash = strrchr(path, '/');
+    size_t dir_length = slash ? static_cast<size_t>(slash - path) + 1 : 0;
+    size_t name_length = strlen(name);
+    
+    if (dir_length + name_length >= out_size) {
+        return false;
+    }
+    
+    memmove(out, path, dir_length);
+    memcpy(out + dir_length, name, name_length + 1);
+    
+    return true;
+}
+
+// Standard CRC-32 (reflected, polynomial 0xEDB88320), nibble table driven.
+// Start with crc = 0 and feed the previous result to continue a stream.
+uint32_t FileSys::crc32(uint32_t crc, const void* data, size_t size) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+        0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+        0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+    
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = (crc >> 4) ^ table[(crc ^ bytes[i]) & 0x0f];
+        crc = (crc >> 4) ^ table[(crc ^ (bytes[i] >> 4)) & 0x0f];
+    }
+    return ~crc;
+}
+
+static TimeSource time_source = nullptr;
+static void* time_source_context = nullptr;
+
+void FileSys::set_time_source(TimeSource source, void* context) {
+    time_source = source;
+    time_source_context = context;
+}
+
+uint32_t FileSys::current_time() {
+    return time_source ? time_source(time_source_context) : 0;
+}
+
+// Days before each month of a common year, indexed by FAT month (1..12);
+// the spare slots keep bad month fields inside the table
+static const uint16_t days_before_month[16] = {
+    0, 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365, 365, 365,
+};
+
+static constexpr uint32_t DAYS_1970_TO_1980 = 3652;
+static constexpr uint32_t FAT_YEARS = 128;                  // 1980..2107
+
+// Days from 1980-01-01 to the start of FAT year (years since 1980). Every
+// fourth year is a leap year except 2100 (year 120).
+static uint32_t days_before_year(uint32_t year) {
+    return year * 365 + (year + 3) / 4 - (year > 120 ? 1 : 0);
+}
+
+static uint32_t leap_day(uint32_t year, uint32_t month) {
+    return (year & 3) == 0 && year != 120 && month > 2 ? 1 : 0;
+}
+
+// Last date converted in each direction, as key << 16 | value in one word so
+// that readers never see half an update. Listings and timestamps mostly
+// repeat the same day, so the calendar arithmetic is usually skipped.
+static std::atomic<uint32_t> fat_date_cache(0);            // FAT date -> days since 1970
+static std::atomic<uint32_t> unix_day_cache(0);            // Days since 1970 -> FAT date
+
+uint32_t FileSys::fat_to_unix(uint32_t fat_time) {
+    uint32_t date = fat_time >> 16;
+    if (date == 0) {
+        return 0;
+    }
+    
+    uint32_t days;
+    uint32_t cached = fat_date_cache.load(std::memory_order_relaxed);
+    if ((cached >> 16) == date) {
+        days = cached & 0xffff;
+    } else {
+        uint32_t year = date >> 9;
+        uint32_t month = (date >> 5) & 0x0f;
+        days = DAYS_1970_TO_1980 + days_before_year(year) + days_before_month[month] + leap_day(year, month) +
+               (date & 0x1f) - 1;
+        fat_date_cache.store(date << 16 | (days & 0xffff), std::memory_order_relaxed);
+    }
+    
+    uint32_t time = fat_time & 0xffff;
+    return days * 86400 + (time >> 11) * 3600 + ((time >> 5) & 0x3f) * 60 + (time & 0x1f) * 2;
+}
+
+uint32_t FileSys::unix_to_fat(uint32_t unix_time) {
+    uint32_t days = unix_time / 86400;
+    if (days < DAYS_1970_TO_1980 || days >= DAYS_1970_TO_1980 + days_before_year(FAT_YEARS)) {
+        return 0;
+    }
+    
+    uint32_t date;
+    uint32_t cached = unix_day_cache.load(std::memory_order_relaxed);
+    if ((cached >> 16) == days) {
+        date = cached & 0xffff;
+    } else {
+        // The four-year estimate is exact up to 2100 and at most one short after
+        uint32_t day = days - DAYS_1970_TO_1980;
+        uint32_t year = day * 4 / 1461;
+        year += days_before_year(year + 1) <= day ? 1 : 0;
+        day -= days_before_year(year);
+        
+        // Months are 28..31 days, so day / 32 is the month or the one before
+        uint32_t month = day / 32 + 1;
+        month += days_before_month[month + 1] + leap_day(year, month + 1) <= day ? 1 : 0;
+        day -= days_before_month[month] + leap_day(year, month);
+        
+        date = year << 9 | month << 5 | (day + 1);
+        unix_day_cache.store(days << 16 | date, std::memory_order_relaxed);
+    }
+    
+    uint32_t second = unix_time % 86400;
+    return date << 16 | (second / 3600) << 11 | (second / 60 % 60) << 5 | (second % 60) / 2;
+}
+
+// LittleFS tuning targets per workload, before fitting the caller's buffers:
+//                 cache                  metadata_max      inline_max       lookahead window
+//   SMALL_FILES   metadata_max / 8,      block, <= 16 KiB  whole cache      256 blocks
+//                 <= 1 KiB
+//   STREAMING     block, <= 4 KiB        block, <= 4 KiB   max(prog_size,   4096 blocks
+//                                                              256 bytes)
+// littlefs wants caches that are multiples of read_size and prog_size and
+// divide block_size, inline_max within cache_size, attr_max and
+// metadata_max / 8, and a lookahead of whole 8-byte words.
+struct LfsTuning {
+    uint32_t unit;                  // Smallest valid cache
+    uint32_t cache_size;
+    uint32_t lookahead_size;
+    uint32_t metadata_max;
+    uint32_t inline_max;
+};
+
+// Largest cache of at most target bytes that littlefs accepts, or 0
+static uint32_t lfs_cache_size(const lfs_config_t& config, uint32_t unit, uint32_t target) {
+    for (uint32_t size = target / unit * unit; size >= unit; size -= unit) {
+        if (config.block_size % size == 0) {
+            return size;
+        }
+    }
+    return 0;
+}
+
+static uint32_t lfs_inline_max(const lfs_config_t& config, LfsWorkload workload, const LfsTuning& tuning) {
+    uint32_t limit = tuning.cache_size < tuning.metadata_max / 8 ? tuning.cache_size : tuning.metadata_max / 8;
+    if (limit > LFS_ATTR_MAX) {
+        limit = LFS_ATTR_MAX;
+    }
+    uint32_t streaming_max = config.prog_size > 256 ? config.prog_size : 256;
+    if (workload == LfsWorkload::STREAMING && limit > streaming_max) {
+        limit = streaming_max;
+    }
+    return limit;
+}
+
+static bool lfs_tuning(const lfs_config_t& config, LfsWorkload workload, LfsTuning& tuning) {
+    if (config.read_size == 0 || config.prog_size == 0 || config.block_size == 0 || config.block_count == 0) {
+        return false;
+    }
+    
+    // Least common multiple of the read and program sizes
+    uint32_t a = config.read_size;
+    uint32_t b = config.prog_size;
+    while (b != 0) {
+        uint32_t r = a % b;
+        a = b;
+        b = r;
+    }
+    tuning.unit = config.read_size / a * config.prog_size;
+    if (config.block_size % tuning.unit != 0) {
+        return false;
+    }
+    
+    bool small_files = workload == LfsWorkload::SMALL_FILES;
+    uint32_t metadata_cap = small_files ? 16384 : 4096;
+    tuning.metadata_max = config.block_size;
+    if (config.block_size > metadata_cap && metadata_cap >= config.prog_size) {
+        tuning.metadata_max = metadata_cap / config.prog_size * config.prog_size;
+    }
+    
+    uint32_t cache_target = small_files ? tuning.metadata_max / 8 : 4096;
+    if (cache_target > (small_files ? 1024u : config.block_size)) {
+        cache_target = small_files ? 1024 : config.block_size;
+    }
+    tuning.cache_size = lfs_cache_size(config, tuning.unit, cache_target);
+    if (tuning.cache_size == 0) {
+        tuning.cache_size = tuning.unit;
+    }
+    
+    // Blocks the allocator scans per pass
+    uint32_t window = small_files ? 256 : 4096;
+    if (window > config.block_count) {
+        window = config.block_count;
+    }
+    tuning.lookahead_size = (window + 63) / 64 * 8;
+    
+    tuning.inline_max = lfs_inline_max(config, workload, tuning);
+    return true;
+}
+
+size_t FileSys::littlefs_buffer_size(const lfs_config_t& config, LfsWorkload workload) {
+    LfsTuning tuning;
+    if (!lfs_tuning(config, workload, tuning)) {
+        return 0;
+    }
+    
+    // Room to align the lookahead buffer too
+    return 2 * static_cast<size_t>(tuning.cache_size) + tuning.lookahead_size + 3;
+}
+
+FSResult FileSys::tune_littlefs(lfs_config_t& config, LfsWorkload workload, uint8_t* buffers, size_t buffers_size) {
+    LfsTuning tuning;
+    if (!buffers || !lfs_tuning(config, workload, tuning)) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    // The lookahead buffer comes first and must be 32-bit aligned
+    size_t skip = (4 - reinterpret_cast<uintptr_t>(buffers) % 4) % 4;
+    size_t available = buffers_size > skip ? buffers_size - skip : 0;
+    
+    // Short of room, halve the caches first: a narrower lookahead costs
+    // allocator scans on every pass, smaller caches only transfer length
+    while (2 * static_cast<size_t>(tuning.cache_size) + tuning.lookahead_size > available) {
+        if (tuning.cache_size > tuning.unit) {
+            uint32_t smaller = lfs_cache_size(config, tuning.unit, tuning.cache_size / 2);
+            tuning.cache_size = smaller ? smaller : tuning.unit;
+        } else if (tuning.lookahead_size > 8) {
+            tuning.lookahead_size = 8;
+        } else {
+            return FSResult::ERROR_NO_MEM;
+        }
+    }
+    tuning.inline_max = lfs_inline_max(config, workload, tuning);
+    
+    uint8_t* next = buffers + skip;
+    config.lookahead_size = tuning.lookahead_size;
+    config.lookahead_buffer = next;
+    next += tuning.lookahead_size;
+    config.cache_size = tuning.cache_size;
+    config.read_buffer = next;
+    config.prog_buffer = next + tuning.cache_size;
+#if LFS_VERSION >= 0x00020004
+    config.metadata_max = tuning.metadata_max;
+#endif
+    // Before 2.9 littlefs has no inline_max and inlines up to its own
+    // limit, which is the SMALL_FILES value
+#if LFS_VERSION >= 0x00020009
+    config.inline_max = tuning.inline_max;
+#endif
+    
+    return FSResult::OK;
+}
+
+// Create a directory and any missing parents. The full path is tried first
+// and parents are only probed on ERROR_NO_ENT, so when the parent exists it
+// costs a single mkdir. When the path already exists, one stat tells a
+// directory from a file of that name.
+FSResult FileSys::mkdir_p(const char* path) {
+    Guard guard(this);
+    char buffer[MAX_PATH_LENGTH];
+    size_t length = strlen(path);
+    
+    if (length >= sizeof(buffer)) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    memcpy(buffer, path, length + 1);
+    while (length > 1 && buffer[length - 1] == '/') {
+        buffer[--length] = '\0';
+    }
+    
+    FSResult result = impl_->mkdir(buffer);
+    if (result == FSResult::OK && changes_) {
+        changes_->post(ChangeType::CREATED, buffer, true);
+    }
+    if (result == FSResult::ERROR_EXIST) {
+        FileInfo info;
+        result = impl_->stat(buffer, info);
+        if (result == FSResult::OK && !info.is_directory) {
+            result = FSResult::ERROR_EXIST;
+        }
+        return result;
+    }
+    if (result != FSResult::ERROR_NO_ENT) {
+        return result;
+    }
+    
+    // Walk back to the deepest ancestor that exists (or could be created)
+    size_t end = length;
+    for (;;) {
+        while (end > 0 && buffer[end - 1] != '/') {
+            end--;
+        }
+        while (end > 0 && buffer[end - 1] == '/') {
+            end--;
+        }
+        if (end == 0) {
+            return FSResult::ERROR_NO_ENT;
+        }
+        
+        buffer[end] = '\0';
+        result = impl_->mkdir(buffer);
+        if (result == FSResult::OK && changes_) {
+            changes_->post(ChangeType::CREATED, buffer, true);
+        }
+        buffer[end] = '/';
+        
+        if (result == FSResult::OK || result == FSResult::ERROR_EXIST) {
+            break;
+        }
+        if (result != FSResult::ERROR_NO_ENT) {
+            return result;
+        }
+    }
+    
+    // Then create each remaining component going forward
+    while (end < length) {
+        end++;
+        while (end < length && buffer[end] != '/') {
+            end++;
+        }
+        if (end < length && buffer[end - 1] == '/') {
+            continue; // Repeated separator
+        }
+        
+        buffer[end] = '\0';
+        result = impl_->mkdir(buffer);
+        if (result == FSResult::OK && changes_) {
+            changes_->post(ChangeType::CREATED, buffer, true);
+        }
+        if (end < length) {
+            buffer[end] = '/';
+        }
+        
+        if (result != FSResult::OK && !(result == FSResult::ERROR_EXIST && end < length)) {
+            return result;
+        }
+    }
+    
+    return FSResult::OK;
+}
+
+// Remove a file, or a directory and everything beneath it. One stat tells
+// which. Runs depth first in one path buffer with a single open directory
+// and no entry list: files are removed while the directory is iterated,
+// and after a subdirectory has been emptied and removed its parent is
+// reopened once and scanned again (entries already removed are gone, so
+// the scan resumes where it was). Each removal still goes to the backend
+// by full path, so it resolves the path and commits on its own, as a
+// caller's own loop would.
+FSResult FileSys::remove_tree(const char* path) {
+    Guard guard(this);
+    FileInfo info;
+    FSResult result = impl_->stat(path, info);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    if (!info.is_directory) {
+        return remove(path);
+    }
+    
+    char buffer[MAX_PATH_LENGTH];
+    size_t root_length = strlen(path);
+    if (root_length >= sizeof(buffer)) {
+        return FSResult::ERROR_INVALID;
+    }
+    memcpy(buffer, path, root_length + 1);
+    
+    for (;;) {
+        DirHandle dir;
+        result = impl_->opendir(dir, buffer);
+        if (result != FSResult::OK) {
+            return result;
+        }
+        
+        size_t length = strlen(buffer);
+        bool descended = false;
+        
+        while ((result = impl_->readdir(dir, info)) == FSResult::OK && info.name[0] != '\0') {
+            if (strcmp(info.name, ".") == 0 || strcmp(info.name, "..") == 0) {
+                continue;
+            }
+            
+            if (!join_path(buffer, sizeof(buffer), buffer, info.name)) {
+                result = FSResult::ERROR_INVALID;
+                break;
+            }
+            
+            if (info.is_directory) {
+                descended = true;
+                break;
+            }
+            
+            result = impl_->remove(buffer);
+            if (result == FSResult::OK && changes_) {
+                changes_->post(ChangeType::REMOVED, buffer, false);
+            }
+            buffer[length] = '\0';
+            if (result != FSResult::OK) {
+                break;
+            }
+        }
+        
+        impl_->closedir(dir);
+        
+        if (result != FSResult::OK) {
+            return result;
+        }
+        if (descended) {
+            continue;
+        }
+        
+        // Directory is empty now
+        result = rmdir(buffer);
+        if (result != FSResult::OK || length <= root_length) {
+            return result;
+        }
+        
+        // Back to the parent
+        while (length > 0 && buffer[length - 1] != '/') {
+            length--;
+        }
+        while (length > 1 && buffer[length - 1] == '/') {
+            length--;
+        }
+        buffer[length] = '\0';
+    }
+}
+
+FSResult FileSys::open(FileHandle& handle, const char* path, OpenMode mode) {
+    Guard guard(this, handle);
+    if (!changes_) {
+        return impl_->open(handle, path, mode);
+    }
+    
+    // Whether the open creates the file can only be told by looking first
+    bool creating = false;
+    if (!!(mode & OpenMode::CREATE)) {
+        creating = !!(mode & OpenMode::EXCL) || impl_->exists(path) == FSResult::ERROR_NO_ENT;
+    }
+    
+    FSResult result = impl_->open(handle, path, mode);
+    if (result == FSResult::OK) {
+        if (creating) {
+            changes_->post(ChangeType::CREATED, path, false);
+        }
+        if (!!(mode & OpenMode::WRITE)) {
+            changes_->opened(handle, path, !creating && !!(mode & OpenMode::TRUNC));
+        }
+    }
+    return result;
+}
+
+FSResult FileSys::close(FileHandle& handle) {
+    Guard guard(this, handle);
+    
+    if (handle.sync_batch != 0) {
+        // Still queued for a group commit; the close commits it anyway
+        GroupCommit& group = group_commit_;
+        for (uint8_t i = 0; i < group.pending_count; i++) {
+            if (group.pending[i] == &handle) {
+                group.pending[i] = group.pending[--group.pending_count];
+                break;
+            }
+        }
+        handle.sync_batch = 0;
+    }
+    
+    FSResult result = impl_->close(handle);
+    handle.sync_result = result;
+    handle.unsynced_bytes = 0;
+    if (changes_) {
+        changes_->closed(handle);
+    }
+    return result;
+}
+
+FSResult FileSys::truncate(FileHandle& handle, uint32_t size) {
+    Guard guard(this, handle);
+    FSResult result = impl_->truncate(handle, size);
+    if (result == FSResult::OK && changes_) {
+        changes_->written(handle);
+    }
+    return result;
+}
+
+FSResult FileSys::remove(const char* path) {
+    Guard guard(this);
+    FSResult result = impl_->remove(path);
+    if (result == FSResult::OK && changes_) {
+        changes_->post(ChangeType::REMOVED, path, false);
+    }
+    return result;
+}
+
+FSResult FileSys::rename(const char* old_path, const char* new_path) {
+    Guard guard(this);
+    FSResult result = impl_->rename(old_path, new_path);
+    if (result == FSResult::OK && changes_) {
+        FileInfo info;
+        bool is_directory = impl_->stat(new_path, info) == FSResult::OK && info.is_directory;
+        changes_->post_rename(old_path, new_path, is_directory);
+    }
+    return result;
+}
+
+FSResult FileSys::mkdir(const char* path) {
+    Guard guard(this);
+    FSResult result = impl_->mkdir(path);
+    if (result == FSResult::OK && changes_) {
+        changes_->post(ChangeType::CREATED, path, true);
+    }
+    return result;
+}
+
+FSResult FileSys::rmdir(const char* path) {
+    Guard guard(this);
+    FSResult result = impl_->rmdir(path);
+    if (result == FSResult::OK && changes_) {
+        changes_->post(ChangeType::REMOVED, path, true);
+    }
+    return result;
+}
+
+FSResult FileSys::atomic_replace(const char* path, ReplaceWriter writer, void* context) {
+    Guard guard(this);
+    bool creating = changes_ && impl_->exists(path) == FSResult::ERROR_NO_ENT;
+    
+    FSResult result = impl_->atomic_replace(path, writer, context);
+    if (result == FSResult::OK && changes_) {
+        changes_->post(creating ? ChangeType::CREATED : ChangeType::MODIFIED, path, false);
+    }
+    return result;
+}
+
+FSResult FileSys::swap_contents(const char* const* paths, const char* const* others, size_t count) {
+    Guard guard(this);
+    FSResult result = impl_->swap_contents(paths, others, count);
+    if (result == FSResult::OK && changes_) {
+        for (size_t i = 0; i < count; i++) {
+            changes_->post(ChangeType::MODIFIED, paths[i], false);
+            changes_->post(ChangeType::MODIFIED, others[i], false);
+        }
+    }
+    return result;
+}
+
+FSResult FileSys::write(FileHandle& handle, const void* buffer, size_t size, size_t& bytes_written) {
+    Guard guard(this, handle);
+    
+    // Background writes under the scheduler go in slices, yielding between
+    // them; throttled writes are charged one burst at a time
+    size_t slice = size;
+    bool slicing = scheduler_.slice_bytes != 0 && handle.io_priority == IoPriority::BACKGROUND && lock_depth_ == 1;
+    if (slicing) {
+        slice = scheduler_.slice_bytes;
+    }
+    bool limited = throttled(handle);
+    if (limited && handle.budget->bytes_per_s != 0 && handle.budget->burst_bytes < slice) {
+        slice = handle.budget->burst_bytes;
+    }
+    
+    const uint8_t* data = static_cast<const uint8_t*>(buffer);
+    FSResult result;
+    uint32_t ops = 1;
+    bytes_written = 0;
+    for (;;) {
+        size_t chunk = size - bytes_written < slice ? size - bytes_written : slice;
+        if (limited) {
+            throttle(handle, static_cast<uint32_t>(chunk), ops);
+            ops = 0;
+        }
+        
+        size_t done = 0;
+        result = impl_->write(handle, data + bytes_written, chunk, done);
+        bytes_written += done;
+        
+        if (result != FSResult::OK || done < chunk || bytes_written >= size) {
+            break;
+        }
+        if (slicing) {
+            yield_device();
+            scheduler_.stats.slices++;
+        }
+    }
+    
+    if (bytes_written > 0) {
+        if (changes_) {
+            changes_->written(handle);
+        }
+        if (handle.unsynced_bytes == 0 && hooks_ && hooks_->tick_ms) {
+            handle.dirty_since = hooks_->tick_ms(hooks_->context);
+        }
+        handle.unsynced_bytes += static_cast<uint32_t>(bytes_written);
+    }
+    
+    if (result == FSResult::OK && durability_due(handle)) {
+        result = sync_locked(handle);
+    }
+    return result;
+}
+
+FSResult FileSys::read(FileHandle& handle, void* buffer, size_t size, size_t& bytes_read) {
+    Guard guard(this, handle);
+    
+    if (!throttled(handle)) {
+        return impl_->read(handle, buffer, size, bytes_read);
+    }
+    
+    uint8_t* data = static_cast<uint8_t*>(buffer);
+    FSResult result;
+    uint32_t ops = 1;
+    bytes_read = 0;
+    for (;;) {
+        size_t chunk = size - bytes_read;
+        if (handle.budget->bytes_per_s != 0 && chunk > handle.budget->burst_bytes) {
+            chunk = handle.budget->burst_bytes;
+        }
+        throttle(handle, static_cast<uint32_t>(chunk), ops);
+        ops = 0;
+        
+        size_t done = 0;
+        result = impl_->read(handle, data + bytes_read, chunk, done);
+        bytes_read += done;
+        
+        if (result != FSResult::OK || done < chunk || bytes_read >= size) {
+            break;
+        }
+    }
+    return result;
+}
+
+FSResult FileSys::sync(FileHandle& handle) {
+    Guard guard(this, handle);
+    
+    if (throttled(handle)) {
+        throttle(handle, 0, 1);
+    }
+    return sync_locked(handle);
+}
+
+FSResult FileSys::sync_locked(FileHandle& handle) {
+    // Waiting for the batch needs the lock released at every level; a sync
+    // nested inside another locked call (a callback) commits on its own
+    FSResult result;
+    if (!hooks_ || group_commit_.window_ms == 0 || lock_depth_ > 1) {
+        result = impl_->sync(handle);
+    } else {
+        result = sync_grouped(handle);
+    }
+    
+    if (result == FSResult::OK) {
+        handle.unsynced_bytes = 0;
+    }
+    return result;
+}
+
+FSResult FileSys::set_durability(FileHandle& handle, const DurabilityPolicy& policy) {
+    if (policy.max_unsynced_ms != 0 && (!hooks_ || !hooks_->tick_ms)) {
+        return FSResult::ERROR_NOT_SUPPORTED;
+    }
+    
+    Guard guard(this, handle);
+    handle.durability = policy;
+    return FSResult::OK;
+}
+
+FSResult FileSys::end_record(FileHandle& handle) {
+    Guard guard(this, handle);
+    
+    if ((handle.durability.sync_on_record && handle.unsynced_bytes > 0) || durability_due(handle)) {
+        return sync_locked(handle);
+    }
+    return FSResult::OK;
+}
+
+FSResult FileSys::check_durability(FileHandle& handle) {
+    Guard guard(this, handle);
+    
+    if (durability_due(handle)) {
+        return sync_locked(handle);
+    }
+    return FSResult::OK;
+}
+
+// Cheap test of the byte and age limits: two compares and at most one tick read
+bool FileSys::durability_due(const FileHandle& handle) {
+    const DurabilityPolicy& policy = handle.durability;
+    
+    if (handle.unsynced_bytes == 0) {
+        return false;
+    }
+    if (policy.max_unsynced_bytes != 0 && handle.unsynced_bytes >= policy.max_unsynced_bytes) {
+        return true;
+    }
+    if (policy.max_unsynced_ms != 0 && hooks_ && hooks_->tick_ms) {
+        return hooks_->tick_ms(hooks_->context) - handle.dirty_since >= policy.max_unsynced_ms;
+    }
+    return false;
+}
+
+FSResult FileSys::enable_group_commit(uint32_t window_ms) {
+    if (window_ms != 0 && (!hooks_ || !hooks_->wait || !hooks_->notify_all || !hooks_->tick_ms)) {
+        return FSResult::ERROR_NOT_SUPPORTED;
+    }
+    
+    Guard guard(this);
+    group_commit_.window_ms = window_ms;
+    return FSResult::OK;
+}
+
+// Queue the handle in the open batch. The first task to arrive becomes the
+// batch leader: it keeps the batch open for the window (the OS lock is
+// released while it waits, so other tasks can write and join), then flushes
+// every queued handle in one pass and wakes the followers. A handle that is
+// already queued just waits for its batch, so repeated syncs of one file
+// within the window cost a single commit.
+FSResult FileSys::sync_grouped(FileHandle& handle) {
+    GroupCommit& group = group_commit_;
+    
+    uint32_t batch = handle.sync_batch;
+    if (batch == 0) {
+        if (group.pending_count == MAX_OPEN_FILES) {
+            return impl_->sync(handle);
+        }
+        batch = group.open_batch;
+        handle.sync_batch = batch;
+        group.pending[group.pending_count++] = &handle;
+    }
+    group.stats.requests++;
+    
+    if (!group.leader_active) {
+        group.leader_active = true;
+        
+        uint32_t start = hooks_->tick_ms(hooks_->context);
+        for (;;) {
+            uint32_t elapsed = hooks_->tick_ms(hooks_->context) - start;
+            if (elapsed >= group.window_ms) {
+                break;
+            }
+            park(group.window_ms - elapsed);
+        }
+        
+        flush_group(batch);
+        group.leader_active = false;
+        hooks_->notify_all(hooks_->context);
+    } else {
+        while (static_cast<int32_t>(group.done_batch - batch) < 0) {
+            park(0);
+        }
+    }
+    
+    return handle.sync_result;
+}
+
+// Flush all handles queued in batch and record the batch size
+void FileSys::flush_group(uint32_t batch) {
+    GroupCommit& group = group_commit_;
+    
+    // Later requests go to the next batch
+    if (++group.open_batch == 0) {
+        group.open_batch = 1;
+    }
+    
+    uint8_t count = group.pending_count;
+    for (uint8_t i = 0; i < count; i++) {
+        FileHandle* handle = group.pending[i];
+        handle->sync_result = impl_->sync(*handle);
+        handle->sync_batch = 0;
+        if (handle->sync_result == FSResult::OK) {
+            handle->unsynced_bytes = 0;
+        }
+    }
+    group.pending_count = 0;
+    group.done_batch = batch;
+    
+    GroupCommitStats& stats = group.stats;
+    stats.batches++;
+    stats.last_batch = count;
+    if (count > stats.max_batch) {
+        stats.max_batch = count;
+    }
+    if (count <= 1) {
+        stats.batch_sizes[0]++;
+    } else if (count == 2) {
+        stats.batch_sizes[1]++;
+    } else if (count <= 4) {
+        stats.batch_sizes[2]++;
+    } else {
+        stats.batch_sizes[3]++;
+    }
+}
+
+FSResult FileSys::enable_io_scheduler(uint32_t slice_bytes) {
+    if (slice_bytes != 0 && (!hooks_ || !hooks_->wait || !hooks_->notify_all || !hooks_->tick_ms)) {
+        return FSResult::ERROR_NOT_SUPPORTED;
+    }
+    
+    Guard guard(this);
+    scheduler_.slice_bytes = slice_bytes;
+    return FSResult::OK;
+}
+
+FSResult FileSys::set_io_priority(FileHandle& handle, IoPriority priority, uint32_t deadline_ms) {
+    if (static_cast<size_t>(priority) >= IO_PRIORITY_COUNT) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    Guard guard(this);
+    handle.io_priority = priority;
+    handle.io_deadline_ms = deadline_ms;
+    return FSResult::OK;
+}
+
+// Take the OS lock; the outermost Guard of a task also passes admission.
+// arriving_ counts tasks blocked on the lock that are not in the waiter
+// table yet (see yield_device).
+void FileSys::enter(IoPriority priority, uint32_t deadline_ms) {
+    arriving_++;
+    hooks_->lock(hooks_->context);
+    arriving_--;
+    if (++lock_depth_ == 1 && scheduler_.slice_bytes != 0) {
+        admit(priority, deadline_ms);
+    }
+}
+
+void FileSys::leave() {
+    if (lock_depth_ == 1 && scheduler_.device_busy) {
+        scheduler_.device_busy = false;
+        hooks_->notify_all(hooks_->context);
+    }
+    lock_depth_--;
+    hooks_->unlock(hooks_->context);
+}
+
+// Wait in the waiter table until the device is free and no other waiter
+// should run first, then take the device. A yielding writer also waits
+// until every task blocked on the lock has registered.
+void FileSys::admit(IoPriority priority, uint32_t deadline_ms, bool yielding) {
+    IoScheduler& sched = scheduler_;
+    uint32_t arrival = hooks_->tick_ms(hooks_->context);
+    
+    IoWaiter* self = nullptr;
+    for (;;) {
+        for (size_t i = 0; i < MAX_IO_WAITERS; i++) {
+            if (!sched.waiters[i].used) {
+                self = &sched.waiters[i];
+                break;
+            }
+        }
+        if (self) {
+            break;
+        }
+        os_wait(0);
+    }
+    
+    self->used = true;
+    self->ticket = sched.next_ticket++;
+    self->priority = priority;
+    self->has_deadline = deadline_ms != 0;
+    self->deadline = arrival + deadline_ms;
+    
+    // A yielding writer may be waiting for this task to register
+    hooks_->notify_all(hooks_->context);
+    
+    for (;;) {
+        if (!sched.device_busy && !(yielding && arriving_ != 0)) {
+            uint32_t now = hooks_->tick_ms(hooks_->context);
+            bool first = true;
+            for (size_t i = 0; i < MAX_IO_WAITERS && first; i++) {
+                const IoWaiter& other = sched.waiters[i];
+                if (other.used && &other != self && runs_before(other, *self, now)) {
+                    first = false;
+                }
+            }
+            if (first) {
+                break;
+            }
+        }
+        os_wait(0);
+    }
+    
+    self->used = false;
+    sched.device_busy = true;
+    sched.owner_priority = priority;
+    
+    uint32_t now = hooks_->tick_ms(hooks_->context);
+    uint32_t waited = now - arrival;
+    size_t cls = static_cast<size_t>(priority);
+    sched.stats.requests[cls]++;
+    sched.stats.total_wait_ms[cls] += waited;
+    if (waited > sched.stats.max_wait_ms[cls]) {
+        sched.stats.max_wait_ms[cls] = waited;
+    }
+    if (self->has_deadline && static_cast<int32_t>(now - self->deadline) > 0) {
+        sched.stats.deadline_misses++;
+    }
+}
+
+// Admission order: overdue requests first (earliest deadline first), then
+// by class, then deadline, then arrival
+bool FileSys::runs_before(const IoWaiter& a, const IoWaiter& b, uint32_t now) const {
+    bool a_late = a.has_deadline && static_cast<int32_t>(now - a.deadline) >= 0;
+    bool b_late = b.has_deadline && static_cast<int32_t>(now - b.deadline) >= 0;
+    
+    if (a_late != b_late) {
+        return a_late;
+    }
+    if (!a_late && a.priority != b.priority) {
+        return a.priority < b.priority;
+    }
+    if (a.has_deadline != b.has_deadline) {
+        return a.has_deadline;
+    }
+    if (a.has_deadline && a.deadline != b.deadline) {
+        return static_cast<int32_t>(a.deadline - b.deadline) < 0;
+    }
+    return static_cast<int32_t>(a.ticket - b.ticket) < 0;
+}
+
+// hooks_->wait releases the lock, so other tasks must not see our nesting
+void FileSys::os_wait(uint32_t timeout_ms) {
+    uint8_t depth = lock_depth_;
+    lock_depth_ = 0;
+    hooks_->wait(hooks_->context, timeout_ms);
+    lock_depth_ = depth;
+}
+
+// Wait inside a call (group commit), letting other requests use the device meanwhile
+void FileSys::park(uint32_t timeout_ms) {
+    if (scheduler_.slice_bytes == 0 || !scheduler_.device_busy) {
+        os_wait(timeout_ms);
+        return;
+    }
+    
+    IoPriority priority = scheduler_.owner_priority;
+    scheduler_.device_busy = false;
+    hooks_->notify_all(hooks_->context);
+    os_wait(timeout_ms);
+    admit(priority, 0);
+}
+
+// Between background slices: hand the device to anyone waiting. Unlocking
+// and relocking would not do, since the OS lock need not pass to a task
+// blocked on it, and such a task is not in the waiter table to be ranked.
+// Instead the writer registers and waits as a new request, and first lets
+// every blocked task take the lock and register.
+void FileSys::yield_device() {
+    IoPriority priority = scheduler_.owner_priority;
+    scheduler_.device_busy = false;
+    hooks_->notify_all(hooks_->context);
+    admit(priority, 0, true);
+}
+
+FSResult FileSys::set_budget(FileHandle& handle, IoBudget* budget) {
+    if (budget && (!hooks_ || !hooks_->wait || !hooks_->tick_ms)) {
+        return FSResult::ERROR_NOT_SUPPORTED;
+    }
+    
+    Guard guard(this);
+    if (budget && budget != handle.budget) {
+        if (budget->burst_bytes == 0) {
+            budget->burst_bytes = budget->bytes_per_s / 10 > BUFFER_SIZE ? budget->bytes_per_s / 10 : BUFFER_SIZE;
+        }
+        if (budget->burst_ops == 0) {
+            budget->burst_ops = budget->ops_per_s / 10 > 1 ? budget->ops_per_s / 10 : 1;
+        }
+        if (budget->last_refill == 0) {
+            // First use: start with a full bucket
+            budget->byte_credit = static_cast<uint64_t>(budget->burst_bytes) * 1000;
+            budget->op_credit = static_cast<uint64_t>(budget->burst_ops) * 1000;
+            budget->last_refill = hooks_->tick_ms(hooks_->context) | 1;
+        }
+    }
+    handle.budget = budget;
+    return FSResult::OK;
+}
+
+// Throttling only applies to the outermost call of a task, since waiting
+// must release the lock completely
+bool FileSys::throttled(const FileHandle& handle) const {
+    return handle.budget && hooks_ && lock_depth_ == 1 && handle.io_priority != IoPriority::FOREGROUND;
+}
+
+// Wait until the budget has credit for bytes and ops, then charge it
+void FileSys::throttle(FileHandle& handle, uint32_t bytes, uint32_t ops) {
+    IoBudget& budget = *handle.budget;
+    uint64_t byte_cap = static_cast<uint64_t>(budget.burst_bytes) * 1000;
+    uint64_t op_cap = static_cast<uint64_t>(budget.burst_ops) * 1000;
+    uint64_t byte_need = static_cast<uint64_t>(bytes) * 1000;
+    uint64_t op_need = static_cast<uint64_t>(ops) * 1000;
+    
+    for (;;) {
+        // Refill: one millisecond at r per second earns r thousandths
+        uint32_t now = hooks_->tick_ms(hooks_->context);
+        uint32_t elapsed = now - budget.last_refill;
+        budget.last_refill = now;
+        budget.byte_credit += static_cast<uint64_t>(elapsed) * budget.bytes_per_s;
+        budget.op_credit += static_cast<uint64_t>(elapsed) * budget.ops_per_s;
+        if (budget.byte_credit > byte_cap) {
+            budget.byte_credit = byte_cap;
+        }
+        if (budget.op_credit > op_cap) {
+            budget.op_credit = op_cap;
+        }
+        
+        uint64_t wait_ms = 0;
+        if (budget.bytes_per_s != 0 && budget.byte_credit < byte_need) {
+            wait_ms = (byte_need - budget.byte_credit + budget.bytes_per_s - 1) / budget.bytes_per_s;
+        }
+        if (budget.ops_per_s != 0 && budget.op_credit < op_need) {
+            uint64_t op_wait = (op_need - budget.op_credit + budget.ops_per_s - 1) / budget.ops_per_s;
+            if (op_wait > wait_ms) {
+                wait_ms = op_wait;
+            }
+        }
+        
+        if (wait_ms == 0) {
+            break;
+        }
+        budget.throttled_ms += static_cast<uint32_t>(wait_ms);
+        park(static_cast<uint32_t>(wait_ms));
+    }
+    
+    if (budget.bytes_per_s != 0) {
+        budget.byte_credit -= byte_need;
+    }
+    if (budget.ops_per_s != 0) {
+        budget.op_credit -= op_need;
+    }
+}
+
+} // namespace EmbeddedFS
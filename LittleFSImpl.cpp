@@ -4,8 +4,23 @@
 
 namespace EmbeddedFS {
 
+// Custom attribute holding the modification time (Unix seconds, little-endian)
+static constexpr uint8_t LFS_TIME_ATTR = 't';
+
+static uint32_t get_le32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+           static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+static void put_le32(uint8_t* p, uint32_t value) {
+    p[0] = static_cast<uint8_t>(value);
+    p[1] = static_cast<uint8_t>(value >> 8);
+    p[2] = static_cast<uint8_t>(value >> 16);
+    p[3] = static_cast<uint8_t>(value >> 24);
+}
+
 // Constructor
-LittleFSImpl::LittleFSImpl(lfs_config_t* config) : config_(config), mounted_(false) {
+LittleFSImpl::LittleFSImpl(lfs_config_t* config) : config_(config), mounted_(false), times_enabled_(false) {
     if (!config_) {
         // Handle null config error - could set a flag or use default
         return;
@@ -76,7 +91,7 @@ FSResult LittleFSImpl::open(FileHandle& handle, const char* path, OpenMode mode)
     }
     
     int lfs_flags = convert_open_mode(mode);
-    int res = lfs_file_open(&lfs_, &handle.lfs_file, path, lfs_flags);
+    int res = open_file(handle, path, lfs_flags);
     
     if (res == LFS_ERR_OK) {
         handle.is_open = true;
@@ -93,6 +108,7 @@ FSResult LittleFSImpl::close(FileHandle& handle) {
         return FSResult::ERROR_BAD_FILE;
     }
     
+    stamp_time(handle);
     int res = lfs_file_close(&lfs_, &handle.lfs_file);
     handle.is_open = false;
     handle.fs_impl = nullptr;
@@ -100,6 +116,80 @@ FSResult LittleFSImpl::close(FileHandle& handle) {
     return convert_lfs_error(res);
 }
 
+// Open a file, attaching the time attribute to writable files when times
+// are enabled. lfs commits attached attributes with every sync/close of a
+// writable file, and does not read them for a write-only open, so the
+// stored time is loaded first to keep it unless the file gets written.
+int LittleFSImpl::open_file(FileHandle& handle, const char* path, int lfs_flags) {
+#if FILESYS_LFS_TIMES
+    handle.time_pending = false;
+    if (!times_enabled_ || (lfs_flags & LFS_O_WRONLY) != LFS_O_WRONLY) {
+        handle.lfs_file_cfg.attrs = nullptr;
+        return lfs_file_open(&lfs_, &handle.lfs_file, path, lfs_flags);
+    }
+    
+    handle.lfs_time_attr.type = LFS_TIME_ATTR;
+    handle.lfs_time_attr.buffer = handle.lfs_time;
+    handle.lfs_time_attr.size = sizeof(handle.lfs_time);
+    handle.lfs_file_cfg.buffer = nullptr;
+    handle.lfs_file_cfg.attrs = &handle.lfs_time_attr;
+    handle.lfs_file_cfg.attr_count = 1;
+    
+    // New, truncated and never-stamped files get a time at close even if not written
+    lfs_ssize_t size = lfs_getattr(&lfs_, path, LFS_TIME_ATTR, handle.lfs_time, sizeof(handle.lfs_time));
+    if (size != static_cast<lfs_ssize_t>(sizeof(handle.lfs_time)) || (lfs_flags & LFS_O_TRUNC)) {
+        memset(handle.lfs_time, 0, sizeof(handle.lfs_time));
+        handle.time_pending = true;
+    }
+    return lfs_file_opencfg(&lfs_, &handle.lfs_file, path, lfs_flags, &handle.lfs_file_cfg);
+#else
+    return lfs_file_open(&lfs_, &handle.lfs_file, path, lfs_flags);
+#endif
+}
+
+// Take the time for a file written since the last stamp; lfs writes it out
+// in the commit that follows. Without a clock the old time is kept.
+void LittleFSImpl::stamp_time(FileHandle& handle) {
+#if FILESYS_LFS_TIMES
+    if (!handle.time_pending || !handle.lfs_file_cfg.attrs) {
+        return;
+    }
+    uint32_t now = FileSys::current_time();
+    if (now != 0) {
+        put_le32(handle.lfs_time, now);
+    }
+    handle.time_pending = false;
+#else
+    (void)handle;
+#endif
+}
+
+// Stored time of a path, 0 if it has none
+uint32_t LittleFSImpl::read_time(const char* path) {
+    uint8_t value[4];
+    lfs_ssize_t size = lfs_getattr(&lfs_, path, LFS_TIME_ATTR, value, sizeof(value));
+    if (size != static_cast<lfs_ssize_t>(sizeof(value))) {
+        return 0;
+    }
+    return get_le32(value);
+}
+
+// Stored time of an entry of an open directory
+uint32_t LittleFSImpl::read_entry_time(const DirHandle& handle, const char* name) {
+#if FILESYS_LFS_TIMES
+    char path[MAX_PATH_LENGTH];
+    if ((name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) ||
+        !FileSys::join_path(path, sizeof(path), handle.path, name)) {
+        return 0;
+    }
+    return read_time(path);
+#else
+    (void)handle;
+    (void)name;
+    return 0;
+#endif
+}
+
 // Read from a file
 FSResult LittleFSImpl::read(FileHandle& handle, void* buffer, size_t size, size_t& bytes_read) {
     if (!handle.is_open || handle.fs_impl != this) {
@@ -126,6 +216,9 @@ FSResult LittleFSImpl::write(FileHandle& handle, const void* buffer, size_t size
     lfs_ssize_t res = lfs_file_write(&lfs_, &handle.lfs_file, buffer, size);
     
     if (res >= 0) {
+#if FILESYS_LFS_TIMES
+        handle.time_pending |= res > 0;
+#endif
         bytes_written = static_cast<size_t>(res);
         return FSResult::OK;
     }
@@ -186,6 +279,7 @@ FSResult LittleFSImpl::sync(FileHandle& handle) {
         return FSResult::ERROR_BAD_FILE;
     }
     
+    stamp_time(handle);
     int res = lfs_file_sync(&lfs_, &handle.lfs_file);
     return convert_lfs_error(res);
 }
@@ -197,6 +291,9 @@ FSResult LittleFSImpl::truncate(FileHandle& handle, uint32_t size) {
     }
     
     int res = lfs_file_truncate(&lfs_, &handle.lfs_file, static_cast<lfs_off_t>(size));
+#if FILESYS_LFS_TIMES
+    handle.time_pending |= res == LFS_ERR_OK;
+#endif
     return convert_lfs_error(res);
 }
 
@@ -244,9 +341,8 @@ FSResult LittleFSImpl::stat(const char* path, FileInfo& info) {
         info.size = static_cast<uint32_t>(lfs_info.size);
         info.is_directory = (lfs_info.type == LFS_TYPE_DIR);
         
-        // LittleFS doesn't store modification time by default
-        // Set to 0 or implement custom attribute if needed
-        info.modified_time = 0;
+        // Kept in a custom attribute when enabled
+        info.modified_time = times_enabled_ ? read_time(path) : 0;
         
         return FSResult::OK;
     }
@@ -254,6 +350,50 @@ FSResult LittleFSImpl::stat(const char* path, FileInfo& info) {
     return convert_lfs_error(res);
 }
 
+// Check that a path exists
+FSResult LittleFSImpl::exists(const char* path) {
+    if (!mounted_) {
+        return FSResult::ERROR_NOT_MOUNTED;
+    }
+    
+    struct lfs_info lfs_info;
+    return convert_lfs_error(lfs_stat(&lfs_, path, &lfs_info));
+}
+
+// Size of a file by path
+FSResult LittleFSImpl::file_size(const char* path, uint32_t& size) {
+    if (!mounted_) {
+        return FSResult::ERROR_NOT_MOUNTED;
+    }
+    
+    struct lfs_info lfs_info;
+    int res = lfs_stat(&lfs_, path, &lfs_info);
+    if (res != LFS_ERR_OK) {
+        return convert_lfs_error(res);
+    }
+    if (lfs_info.type == LFS_TYPE_DIR) {
+        return FSResult::ERROR_IS_DIR;
+    }
+    
+    size = static_cast<uint32_t>(lfs_info.size);
+    return FSResult::OK;
+}
+
+// Size of an open file, from the handle alone
+FSResult LittleFSImpl::file_size(FileHandle& handle, uint32_t& size) {
+    if (!handle.is_open || handle.fs_impl != this) {
+        return FSResult::ERROR_BAD_FILE;
+    }
+    
+    lfs_soff_t res = lfs_file_size(&lfs_, &handle.lfs_file);
+    if (res >= 0) {
+        size = static_cast<uint32_t>(res);
+        return FSResult::OK;
+    }
+    
+    return convert_lfs_error(static_cast<int>(res));
+}
+
 // Create a directory
 FSResult LittleFSImpl::mkdir(const char* path) {
     if (!mounted_) {
@@ -275,6 +415,59 @@ FSResult LittleFSImpl::rmdir(const char* path) {
     return convert_lfs_error(res);
 }
 
+// Replace a file's content atomically
+FSResult LittleFSImpl::atomic_replace(const char* path, ReplaceWriter writer, void* context) {
+    if (!mounted_) {
+        return FSResult::ERROR_NOT_MOUNTED;
+    }
+    
+    if (!writer) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    // littlefs keeps an open file's updates (truncation included) out of the
+    // metadata until the file is synced, so rewriting in place is already
+    // copy-on-write: the close below is the single commit
+    FileHandle handle;
+    const char* target = path;
+    char temp_path[MAX_PATH_LENGTH];
+    
+    int res = open_file(handle, path, LFS_O_WRONLY | LFS_O_TRUNC);
+    if (res == LFS_ERR_NOENT) {
+        // Creating the file would commit an empty entry first; build it under
+        // a temp name and let the rename publish it instead
+        if (!FileSys::sibling_path(temp_path, sizeof(temp_path), path, REPLACE_TEMP_NAME)) {
+            return FSResult::ERROR_INVALID;
+        }
+        target = temp_path;
+        res = open_file(handle, temp_path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+    }
+    if (res != LFS_ERR_OK) {
+        return convert_lfs_error(res);
+    }
+    handle.is_open = true;
+    handle.fs_impl = this;
+    
+    FSResult result = writer(handle, context);
+    if (result != FSResult::OK) {
+        // Marking the file errored makes close drop the pending update
+        handle.lfs_file.flags |= LFS_F_ERRED;
+        close(handle);
+        if (target != path) {
+            lfs_remove(&lfs_, temp_path);
+        }
+        return result;
+    }
+    
+    result = close(handle);
+    if (result != FSResult::OK || target == path) {
+        return result;
+    }
+    
+    res = lfs_rename(&lfs_, temp_path, path);
+    return convert_lfs_error(res);
+}
+
 // Open a directory
 FSResult LittleFSImpl::opendir(DirHandle& handle, const char* path) {
     if (!mounted_) {
@@ -285,6 +478,12 @@ FSResult LittleFSImpl::opendir(DirHandle& handle, const char* path) {
         return FSResult::ERROR_BAD_FILE;
     }
     
+#if FILESYS_LFS_TIMES
+    if (times_enabled_ && !FileSys::join_path(handle.path, sizeof(handle.path), "", path)) {
+        return FSResult::ERROR_INVALID;
+    }
+#endif
+    
     int res = lfs_dir_open(&lfs_, &handle.lfs_dir, path);
     
     if (res == LFS_ERR_OK) {
@@ -325,7 +524,7 @@ FSResult LittleFSImpl::readdir(DirHandle& handle, FileInfo& info) {
         
         info.size = static_cast<uint32_t>(lfs_info.size);
         info.is_directory = (lfs_info.type == LFS_TYPE_DIR);
-        info.modified_time = 0; // LittleFS doesn't store modification time by default
+        info.modified_time = times_enabled_ ? read_entry_time(handle, lfs_info.name) : 0;
         
         return FSResult::OK;
     } else if (res == 0) {
@@ -348,6 +547,86 @@ FSResult LittleFSImpl::rewinddir(DirHandle& handle) {
     return convert_lfs_error(res);
 }
 
+// Start a filtered directory search
+FSResult LittleFSImpl::findfirst(DirHandle& handle, const char* path, const FindFilter& filter, FileInfo& info) {
+    FSResult result = opendir(handle, path);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    handle.filter = filter;
+    return findnext(handle, info);
+}
+
+// Continue a filtered directory search
+FSResult LittleFSImpl::findnext(DirHandle& handle, FileInfo& info) {
+    if (!handle.is_open || handle.fs_impl != this) {
+        return FSResult::ERROR_BAD_FILE;
+    }
+    
+    const FindFilter& filter = handle.filter;
+    struct lfs_info lfs_info;
+    
+    for (;;) {
+        int res = lfs_dir_read(&lfs_, &handle.lfs_dir, &lfs_info);
+        
+        if (res == 0) {
+            // End of directory
+            info.name[0] = '\0';
+            return FSResult::OK;
+        } else if (res < 0) {
+            return convert_lfs_error(res);
+        }
+        
+        // Filter on the iterator's own entry; FileInfo is only touched on a
+        // match, and the time is only looked up when needed
+        bool is_directory = (lfs_info.type == LFS_TYPE_DIR);
+        bool time_filter = filter.modified_after != 0 || filter.modified_before != 0;
+        uint32_t modified_time = 0;
+        if (times_enabled_ && time_filter && FileSys::match_pattern(filter.pattern, lfs_info.name)) {
+            modified_time = read_entry_time(handle, lfs_info.name);
+        }
+        if (!filter.accepts(static_cast<uint32_t>(lfs_info.size), is_directory, modified_time) ||
+            !FileSys::match_pattern(filter.pattern, lfs_info.name)) {
+            continue;
+        }
+        if (times_enabled_ && !time_filter) {
+            modified_time = read_entry_time(handle, lfs_info.name);
+        }
+        
+        strncpy(info.name, lfs_info.name, MAX_FILENAME_LENGTH - 1);
+        info.name[MAX_FILENAME_LENGTH - 1] = '\0';
+        
+        info.size = static_cast<uint32_t>(lfs_info.size);
+        info.is_directory = is_directory;
+        info.modified_time = modified_time;
+        
+        return FSResult::OK;
+    }
+}
+
+// Set the stored modification time
+FSResult LittleFSImpl::set_modified_time(const char* path, uint32_t modified_time) {
+    if (!mounted_) {
+        return FSResult::ERROR_NOT_MOUNTED;
+    }
+    
+    uint8_t value[4];
+    put_le32(value, modified_time);
+    int res = lfs_setattr(&lfs_, path, LFS_TIME_ATTR, value, sizeof(value));
+    return convert_lfs_error(res);
+}
+
+FSResult LittleFSImpl::enable_modified_times(bool enable) {
+#if !FILESYS_LFS_TIMES
+    if (enable) {
+        return FSResult::ERROR_NOT_SUPPORTED;
+    }
+#endif
+    times_enabled_ = enable;
+    return FSResult::OK;
+}
+
 // Get free space
 FSResult LittleFSImpl::get_free_space(uint64_t& free_bytes) {
     if (!mounted_) {
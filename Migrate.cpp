@@ -0,0 +1,294 @@
+#include "Migrate.h"
+#include "TreeWalker.h"
+#include <cstring>
+
+namespace EmbeddedFS {
+
+// CRC-32 of the first limit bytes of a file (all of it if shorter)
+static FSResult file_crc(FileSys& fs, const char* path, uint8_t* buffer, size_t buffer_size,
+                         uint32_t limit, uint32_t& crc) {
+    FileHandle file;
+    FSResult result = fs.open(file, path, OpenMode::READ);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    crc = 0;
+    size_t bytes_read;
+    while (limit > 0 &&
+           (result = fs.read(file, buffer, limit < buffer_size ? limit : buffer_size, bytes_read)) == FSResult::OK &&
+           bytes_read > 0) {
+        crc = FileSys::crc32(crc, buffer, bytes_read);
+        limit -= static_cast<uint32_t>(bytes_read);
+    }
+    
+    fs.close(file);
+    return result;
+}
+
+// Stream a file across from offset on and return the CRC-32 of what was
+// read. With offset 0 the destination is rewritten; otherwise its first
+// offset bytes are kept and the rest is replaced.
+static FSResult copy_file(FileSys& source, const char* source_path, FileSys& dest, const char* dest_path,
+                          uint8_t* buffer, size_t buffer_size, uint32_t offset, uint32_t& crc, uint64_t& bytes) {
+    FileHandle in;
+    FSResult result = source.open(in, source_path, OpenMode::READ);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    FileHandle out;
+    result = dest.open(out, dest_path, offset ? OpenMode::WRITE : OpenMode::WRITE | OpenMode::CREATE | OpenMode::TRUNC);
+    if (result == FSResult::OK && offset) {
+        result = source.seek(in, static_cast<int32_t>(offset), SeekOrigin::SET);
+        if (result == FSResult::OK) {
+            result = dest.seek(out, static_cast<int32_t>(offset), SeekOrigin::SET);
+        }
+        if (result != FSResult::OK) {
+            dest.close(out);
+        }
+    }
+    if (result != FSResult::OK) {
+        source.close(in);
+        return result;
+    }
+    
+    crc = 0;
+    size_t bytes_read;
+    while ((result = source.read(in, buffer, buffer_size, bytes_read)) == FSResult::OK && bytes_read > 0) {
+        crc = FileSys::crc32(crc, buffer, bytes_read);
+        
+        size_t bytes_written;
+        result = dest.write(out, buffer, bytes_read, bytes_written);
+        if (result == FSResult::OK && bytes_written != bytes_read) {
+            result = FSResult::ERROR_NO_SPC;
+        }
+        if (result != FSResult::OK) {
+            break;
+        }
+        bytes += bytes_read;
+    }
+    
+    source.close(in);
+    FSResult close_result = dest.close(out);
+    return result != FSResult::OK ? result : close_result;
+}
+
+FSResult migrate_tree(FileSys& source, const char* source_root, FileSys& dest, const char* dest_root,
+                      const MigrateOptions& options, MigrateStats& stats) {
+    if (!options.buffer || options.buffer_size == 0) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    uint32_t start = options.tick_ms ? options.tick_ms(options.tick_context) : 0;
+    stats = MigrateStats();
+    
+    FSResult result = dest.mkdir_p(dest_root);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    TreeWalker walker(source);
+    result = walker.start(source_root);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    char dest_path[MAX_PATH_LENGTH];
+    FileInfo info;
+    while ((result = walker.next(info)) == FSResult::OK && info.name[0] != '\0') {
+        if (!FileSys::join_path(dest_path, sizeof(dest_path), dest_root, walker.relative_path())) {
+            result = FSResult::ERROR_INVALID;
+            break;
+        }
+        
+        if (info.is_directory) {
+            result = dest.mkdir(dest_path);
+            if (result == FSResult::ERROR_EXIST) {
+                result = FSResult::OK;
+            }
+            stats.directories++;
+        } else {
+            uint32_t crc;
+            result = copy_file(source, walker.path(), dest, dest_path, options.buffer, options.buffer_size, 0,
+                               crc, stats.bytes);
+            if (result == FSResult::OK && options.verify) {
+                uint32_t copy_crc;
+                result = file_crc(dest, dest_path, options.buffer, options.buffer_size, UINT32_MAX, copy_crc);
+                if (result == FSResult::OK && copy_crc != crc) {
+                    result = FSResult::ERROR_CORRUPT;
+                }
+            }
+            stats.files++;
+        }
+        if (result != FSResult::OK) {
+            break;
+        }
+        
+        // Not every backend keeps times; that is not an error
+        if (options.preserve_times && info.modified_time != 0 &&
+            dest.set_modified_time(dest_path, info.modified_time) == FSResult::OK) {
+            stats.times_preserved++;
+        }
+    }
+    
+    if (options.tick_ms) {
+        stats.elapsed_ms = options.tick_ms(options.tick_context) - start;
+    }
+    return result;
+}
+
+// Content hash of a whole file, through the cache when its time is known.
+// volume keeps the two sides of a sync apart in the cache.
+static FSResult cached_crc(FileSys& fs, uint32_t volume, const char* path, const FileInfo& info,
+                           const SyncOptions& options, SyncStats& stats, uint32_t& crc) {
+    SyncHashEntry* entry = nullptr;
+    uint32_t path_hash = FileSys::crc32(volume, path, strlen(path)) | 1;
+    if (options.hash_cache && options.hash_cache_size && info.modified_time != 0) {
+        entry = &options.hash_cache[path_hash % options.hash_cache_size];
+        if (entry->path_hash == path_hash && entry->size == info.size &&
+            entry->modified_time == info.modified_time) {
+            crc = entry->crc;
+            stats.hash_cache_hits++;
+            return FSResult::OK;
+        }
+    }
+    
+    FSResult result = file_crc(fs, path, options.buffer, options.buffer_size, UINT32_MAX, crc);
+    stats.hashes_computed++;
+    if (result == FSResult::OK && entry) {
+        entry->path_hash = path_hash;
+        entry->size = info.size;
+        entry->modified_time = info.modified_time;
+        entry->crc = crc;
+    }
+    return result;
+}
+
+// Known and equal to FAT resolution: FatFS keeps times to 2 s, so a time
+// copied over from LittleFS can read back one second earlier
+static bool same_time(uint32_t source_time, uint32_t dest_time) {
+    return source_time != 0 && source_time / 2 == dest_time / 2;
+}
+
+static FSResult sync_file(FileSys& source, const char* source_path, const FileInfo& info,
+                          FileSys& dest, const char* dest_path, const SyncOptions& options, SyncStats& stats) {
+    FileInfo dest_info;
+    FSResult result = dest.stat(dest_path, dest_info);
+    uint32_t offset = 0;
+    
+    if (result == FSResult::OK) {
+        if (dest_info.is_directory) {
+            return FSResult::ERROR_IS_DIR;
+        }
+        
+        bool same_size = dest_info.size == info.size;
+        bool unchanged = same_size && same_time(info.modified_time, dest_info.modified_time);
+        
+        if (!unchanged && same_size && options.compare_hash) {
+            uint32_t source_crc, dest_crc;
+            result = cached_crc(source, 0, source_path, info, options, stats, source_crc);
+            if (result == FSResult::OK) {
+                result = cached_crc(dest, 1, dest_path, dest_info, options, stats, dest_crc);
+            }
+            if (result != FSResult::OK) {
+                return result;
+            }
+            unchanged = source_crc == dest_crc;
+            
+            // Line the times up so the next run decides on metadata alone
+            if (unchanged && info.modified_time != 0) {
+                dest.set_modified_time(dest_path, info.modified_time);
+            }
+        } else if (!unchanged && options.append_only && dest_info.size < info.size) {
+            offset = dest_info.size;
+            if (options.compare_hash && offset) {
+                uint32_t prefix_crc, dest_crc;
+                result = file_crc(source, source_path, options.buffer, options.buffer_size, offset, prefix_crc);
+                if (result == FSResult::OK) {
+                    result = cached_crc(dest, 1, dest_path, dest_info, options, stats, dest_crc);
+                }
+                if (result != FSResult::OK) {
+                    return result;
+                }
+                stats.hashes_computed++;
+                if (prefix_crc != dest_crc) {
+                    offset = 0;     // Not an append after all
+                }
+            }
+        }
+        
+        if (unchanged) {
+            stats.unchanged++;
+            stats.bytes_skipped += info.size;
+            return FSResult::OK;
+        }
+    } else if (result != FSResult::ERROR_NO_ENT) {
+        return result;
+    }
+    
+    uint32_t crc;
+    uint64_t bytes = 0;
+    result = copy_file(source, source_path, dest, dest_path, options.buffer, options.buffer_size, offset, crc, bytes);
+    stats.bytes_copied += bytes;
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    if (offset) {
+        stats.appended++;
+        stats.bytes_skipped += offset;
+    } else {
+        stats.copied++;
+    }
+    if (info.modified_time != 0) {
+        dest.set_modified_time(dest_path, info.modified_time);
+    }
+    return FSResult::OK;
+}
+
+FSResult sync_tree(FileSys& source, const char* source_root, FileSys& dest, const char* dest_root,
+                   const SyncOptions& options, SyncStats& stats) {
+    if (!options.buffer || options.buffer_size == 0) {
+        return FSResult::ERROR_INVALID;
+    }
+    stats = SyncStats();
+    
+    FSResult result = dest.mkdir_p(dest_root);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    TreeWalker walker(source);
+    result = walker.start(source_root);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    char dest_path[MAX_PATH_LENGTH];
+    FileInfo info;
+    while ((result = walker.next(info)) == FSResult::OK && info.name[0] != '\0') {
+        if (!FileSys::join_path(dest_path, sizeof(dest_path), dest_root, walker.relative_path())) {
+            result = FSResult::ERROR_INVALID;
+            break;
+        }
+        
+        if (info.is_directory) {
+            result = dest.mkdir(dest_path);
+            if (result == FSResult::OK) {
+                stats.directories_created++;
+            } else if (result == FSResult::ERROR_EXIST) {
+                result = FSResult::OK;
+            }
+        } else {
+            stats.files++;
+            result = sync_file(source, walker.path(), info, dest, dest_path, options, stats);
+        }
+        if (result != FSResult::OK) {
+            break;
+        }
+    }
+    return result;
+}
+
+} // namespace EmbeddedFS
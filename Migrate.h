@@ -0,0 +1,98 @@
+#ifndef MIGRATE_H
+#define MIGRATE_H
+
+#include "FileSys.h"
+
+namespace EmbeddedFS {
+
+// Options for migrate_tree
+struct MigrateOptions {
+    uint8_t* buffer;                        // Copy buffer (caller storage), at least BUFFER_SIZE
+    size_t buffer_size;
+    bool verify;                            // Read each copy back and compare CRC-32
+    bool preserve_times;                    // Carry modification times over where supported
+    uint32_t (*tick_ms)(void* context);     // Optional clock for the elapsed time
+    void* tick_context;
+    
+    MigrateOptions() : buffer(nullptr), buffer_size(0), verify(true), preserve_times(true),
+                       tick_ms(nullptr), tick_context(nullptr) {}
+};
+
+// Counters of a migrate_tree run
+struct MigrateStats {
+    uint32_t files;
+    uint32_t directories;
+    uint64_t bytes;
+    uint32_t times_preserved;
+    uint32_t elapsed_ms;                    // 0 without a clock
+    
+    MigrateStats() : files(0), directories(0), bytes(0), times_preserved(0), elapsed_ms(0) {}
+    
+    uint32_t bytes_per_second() const {
+        return elapsed_ms ? static_cast<uint32_t>(bytes * 1000 / elapsed_ms) : 0;
+    }
+};
+
+// Copy the tree under source_root on source into dest_root on dest,
+// creating directories as needed and overwriting existing files. The two
+// volumes may use different backends. Each file is streamed through the
+// buffer in buffer_size pieces and its CRC-32 kept for verification; with
+// AsyncBlockAdapter devices on both sides the destination program of one
+// piece overlaps the source read of the next. Stops at the first error.
+FSResult migrate_tree(FileSys& source, const char* source_root, FileSys& dest, const char* dest_root,
+                      const MigrateOptions& options, MigrateStats& stats);
+
+// Slot of the content hash cache used by sync_tree (storage supplied by
+// the caller, see SyncOptions). An entry is valid while the file keeps
+// the size and modification time it was hashed at.
+struct SyncHashEntry {
+    uint32_t path_hash;             // 0 marks a free slot
+    uint32_t size;
+    uint32_t modified_time;
+    uint32_t crc;
+};
+
+// Options for sync_tree
+struct SyncOptions {
+    uint8_t* buffer;                        // Copy buffer (caller storage)
+    size_t buffer_size;
+    bool compare_hash;                      // Compare contents when size/time cannot decide
+    bool append_only;                       // A file that grew only had data appended
+    SyncHashEntry* hash_cache;              // Optional, direct-mapped by path
+    size_t hash_cache_size;
+    
+    SyncOptions() : buffer(nullptr), buffer_size(0), compare_hash(false), append_only(false),
+                    hash_cache(nullptr), hash_cache_size(0) {}
+};
+
+// Counters of a sync_tree run
+struct SyncStats {
+    uint32_t files;                 // Files examined
+    uint32_t copied;                // Rewritten in full
+    uint32_t appended;              // Only the new tail transferred
+    uint32_t unchanged;
+    uint32_t directories_created;
+    uint32_t hashes_computed;
+    uint32_t hash_cache_hits;
+    uint64_t bytes_copied;
+    uint64_t bytes_skipped;         // Bytes not transferred thanks to the comparison
+    
+    SyncStats() : files(0), copied(0), appended(0), unchanged(0), directories_created(0),
+                  hashes_computed(0), hash_cache_hits(0), bytes_copied(0), bytes_skipped(0) {}
+};
+
+// Bring the tree under dest_root up to date with source_root, transferring
+// only what changed. A destination file with the same size and the same
+// non-zero modification time is taken as unchanged. Failing that, and
+// with compare_hash, the CRC-32 of both files decides; hashes are kept in
+// the cache for files whose time is known, so a later run can skip the read.
+// With append_only a destination that is a prefix of the source (by size,
+// and by hash with compare_hash) receives only the missing tail. Copied
+// files get the source modification time where the backend keeps one.
+// Files present only on the destination are left alone.
+FSResult sync_tree(FileSys& source, const char* source_root, FileSys& dest, const char* dest_root,
+                   const SyncOptions& options, SyncStats& stats);
+
+} // namespace EmbeddedFS
+
+#endif // MIGRATE_H
@@ -0,0 +1,753 @@
+#include "Pack.h"
+#include <cstring>
+
+namespace EmbeddedFS {
+
+// Pack layout, all integers little-endian:
+//   header   magic, version (u16), entry size (u16), 20 reserved bytes,
+//            CRC-32 of the 28 bytes before it; written once
+//   blobs    data then CRC-32 of the data, back to back from the header on
+//   index    count entries of key (NUL padded), offset, size; sorted by key
+//   trailer  CRC-32 of the index entries
+//   footer   magic, count, index offset, dead bytes, 12 reserved bytes,
+//            CRC-32 of the 28 bytes before it; the last bytes of the file
+// A put appends blobs, index, trailer and footer; the footer at the end of
+// the file names the index in force.
+static constexpr uint32_t PACK_MAGIC = 0x4B504645; // "EFPK"
+static constexpr uint32_t PACK_FOOTER_MAGIC = 0x45504645; // "EFPE"
+static constexpr uint16_t PACK_VERSION = 2;
+static constexpr uint32_t PACK_COPY_ENTRIES = 8;   // Index entries moved per read/write
+
+static void put_u16(uint8_t* out, uint16_t value) {
+    out[0] = static_cast<uint8_t>(value);
+    out[1] = static_cast<uint8_t>(value >> 8);
+}
+
+static void put_u32(uint8_t* out, uint32_t value) {
+    out[0] = static_cast<uint8_t>(value);
+    out[1] = static_cast<uint8_t>(value >> 8);
+    out[2] = static_cast<uint8_t>(value >> 16);
+    out[3] = static_cast<uint8_t>(value >> 24);
+}
+
+static uint16_t get_u16(const uint8_t* in) {
+    return static_cast<uint16_t>(in[0] | in[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t* in) {
+    return static_cast<uint32_t>(in[0]) | static_cast<uint32_t>(in[1]) << 8 |
+           static_cast<uint32_t>(in[2]) << 16 | static_cast<uint32_t>(in[3]) << 24;
+}
+
+static void encode_header(uint8_t* out) {
+    memset(out, 0, PACK_HEADER_SIZE);
+    put_u32(out, PACK_MAGIC);
+    put_u16(out + 4, PACK_VERSION);
+    put_u16(out + 6, static_cast<uint16_t>(PACK_ENTRY_SIZE));
+    put_u32(out + 28, FileSys::crc32(0, out, 28));
+}
+
+static void encode_footer(uint8_t* out, uint32_t count, uint32_t index_offset, uint32_t dead_bytes) {
+    memset(out, 0, PACK_FOOTER_SIZE);
+    put_u32(out, PACK_FOOTER_MAGIC);
+    put_u32(out + 4, count);
+    put_u32(out + 8, index_offset);
+    put_u32(out + 12, dead_bytes);
+    put_u32(out + 28, FileSys::crc32(0, out, 28));
+}
+
+static void encode_entry(uint8_t* out, const PackEntry& entry) {
+    memcpy(out, entry.key, PACK_KEY_LENGTH);
+    put_u32(out + PACK_KEY_LENGTH, entry.offset);
+    put_u32(out + PACK_KEY_LENGTH + 4, entry.size);
+}
+
+static void decode_entry(const uint8_t* in, PackEntry& entry) {
+    memcpy(entry.key, in, PACK_KEY_LENGTH);
+    entry.key[PACK_KEY_LENGTH - 1] = '\0';
+    entry.offset = get_u32(in + PACK_KEY_LENGTH);
+    entry.size = get_u32(in + PACK_KEY_LENGTH + 4);
+}
+
+// Non-empty and short enough to keep its NUL
+static bool valid_key(const char* key) {
+    return key && key[0] != '\0' && memchr(key, '\0', PACK_KEY_LENGTH) != nullptr;
+}
+
+static void set_key(PackEntry& entry, const char* key) {
+    memset(entry.key, 0, sizeof(entry.key));
+    strcpy(entry.key, key);
+}
+
+// Write all bytes or fail
+static FSResult write_all(FileSys& fs, FileHandle& handle, const void* data, size_t size) {
+    size_t written;
+    FSResult result = fs.write(handle, data, size, written);
+    if (result == FSResult::OK && written != size) {
+        result = FSResult::ERROR_NO_SPC;
+    }
+    return result;
+}
+
+// Read exactly size bytes; a short read means the pack is cut off
+static FSResult read_all(FileSys& fs, FileHandle& handle, void* data, size_t size) {
+    size_t bytes_read;
+    FSResult result = fs.read(handle, data, size, bytes_read);
+    if (result == FSResult::OK && bytes_read != size) {
+        result = FSResult::ERROR_CORRUPT;
+    }
+    return result;
+}
+
+// Constructor
+PackFile::PackFile(FileSys& fs, const char* path)
+    : fs_(fs), path_(path), open_(false), writable_(false), count_(0),
+      index_offset_(PACK_HEADER_SIZE), dead_bytes_(0), end_(0) {}
+
+// Destructor
+PackFile::~PackFile() {
+    if (open_) {
+        close();
+    }
+}
+
+FSResult PackFile::open(bool writable) {
+    if (open_) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    OpenMode mode = writable ? OpenMode::READ | OpenMode::WRITE | OpenMode::CREATE : OpenMode::READ;
+    FSResult result = fs_.open(file_, path_, mode);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    uint32_t size;
+    result = fs_.file_size(file_, size);
+    if (result == FSResult::OK && size == 0 && writable) {
+        // New pack: the header and an empty index, which is just its trailer
+        uint8_t start[PACK_HEADER_SIZE + 4];
+        encode_header(start);
+        put_u32(start + PACK_HEADER_SIZE, 0);
+        result = write_at(0, start, sizeof(start));
+        if (result == FSResult::OK) {
+            result = commit(0, PACK_HEADER_SIZE, 0, sizeof(start));
+        }
+    } else if (result == FSResult::OK) {
+        uint8_t header[PACK_HEADER_SIZE];
+        uint8_t footer[PACK_FOOTER_SIZE];
+        if (size < PACK_HEADER_SIZE + 4 + PACK_FOOTER_SIZE) {
+            result = FSResult::ERROR_CORRUPT;
+        }
+        if (result == FSResult::OK) {
+            result = read_at(0, header, sizeof(header));
+        }
+        if (result == FSResult::OK) {
+            result = read_at(size - PACK_FOOTER_SIZE, footer, sizeof(footer));
+        }
+        if (result == FSResult::OK &&
+            (get_u32(header) != PACK_MAGIC || get_u32(header + 28) != FileSys::crc32(0, header, 28) ||
+             get_u16(header + 4) != PACK_VERSION || get_u16(header + 6) != PACK_ENTRY_SIZE ||
+             get_u32(footer) != PACK_FOOTER_MAGIC || get_u32(footer + 28) != FileSys::crc32(0, footer, 28))) {
+            result = FSResult::ERROR_CORRUPT;
+        }
+        
+        // The footer follows its index directly
+        if (result == FSResult::OK) {
+            count_ = get_u32(footer + 4);
+            index_offset_ = get_u32(footer + 8);
+            dead_bytes_ = get_u32(footer + 12);
+            end_ = size;
+            uint64_t index_end = static_cast<uint64_t>(index_offset_) + static_cast<uint64_t>(count_) * PACK_ENTRY_SIZE + 4;
+            if (index_offset_ < PACK_HEADER_SIZE || index_end != size - PACK_FOOTER_SIZE) {
+                result = FSResult::ERROR_CORRUPT;
+            }
+        }
+        
+        // The index is trusted from here on, so check it once
+        uint8_t chunk[PACK_COPY_ENTRIES * PACK_ENTRY_SIZE];
+        uint32_t crc = 0;
+        for (uint32_t first = 0; result == FSResult::OK && first < count_; first += PACK_COPY_ENTRIES) {
+            size_t bytes = (count_ - first < PACK_COPY_ENTRIES ? count_ - first : PACK_COPY_ENTRIES) * PACK_ENTRY_SIZE;
+            result = read_at(index_offset_ + first * PACK_ENTRY_SIZE, chunk, bytes);
+            crc = FileSys::crc32(crc, chunk, bytes);
+        }
+        if (result == FSResult::OK) {
+            result = read_at(index_offset_ + count_ * PACK_ENTRY_SIZE, chunk, 4);
+        }
+        if (result == FSResult::OK && get_u32(chunk) != crc) {
+            result = FSResult::ERROR_CORRUPT;
+        }
+    }
+    
+    if (result != FSResult::OK) {
+        fs_.close(file_);
+        return result;
+    }
+    
+    open_ = true;
+    writable_ = writable;
+    return FSResult::OK;
+}
+
+FSResult PackFile::close() {
+    if (!open_) {
+        return FSResult::ERROR_BAD_FILE;
+    }
+    
+    open_ = false;
+    return fs_.close(file_);
+}
+
+FSResult PackFile::get(const char* key, void* buffer, size_t buffer_size, size_t& size) {
+    if (!open_) {
+        return FSResult::ERROR_BAD_FILE;
+    }
+    
+    if (!valid_key(key)) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    uint32_t index;
+    PackEntry entry;
+    bool found;
+    FSResult result = find(key, index, entry, found);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    if (!found) {
+        return FSResult::ERROR_NO_ENT;
+    }
+    
+    size = entry.size;
+    if (buffer_size < entry.size) {
+        return FSResult::ERROR_NO_MEM;
+    }
+    
+    // Blob and CRC are adjacent, so the second read continues the first
+    uint8_t stored[4];
+    result = read_at(entry.offset, buffer, entry.size);
+    if (result == FSResult::OK) {
+        result = read_all(fs_, file_, stored, sizeof(stored));
+    }
+    if (result == FSResult::OK && get_u32(stored) != FileSys::crc32(0, buffer, entry.size)) {
+        result = FSResult::ERROR_CORRUPT;
+    }
+    return result;
+}
+
+FSResult PackFile::put(const char* key, const void* data, size_t size) {
+    if (!open_ || !writable_) {
+        return FSResult::ERROR_BAD_FILE;
+    }
+    
+    if (!valid_key(key) || (!data && size > 0)) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    // The blob goes after the current footer, then the new index and footer;
+    // until they are synced the file still ends at the old footer
+    uint32_t index_size = count_ * PACK_ENTRY_SIZE + 4;
+    uint32_t blob_offset = end_;
+    if (static_cast<uint64_t>(blob_offset) + size + 4 + index_size + PACK_ENTRY_SIZE + PACK_FOOTER_SIZE >
+        UINT32_MAX) {
+        return FSResult::ERROR_FB_BIG;
+    }
+    
+    uint32_t index;
+    PackEntry old;
+    bool found;
+    FSResult result = find(key, index, old, found);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    uint8_t crc_bytes[4];
+    put_u32(crc_bytes, FileSys::crc32(0, data, size));
+    result = write_at(blob_offset, data, size);
+    if (result == FSResult::OK) {
+        result = write_all(fs_, file_, crc_bytes, sizeof(crc_bytes));
+    }
+    
+    // Old entries up to the key, the new entry, then the rest
+    uint32_t new_index_offset = blob_offset + static_cast<uint32_t>(size) + 4;
+    uint32_t offset = new_index_offset;
+    uint32_t crc = 0;
+    if (result == FSResult::OK) {
+        result = copy_index(0, index, offset, crc);
+    }
+    if (result == FSResult::OK) {
+        PackEntry entry;
+        set_key(entry, key);
+        entry.offset = blob_offset;
+        entry.size = static_cast<uint32_t>(size);
+        
+        uint8_t raw[PACK_ENTRY_SIZE];
+        encode_entry(raw, entry);
+        result = write_at(offset, raw, sizeof(raw));
+        crc = FileSys::crc32(crc, raw, sizeof(raw));
+        offset += PACK_ENTRY_SIZE;
+    }
+    if (result == FSResult::OK) {
+        result = copy_index(found ? index + 1 : index, count_, offset, crc);
+    }
+    if (result == FSResult::OK) {
+        put_u32(crc_bytes, crc);
+        result = write_at(offset, crc_bytes, sizeof(crc_bytes));
+        offset += 4;
+    }
+    
+    uint32_t count = found ? count_ : count_ + 1;
+    uint32_t dead_bytes = dead_bytes_ + index_size + PACK_FOOTER_SIZE + (found ? old.size + 4 : 0);
+    if (result == FSResult::OK) {
+        result = commit(count, new_index_offset, dead_bytes, offset);
+    }
+    if (result != FSResult::OK) {
+        // Drop the partial append so a later close cannot move the end of
+        // file past the last footer
+        fs_.truncate(file_, end_);
+    }
+    return result;
+}
+
+FSResult PackFile::entry(uint32_t index, PackEntry& entry) {
+    if (!open_) {
+        return FSResult::ERROR_BAD_FILE;
+    }
+    
+    if (index >= count_) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    uint8_t raw[PACK_ENTRY_SIZE];
+    FSResult result = read_at(index_offset_ + index * PACK_ENTRY_SIZE, raw, sizeof(raw));
+    if (result == FSResult::OK) {
+        decode_entry(raw, entry);
+    }
+    return result;
+}
+
+FSResult PackFile::read_at(uint32_t offset, void* data, size_t size) {
+    FSResult result = fs_.seek(file_, static_cast<int32_t>(offset), SeekOrigin::SET);
+    if (result == FSResult::OK) {
+        result = read_all(fs_, file_, data, size);
+    }
+    return result;
+}
+
+FSResult PackFile::write_at(uint32_t offset, const void* data, size_t size) {
+    FSResult result = fs_.seek(file_, static_cast<int32_t>(offset), SeekOrigin::SET);
+    if (result == FSResult::OK) {
+        result = write_all(fs_, file_, data, size);
+    }
+    return result;
+}
+
+// Append the footer for a new index and sync. The sync moves the end of
+// file onto the new footer in one metadata update (the LittleFS commit or
+// the FAT directory entry), which makes it the commit point of a put.
+FSResult PackFile::commit(uint32_t count, uint32_t index_offset, uint32_t dead_bytes, uint32_t footer_offset) {
+    uint8_t footer[PACK_FOOTER_SIZE];
+    encode_footer(footer, count, index_offset, dead_bytes);
+    
+    FSResult result = write_at(footer_offset, footer, sizeof(footer));
+    if (result == FSResult::OK) {
+        result = fs_.sync(file_);
+    }
+    if (result == FSResult::OK) {
+        count_ = count;
+        index_offset_ = index_offset;
+        dead_bytes_ = dead_bytes;
+        end_ = footer_offset + static_cast<uint32_t>(PACK_FOOTER_SIZE);
+    }
+    return result;
+}
+
+// Binary search of the index. Without a match, index is where key would be
+// inserted.
+FSResult PackFile::find(const char* key, uint32_t& index, PackEntry& entry, bool& found) {
+    uint32_t low = 0;
+    uint32_t high = count_;
+    found = false;
+    
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        uint8_t raw[PACK_ENTRY_SIZE];
+        FSResult result = read_at(index_offset_ + mid * PACK_ENTRY_SIZE, raw, sizeof(raw));
+        if (result != FSResult::OK) {
+            return result;
+        }
+        
+        int order = strncmp(key, reinterpret_cast<const char*>(raw), PACK_KEY_LENGTH);
+        if (order == 0) {
+            decode_entry(raw, entry);
+            index = mid;
+            found = true;
+            return FSResult::OK;
+        }
+        if (order < 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    
+    index = low;
+    return FSResult::OK;
+}
+
+// Copy entries first..last-1 of the current index to offset, advancing
+// offset and folding them into crc
+FSResult PackFile::copy_index(uint32_t first, uint32_t last, uint32_t& offset, uint32_t& crc) {
+    uint8_t chunk[PACK_COPY_ENTRIES * PACK_ENTRY_SIZE];
+    
+    while (first < last) {
+        uint32_t entries = last - first < PACK_COPY_ENTRIES ? last - first : PACK_COPY_ENTRIES;
+        size_t bytes = entries * PACK_ENTRY_SIZE;
+        FSResult result = read_at(index_offset_ + first * PACK_ENTRY_SIZE, chunk, bytes);
+        if (result == FSResult::OK) {
+            result = write_at(offset, chunk, bytes);
+        }
+        if (result != FSResult::OK) {
+            return result;
+        }
+        
+        crc = FileSys::crc32(crc, chunk, bytes);
+        first += entries;
+        offset += static_cast<uint32_t>(bytes);
+    }
+    
+    return FSResult::OK;
+}
+
+// Index trailer and footer that close a pack written front to back
+static FSResult write_tail(FileSys& fs, FileHandle& pack, uint32_t crc, uint32_t count, uint32_t index_offset) {
+    uint8_t tail[4 + PACK_FOOTER_SIZE];
+    put_u32(tail, crc);
+    encode_footer(tail + 4, count, index_offset, 0);
+    return write_all(fs, pack, tail, sizeof(tail));
+}
+
+// State of a build, passed through atomic_replace
+struct PackBuild {
+    FileSys* fs;
+    const char* source_dir;
+    PackEntry* scratch;
+    size_t scratch_count;
+    uint8_t* buffer;
+    size_t buffer_size;
+    PackStats* stats;
+};
+
+// Files that can be packed: plain files whose name fits a key
+static bool packable(const FileInfo& info) {
+    return !info.is_directory && valid_key(info.name);
+}
+
+// Counting pass: number of blobs and the space their data takes
+static FSResult count_files(PackBuild& build, uint32_t& count, uint64_t& data_size) {
+    DirHandle dir;
+    FSResult result = build.fs->opendir(dir, build.source_dir);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    build.stats->passes++;
+    
+    count = 0;
+    data_size = 0;
+    FileInfo info;
+    while ((result = build.fs->readdir(dir, info)) == FSResult::OK && info.name[0] != '\0') {
+        if (!packable(info)) {
+            if (strcmp(info.name, ".") != 0 && strcmp(info.name, "..") != 0) {
+                build.stats->skipped++;
+            }
+            continue;
+        }
+        count++;
+        data_size += static_cast<uint64_t>(info.size) + 4;
+    }
+    
+    build.fs->closedir(dir);
+    return result;
+}
+
+// Fill scratch, in key order, with the first scratch_count files whose name
+// sorts after `after` (from the start when after is null)
+static FSResult select_files(PackBuild& build, const char* after, size_t& selected) {
+    DirHandle dir;
+    FSResult result = build.fs->opendir(dir, build.source_dir);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    build.stats->passes++;
+    
+    selected = 0;
+    FileInfo info;
+    while ((result = build.fs->readdir(dir, info)) == FSResult::OK && info.name[0] != '\0') {
+        if (!packable(info) || (after && strcmp(info.name, after) <= 0)) {
+            continue;
+        }
+        
+        size_t low = 0;
+        size_t high = selected;
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            if (strcmp(build.scratch[mid].key, info.name) < 0) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        if (low >= build.scratch_count) {
+            continue;
+        }
+        
+        // Full: the largest key drops out to make room
+        if (selected == build.scratch_count) {
+            selected--;
+        }
+        memmove(&build.scratch[low + 1], &build.scratch[low], (selected - low) * sizeof(PackEntry));
+        set_key(build.scratch[low], info.name);
+        build.scratch[low].offset = 0;
+        build.scratch[low].size = info.size;
+        selected++;
+    }
+    
+    build.fs->closedir(dir);
+    return result;
+}
+
+// Stream one source file into the pack, followed by its CRC
+static FSResult copy_file(PackBuild& build, FileHandle& pack, const PackEntry& entry) {
+    char path[MAX_PATH_LENGTH];
+    if (!FileSys::join_path(path, sizeof(path), build.source_dir, entry.key)) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    FileHandle file;
+    FSResult result = build.fs->open(file, path, OpenMode::READ);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    uint32_t crc = 0;
+    uint32_t copied = 0;
+    size_t bytes_read;
+    while ((result = build.fs->read(file, build.buffer, build.buffer_size, bytes_read)) == FSResult::OK &&
+           bytes_read > 0) {
+        crc = FileSys::crc32(crc, build.buffer, bytes_read);
+        copied += static_cast<uint32_t>(bytes_read);
+        result = write_all(*build.fs, pack, build.buffer, bytes_read);
+        if (result != FSResult::OK) {
+            break;
+        }
+    }
+    build.fs->close(file);
+    
+    // The offsets were laid out from the sizes seen while counting
+    if (result == FSResult::OK && copied != entry.size) {
+        result = FSResult::ERROR_CORRUPT;
+    }
+    if (result == FSResult::OK) {
+        uint8_t crc_bytes[4];
+        put_u32(crc_bytes, crc);
+        result = write_all(*build.fs, pack, crc_bytes, sizeof(crc_bytes));
+    }
+    if (result == FSResult::OK) {
+        build.stats->entries++;
+        build.stats->bytes += copied;
+    }
+    return result;
+}
+
+// Walk the directory in key order, one scratch load per pass, writing
+// either the blobs or the index entries that point at them
+static FSResult emit_files(PackBuild& build, FileHandle& pack, uint32_t count, bool index, uint32_t& crc) {
+    char last[PACK_KEY_LENGTH];
+    uint32_t done = 0;
+    uint32_t offset = PACK_HEADER_SIZE;
+    
+    while (done < count) {
+        size_t selected;
+        FSResult result = select_files(build, done ? last : nullptr, selected);
+        if (result == FSResult::OK && (selected == 0 || done + selected > count)) {
+            result = FSResult::ERROR_CORRUPT;   // The directory changed during the build
+        }
+        
+        for (size_t i = 0; result == FSResult::OK && i < selected; i++) {
+            PackEntry& entry = build.scratch[i];
+            if (index) {
+                entry.offset = offset;
+                uint8_t raw[PACK_ENTRY_SIZE];
+                encode_entry(raw, entry);
+                result = write_all(*build.fs, pack, raw, sizeof(raw));
+                crc = FileSys::crc32(crc, raw, sizeof(raw));
+                offset += entry.size + 4;
+            } else {
+                result = copy_file(build, pack, entry);
+            }
+        }
+        if (result != FSResult::OK) {
+            return result;
+        }
+        
+        memcpy(last, build.scratch[selected - 1].key, PACK_KEY_LENGTH);
+        done += static_cast<uint32_t>(selected);
+    }
+    
+    return FSResult::OK;
+}
+
+static FSResult build_writer(FileHandle& pack, void* context) {
+    PackBuild& build = *static_cast<PackBuild*>(context);
+    
+    uint32_t count;
+    uint64_t data_size;
+    FSResult result = count_files(build, count, data_size);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    if (PACK_HEADER_SIZE + data_size + static_cast<uint64_t>(count) * PACK_ENTRY_SIZE + 4 + PACK_FOOTER_SIZE >
+        UINT32_MAX) {
+        return FSResult::ERROR_FB_BIG;
+    }
+    
+    uint8_t header[PACK_HEADER_SIZE];
+    encode_header(header);
+    result = write_all(*build.fs, pack, header, sizeof(header));
+    
+    uint32_t crc = 0;
+    if (result == FSResult::OK) {
+        result = emit_files(build, pack, count, false, crc);
+    }
+    if (result == FSResult::OK) {
+        result = emit_files(build, pack, count, true, crc);
+    }
+    if (result == FSResult::OK) {
+        result = write_tail(*build.fs, pack, crc, count, static_cast<uint32_t>(PACK_HEADER_SIZE + data_size));
+    }
+    return result;
+}
+
+FSResult PackFile::build(FileSys& fs, const char* source_dir, const char* path,
+                         PackEntry* scratch, size_t scratch_count,
+                         uint8_t* buffer, size_t buffer_size, PackStats& stats) {
+    if (!source_dir || !path || !scratch || scratch_count == 0 || !buffer || buffer_size == 0) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    stats = PackStats();
+    PackBuild build = { &fs, source_dir, scratch, scratch_count, buffer, buffer_size, &stats };
+    return fs.atomic_replace(path, build_writer, &build);
+}
+
+// State of a compaction, passed through atomic_replace
+struct PackCompact {
+    PackFile* source;
+    uint8_t* buffer;
+    size_t buffer_size;
+    PackStats* stats;
+    uint32_t source_size;
+};
+
+FSResult PackFile::compact_writer(FileHandle& pack, void* context) {
+    PackCompact& compact = *static_cast<PackCompact*>(context);
+    PackFile& source = *compact.source;
+    FileSys& fs = source.fs_;
+    
+    // Live blobs only, so the index moves up to right after them
+    uint64_t data_size = 0;
+    PackEntry entry;
+    FSResult result = FSResult::OK;
+    for (uint32_t i = 0; result == FSResult::OK && i < source.count_; i++) {
+        result = source.entry(i, entry);
+        data_size += static_cast<uint64_t>(entry.size) + 4;
+    }
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    uint32_t index_offset = static_cast<uint32_t>(PACK_HEADER_SIZE + data_size);
+    uint8_t header[PACK_HEADER_SIZE];
+    encode_header(header);
+    result = write_all(fs, pack, header, sizeof(header));
+    
+    for (uint32_t i = 0; result == FSResult::OK && i < source.count_; i++) {
+        result = source.entry(i, entry);
+        
+        uint32_t crc = 0;
+        for (uint32_t done = 0; result == FSResult::OK && done < entry.size;) {
+            size_t chunk = entry.size - done < compact.buffer_size ? entry.size - done : compact.buffer_size;
+            result = source.read_at(entry.offset + done, compact.buffer, chunk);
+            if (result == FSResult::OK) {
+                result = write_all(fs, pack, compact.buffer, chunk);
+            }
+            crc = FileSys::crc32(crc, compact.buffer, chunk);
+            done += static_cast<uint32_t>(chunk);
+        }
+        
+        uint8_t stored[4];
+        if (result == FSResult::OK) {
+            result = source.read_at(entry.offset + entry.size, stored, sizeof(stored));
+        }
+        if (result == FSResult::OK && get_u32(stored) != crc) {
+            result = FSResult::ERROR_CORRUPT;
+        }
+        if (result == FSResult::OK) {
+            result = write_all(fs, pack, stored, sizeof(stored));
+            compact.stats->entries++;
+            compact.stats->bytes += entry.size;
+        }
+    }
+    
+    uint32_t offset = PACK_HEADER_SIZE;
+    uint32_t crc = 0;
+    for (uint32_t i = 0; result == FSResult::OK && i < source.count_; i++) {
+        result = source.entry(i, entry);
+        entry.offset = offset;
+        offset += entry.size + 4;
+        
+        uint8_t raw[PACK_ENTRY_SIZE];
+        encode_entry(raw, entry);
+        if (result == FSResult::OK) {
+            result = write_all(fs, pack, raw, sizeof(raw));
+        }
+        crc = FileSys::crc32(crc, raw, sizeof(raw));
+    }
+    if (result == FSResult::OK) {
+        result = write_tail(fs, pack, crc, source.count_, index_offset);
+    }
+    
+    if (result == FSResult::OK) {
+        compact.stats->reclaimed =
+            compact.source_size - (index_offset + source.count_ * PACK_ENTRY_SIZE + 4 + PACK_FOOTER_SIZE);
+    }
+    return result;
+}
+
+FSResult PackFile::compact(FileSys& fs, const char* path, uint8_t* buffer, size_t buffer_size,
+                           PackStats& stats) {
+    if (!path || !buffer || buffer_size == 0) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    stats = PackStats();
+    PackFile source(fs, path);
+    FSResult result = source.open(false);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    // Every read of the old pack happens inside the writer, before the
+    // replacement is committed
+    PackCompact compact = { &source, buffer, buffer_size, &stats, 0 };
+    result = fs.file_size(source.file_, compact.source_size);
+    if (result == FSResult::OK) {
+        result = fs.atomic_replace(path, compact_writer, &compact);
+    }
+    
+    FSResult close_result = source.close();
+    return result != FSResult::OK ? result : close_result;
+}
+
+} // namespace EmbeddedFS
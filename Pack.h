@@ -0,0 +1,123 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include "FileSys.h"
+
+namespace EmbeddedFS {
+
+static constexpr size_t PACK_KEY_LENGTH = 24;       // Key bytes including the NUL
+static constexpr size_t PACK_HEADER_SIZE = 32;
+static constexpr size_t PACK_FOOTER_SIZE = 32;
+static constexpr size_t PACK_ENTRY_SIZE = 32;
+
+// Index entry of a pack; blob data starts at offset and is followed by its
+// CRC-32
+struct PackEntry {
+    char key[PACK_KEY_LENGTH];
+    uint32_t offset;
+    uint32_t size;
+};
+
+// Counters of a PackFile::build or PackFile::compact run
+struct PackStats {
+    uint32_t entries;
+    uint32_t skipped;               // Build: subdirectories and names too long for a key
+    uint32_t passes;                // Build: scans of the source directory
+    uint64_t bytes;                 // Blob data, without CRCs or index
+    uint32_t reclaimed;             // Compact: bytes of superseded blobs and indexes dropped
+    
+    PackStats() : entries(0), skipped(0), passes(0), bytes(0), reclaimed(0) {}
+};
+
+// Many small blobs in one file, found by key through a sorted index.
+//
+// A file of a few dozen bytes still costs a metadata entry on LittleFS and
+// a whole cluster on FatFS, and finding it means searching its directory.
+// A pack stores the blobs back to back, each followed by its CRC-32, then
+// an index of fixed-size entries sorted by key and the index CRC, then a
+// footer that ends the file and points at the index. open() reads the
+// footer from the end of the file. get() is a binary search over the index
+// (log2(count) entry reads on the one open handle) and a single read of
+// the blob.
+//
+// put() appends the blob, a new copy of the index and a new footer, then
+// syncs once. Nothing already in the file is rewritten, so on LittleFS the
+// sync copies at most the last partly filled block rather than the whole
+// file. The sync that moves the end of file is the commit point: after an
+// interrupted put the file still ends at the previous footer. The old
+// index, footer and any replaced blob become dead space (dead_bytes())
+// until compact(). As every put copies the whole index, fill a pack in
+// bulk with build() rather than one put per blob.
+//
+// Usage:
+//   PackFile pack(fs, "/cal.pack");
+//   pack.open(false);
+//   pack.get("dev-00417", blob, sizeof(blob), size);
+class PackFile {
+public:
+    PackFile(FileSys& fs, const char* path);
+    ~PackFile();
+    
+    // Open the pack; a writable open creates an empty pack if none exists.
+    // The header, footer and index CRC are checked, ERROR_CORRUPT if they
+    // fail.
+    FSResult open(bool writable);
+    FSResult close();
+    
+    uint32_t count() const { return count_; }
+    uint32_t dead_bytes() const { return dead_bytes_; }
+    
+    // Copy the blob stored under key into buffer. size is set whenever the
+    // key exists; ERROR_NO_MEM if buffer_size is smaller, ERROR_CORRUPT if
+    // the blob fails its CRC.
+    FSResult get(const char* key, void* buffer, size_t buffer_size, size_t& size);
+    
+    // Add a blob or replace the one stored under key, and sync
+    FSResult put(const char* key, const void* data, size_t size);
+    
+    // List the pack: entries 0..count()-1 in key order
+    FSResult entry(uint32_t index, PackEntry& entry);
+    
+    // Pack every file directly inside source_dir into a new pack at path,
+    // keyed by file name, replacing any pack there with atomic_replace.
+    // scratch holds the keys of one pass: each pass over the directory
+    // collects the next scratch_count keys in order, so with room for all
+    // of them the directory is read three times in total (count, data,
+    // index). buffer carries the file data. path must not lie inside
+    // source_dir.
+    static FSResult build(FileSys& fs, const char* source_dir, const char* path,
+                          PackEntry* scratch, size_t scratch_count,
+                          uint8_t* buffer, size_t buffer_size, PackStats& stats);
+    
+    // Rewrite the pack at path without dead space, checking each blob's
+    // CRC on the way. The pack must not be open elsewhere.
+    static FSResult compact(FileSys& fs, const char* path, uint8_t* buffer, size_t buffer_size,
+                            PackStats& stats);
+
+private:
+    FileSys& fs_;
+    const char* path_;
+    FileHandle file_;
+    bool open_;
+    bool writable_;
+    uint32_t count_;
+    uint32_t index_offset_;
+    uint32_t dead_bytes_;
+    uint32_t end_;                  // Committed file size, just past the footer
+    
+    FSResult read_at(uint32_t offset, void* data, size_t size);
+    FSResult write_at(uint32_t offset, const void* data, size_t size);
+    FSResult commit(uint32_t count, uint32_t index_offset, uint32_t dead_bytes, uint32_t footer_offset);
+    FSResult find(const char* key, uint32_t& index, PackEntry& entry, bool& found);
+    FSResult copy_index(uint32_t first, uint32_t last, uint32_t& offset, uint32_t& crc);
+    
+    static FSResult compact_writer(FileHandle& pack, void* context);
+    
+    // Disable copy construction and assignment
+    PackFile(const PackFile&) = delete;
+    PackFile& operator=(const PackFile&) = delete;
+};
+
+} // namespace EmbeddedFS
+
+#endif // PACK_H
@@ -0,0 +1,111 @@
+#include "PollOp.h"
+
+namespace EmbeddedFS {
+
+PollOp::PollOp(FileSys& fs, size_t step_bytes)
+    : fs_(fs), handle_(nullptr), buffer_(nullptr), size_(0), done_(0),
+      step_bytes_(step_bytes ? step_bytes : BUFFER_SIZE), position_(0),
+      state_(State::IDLE), sync_after_(false) {
+}
+
+FSResult PollOp::start_read(FileHandle& handle, void* buffer, size_t size) {
+    return start(handle, State::READ, buffer, size);
+}
+
+FSResult PollOp::start_write(FileHandle& handle, const void* buffer, size_t size, bool sync_after) {
+    FSResult result = start(handle, State::WRITE, const_cast<void*>(buffer), size);
+    if (result == FSResult::OK) {
+        sync_after_ = sync_after;
+    }
+    return result;
+}
+
+FSResult PollOp::start_sync(FileHandle& handle) {
+    return start(handle, State::SYNC, nullptr, 0);
+}
+
+FSResult PollOp::start(FileHandle& handle, State state, void* buffer, size_t size) {
+    if (state_ != State::IDLE) {
+        return FSResult::ERROR_INVALID;
+    }
+    if (!handle.is_open) {
+        return FSResult::ERROR_BAD_FILE;
+    }
+    
+    // Only needed to align steps; an unknown position just leaves them unaligned
+    uint32_t position = 0;
+    if (state != State::SYNC && fs_.tell(handle, position) != FSResult::OK) {
+        position = 0;
+    }
+    
+    handle_ = &handle;
+    buffer_ = static_cast<uint8_t*>(buffer);
+    size_ = size;
+    done_ = 0;
+    position_ = position;
+    state_ = state;
+    sync_after_ = false;
+    return FSResult::OK;
+}
+
+FSResult PollOp::step() {
+    switch (state_) {
+        case State::IDLE:
+            return FSResult::ERROR_INVALID;
+        
+        case State::SYNC:
+            return finish(fs_.sync(*handle_));
+        
+        case State::READ:
+        case State::WRITE: {
+            if (done_ >= size_) {
+                if (state_ == State::WRITE && sync_after_) {
+                    state_ = State::SYNC;
+                    return FSResult::IN_PROGRESS;
+                }
+                return finish(FSResult::OK);
+            }
+            
+            // Up to the next step boundary of the file
+            size_t chunk = step_bytes_ - position_ % step_bytes_;
+            if (chunk > size_ - done_) {
+                chunk = size_ - done_;
+            }
+            
+            size_t moved = 0;
+            FSResult result;
+            if (state_ == State::READ) {
+                result = fs_.read(*handle_, buffer_ + done_, chunk, moved);
+            } else {
+                result = fs_.write(*handle_, buffer_ + done_, chunk, moved);
+            }
+            done_ += moved;
+            position_ += static_cast<uint32_t>(moved);
+            
+            if (result != FSResult::OK) {
+                return finish(result);
+            }
+            if (moved < chunk) {
+                // End of file on read, full volume on write
+                return finish(state_ == State::READ ? FSResult::OK : FSResult::ERROR_NO_SPC);
+            }
+            return FSResult::IN_PROGRESS;
+        }
+    }
+    
+    return FSResult::ERROR_INVALID;
+}
+
+void PollOp::cancel() {
+    finish(FSResult::OK);
+}
+
+FSResult PollOp::finish(FSResult result) {
+    state_ = State::IDLE;
+    handle_ = nullptr;
+    buffer_ = nullptr;
+    sync_after_ = false;
+    return result;
+}
+
+} // namespace EmbeddedFS
@@ -0,0 +1,66 @@
+#ifndef POLL_OP_H
+#define POLL_OP_H
+
+#include "FileSys.h"
+
+namespace EmbeddedFS {
+
+// Poll-driven read, write or sync for firmware without threads.
+//
+// start_*() only records the request; every step() then moves at most
+// step_bytes (default BUFFER_SIZE, ideally one flash page or one sector)
+// through the backend, aligned to the file position so that each step maps
+// onto a single program or sector transfer. step() returns IN_PROGRESS
+// until the request is finished and then its final result. A sync is a
+// single backend commit and cannot be split; it takes one step.
+//
+// Usage in a super-loop:
+//   PollOp op(fs);
+//   op.start_write(file, data, sizeof(data));
+//   while (true) {
+//       control_loop();
+//       if (op.busy() && op.step() != FSResult::IN_PROGRESS) { ... }
+//   }
+class PollOp {
+public:
+    explicit PollOp(FileSys& fs, size_t step_bytes = BUFFER_SIZE);
+    
+    FSResult start_read(FileHandle& handle, void* buffer, size_t size);
+    FSResult start_write(FileHandle& handle, const void* buffer, size_t size, bool sync_after = false);
+    FSResult start_sync(FileHandle& handle);
+    
+    FSResult step();
+    void cancel();                  // Stop between steps; data moved so far stays moved
+    
+    bool busy() const { return state_ != State::IDLE; }
+    size_t transferred() const { return done_; }
+
+private:
+    enum class State : uint8_t {
+        IDLE,
+        READ,
+        WRITE,
+        SYNC
+    };
+    
+    FileSys& fs_;
+    FileHandle* handle_;
+    uint8_t* buffer_;
+    size_t size_;
+    size_t done_;
+    size_t step_bytes_;
+    uint32_t position_;             // File position of the next step, for alignment
+    State state_;
+    bool sync_after_;
+    
+    FSResult start(FileHandle& handle, State state, void* buffer, size_t size);
+    FSResult finish(FSResult result);
+    
+    // Disable copy construction and assignment
+    PollOp(const PollOp&) = delete;
+    PollOp& operator=(const PollOp&) = delete;
+};
+
+} // namespace EmbeddedFS
+
+#endif // POLL_OP_H
@@ -0,0 +1,535 @@
+#include "Tar.h"
+#include "TreeWalker.h"
+#include <cstring>
+
+namespace EmbeddedFS {
+
+// ustar header layout (POSIX.1-1988)
+static constexpr size_t TAR_NAME = 0;
+static constexpr size_t TAR_MODE = 100;
+static constexpr size_t TAR_UID = 108;
+static constexpr size_t TAR_GID = 116;
+static constexpr size_t TAR_SIZE = 124;
+static constexpr size_t TAR_MTIME = 136;
+static constexpr size_t TAR_CHECKSUM = 148;
+static constexpr size_t TAR_TYPE = 156;
+static constexpr size_t TAR_MAGIC = 257;
+static constexpr size_t TAR_VERSION = 263;
+static constexpr size_t TAR_PREFIX = 345;
+
+static constexpr size_t TAR_NAME_LENGTH = 100;
+static constexpr size_t TAR_PREFIX_LENGTH = 155;
+
+static constexpr char TAR_TYPE_FILE = '0';
+static constexpr char TAR_TYPE_FILE_OLD = '\0';
+static constexpr char TAR_TYPE_DIRECTORY = '5';
+static constexpr char TAR_TYPE_LONG_NAME = 'L';     // GNU: data is the next entry's name
+static constexpr char TAR_TYPE_PAX = 'x';           // pax: data is records for the next entry
+
+// Zero-padded octal field with the terminating NUL
+static void put_octal(uint8_t* field, size_t length, uint64_t value) {
+    field[--length] = '\0';
+    while (length > 0) {
+        field[--length] = static_cast<uint8_t>('0' + (value & 7));
+        value >>= 3;
+    }
+}
+
+static uint64_t get_octal(const uint8_t* field, size_t length) {
+    uint64_t value = 0;
+    size_t i = 0;
+    while (i < length && field[i] == ' ') {
+        i++;
+    }
+    for (; i < length && field[i] >= '0' && field[i] <= '7'; i++) {
+        value = value << 3 | static_cast<uint64_t>(field[i] - '0');
+    }
+    return value;
+}
+
+// Unsigned sum of the header with the checksum field read as spaces
+static uint32_t header_checksum(const uint8_t* header) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; i++) {
+        sum += (i >= TAR_CHECKSUM && i < TAR_CHECKSUM + 8) ? ' ' : header[i];
+    }
+    return sum;
+}
+
+// Split name over the prefix and name fields at a '/'
+static bool put_name(uint8_t* header, const char* name, size_t length) {
+    if (length <= TAR_NAME_LENGTH) {
+        memcpy(header + TAR_NAME, name, length);
+        return true;
+    }
+    for (size_t split = length - 1; split > 0; split--) {
+        if (name[split] == '/' && split <= TAR_PREFIX_LENGTH && length - split - 1 <= TAR_NAME_LENGTH) {
+            memcpy(header + TAR_PREFIX, name, split);
+            memcpy(header + TAR_NAME, name + split + 1, length - split - 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool build_header(uint8_t* header, const char* name, const FileInfo& info) {
+    memset(header, 0, TAR_BLOCK_SIZE);
+    
+    // Directories carry a trailing '/'
+    char entry_name[MAX_PATH_LENGTH + 1];
+    size_t length = strlen(name);
+    memcpy(entry_name, name, length);
+    if (info.is_directory) {
+        entry_name[length++] = '/';
+    }
+    if (!put_name(header, entry_name, length)) {
+        return false;
+    }
+    
+    put_octal(header + TAR_MODE, 8, info.is_directory ? 0755 : 0644);
+    put_octal(header + TAR_UID, 8, 0);
+    put_octal(header + TAR_GID, 8, 0);
+    put_octal(header + TAR_SIZE, 12, info.is_directory ? 0 : info.size);
+    put_octal(header + TAR_MTIME, 12, info.modified_time);
+    header[TAR_TYPE] = static_cast<uint8_t>(info.is_directory ? TAR_TYPE_DIRECTORY : TAR_TYPE_FILE);
+    memcpy(header + TAR_MAGIC, "ustar", 6);
+    memcpy(header + TAR_VERSION, "00", 2);
+    
+    // Six digits, NUL, space
+    put_octal(header + TAR_CHECKSUM, 7, header_checksum(header));
+    header[TAR_CHECKSUM + 7] = ' ';
+    return true;
+}
+
+// Export: the buffer is filled in whole blocks and handed to the sink when full
+struct TarWriter {
+    uint8_t* buffer;
+    size_t size;
+    size_t used;
+    TarWriteFn write;
+    void* context;
+    
+    FSResult flush() {
+        FSResult result = used ? write(context, buffer, used) : FSResult::OK;
+        used = 0;
+        return result;
+    }
+    
+    FSResult reserve() {
+        return used == size ? flush() : FSResult::OK;
+    }
+    
+    // Zero up to the next block boundary
+    void pad() {
+        size_t tail = used % TAR_BLOCK_SIZE;
+        if (tail) {
+            memset(buffer + used, 0, TAR_BLOCK_SIZE - tail);
+            used += TAR_BLOCK_SIZE - tail;
+        }
+    }
+};
+
+static FSResult export_file(FileSys& fs, const char* path, uint32_t size, TarWriter& writer) {
+    FileHandle file;
+    FSResult result = fs.open(file, path, OpenMode::READ);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    // Exactly size bytes go out, as the header promised
+    uint32_t remaining = size;
+    while (remaining > 0 && (result = writer.reserve()) == FSResult::OK) {
+        size_t chunk = writer.size - writer.used;
+        if (chunk > remaining) {
+            chunk = remaining;
+        }
+        size_t bytes_read;
+        result = fs.read(file, writer.buffer + writer.used, chunk, bytes_read);
+        if (result == FSResult::OK && bytes_read == 0) {
+            result = FSResult::ERROR_IO;        // File shrank under us
+        }
+        if (result != FSResult::OK) {
+            break;
+        }
+        writer.used += bytes_read;
+        remaining -= static_cast<uint32_t>(bytes_read);
+    }
+    
+    fs.close(file);
+    if (result == FSResult::OK) {
+        writer.pad();
+    }
+    return result;
+}
+
+FSResult tar_export(FileSys& fs, const char* root, uint8_t* buffer, size_t buffer_size,
+                    TarWriteFn write, void* context, TarStats& stats) {
+    if (!buffer || !write || buffer_size < TAR_BLOCK_SIZE || buffer_size % TAR_BLOCK_SIZE != 0) {
+        return FSResult::ERROR_INVALID;
+    }
+    stats = TarStats();
+    
+    TreeWalker walker(fs);
+    FSResult result = walker.start(root);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    TarWriter writer = { buffer, buffer_size, 0, write, context };
+    FileInfo info;
+    while ((result = walker.next(info)) == FSResult::OK && info.name[0] != '\0') {
+        result = writer.reserve();
+        if (result != FSResult::OK) {
+            break;
+        }
+        if (!build_header(writer.buffer + writer.used, walker.relative_path(), info)) {
+            result = FSResult::ERROR_INVALID;
+            break;
+        }
+        writer.used += TAR_BLOCK_SIZE;
+        
+        if (info.is_directory) {
+            stats.directories++;
+        } else {
+            result = export_file(fs, walker.path(), info.size, writer);
+            if (result != FSResult::OK) {
+                break;
+            }
+            stats.files++;
+            stats.bytes += info.size;
+        }
+    }
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    // End of archive: two zero blocks
+    for (int i = 0; i < 2 && result == FSResult::OK; i++) {
+        result = writer.reserve();
+        memset(writer.buffer + writer.used, 0, TAR_BLOCK_SIZE);
+        writer.used += TAR_BLOCK_SIZE;
+    }
+    return result == FSResult::OK ? writer.flush() : result;
+}
+
+// Import: bytes between start and end are buffered input not yet consumed
+struct TarReader {
+    uint8_t* buffer;
+    size_t size;
+    size_t start;
+    size_t end;
+    TarReadFn read;
+    void* context;
+    
+    // Make at least count bytes available; false at end of stream
+    FSResult fill(size_t count, bool& eof) {
+        eof = false;
+        if (end - start >= count) {
+            return FSResult::OK;
+        }
+        memmove(buffer, buffer + start, end - start);
+        end -= start;
+        start = 0;
+        while (end < count) {
+            size_t bytes_read;
+            FSResult result = read(context, buffer + end, size - end, bytes_read);
+            if (result != FSResult::OK) {
+                return result;
+            }
+            if (bytes_read == 0) {
+                eof = true;
+                return FSResult::OK;
+            }
+            end += bytes_read;
+        }
+        return FSResult::OK;
+    }
+    
+    // Consume count bytes, writing them to file if one is given
+    FSResult take(uint64_t count, FileSys* fs, FileHandle* file) {
+        while (count > 0) {
+            bool eof;
+            FSResult result = fill(1, eof);
+            if (result != FSResult::OK) {
+                return result;
+            }
+            if (eof) {
+                return FSResult::ERROR_CORRUPT;     // Truncated archive
+            }
+            size_t chunk = end - start;
+            if (chunk > count) {
+                chunk = static_cast<size_t>(count);
+            }
+            if (fs) {
+                size_t bytes_written;
+                result = fs->write(*file, buffer + start, chunk, bytes_written);
+                if (result == FSResult::OK && bytes_written != chunk) {
+                    result = FSResult::ERROR_NO_SPC;
+                }
+                if (result != FSResult::OK) {
+                    return result;
+                }
+            }
+            start += chunk;
+            count -= chunk;
+        }
+        return FSResult::OK;
+    }
+};
+
+static bool is_zero_block(const uint8_t* block) {
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; i++) {
+        if (block[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Bounded copy of a header string field
+static size_t field_length(const uint8_t* field, size_t length) {
+    size_t i = 0;
+    while (i < length && field[i] != '\0') {
+        i++;
+    }
+    return i;
+}
+
+// Destination path of a header: root + prefix/name (or long_name when an
+// extended header gave one), without "./", leading or trailing slashes
+// ("./" itself is root); false if it is too long or escapes root
+static bool entry_path(const uint8_t* header, const char* long_name, const char* root,
+                       char* path, size_t path_size) {
+    char name[TAR_PREFIX_LENGTH + 1 + TAR_NAME_LENGTH + 1];
+    size_t length;
+    if (long_name) {
+        length = strlen(long_name);
+        memcpy(name, long_name, length);
+    } else {
+        length = field_length(header + TAR_PREFIX, TAR_PREFIX_LENGTH);
+        memcpy(name, header + TAR_PREFIX, length);
+        if (length) {
+            name[length++] = '/';
+        }
+        size_t name_length = field_length(header + TAR_NAME, TAR_NAME_LENGTH);
+        memcpy(name + length, header + TAR_NAME, name_length);
+        length += name_length;
+    }
+    name[length] = '\0';
+    
+    const char* relative = name;
+    while (relative[0] == '/' || (relative[0] == '.' && relative[1] == '/')) {
+        relative += relative[0] == '/' ? 1 : 2;
+    }
+    while (length > 0 && name[length - 1] == '/') {
+        name[--length] = '\0';
+    }
+    if (relative[0] == '.' && relative[1] == '\0') {
+        relative = "";
+    }
+    
+    for (const char* p = relative; *p; ) {
+        const char* slash = strchr(p, '/');
+        size_t component = slash ? static_cast<size_t>(slash - p) : strlen(p);
+        if (component == 2 && p[0] == '.' && p[1] == '.') {
+            return false;
+        }
+        p += component + (slash ? 1 : 0);
+    }
+    if (relative[0] == '\0') {
+        return FileSys::join_path(path, path_size, "", root);
+    }
+    return FileSys::join_path(path, path_size, root, relative);
+}
+
+// Name and size an extended header sets for the entry after it
+struct TarOverride {
+    char name[MAX_PATH_LENGTH];
+    bool has_name;
+    bool name_too_long;
+    uint64_t size;
+    bool has_size;
+    
+    TarOverride() { clear(); }
+    
+    void clear() {
+        name[0] = '\0';
+        has_name = false;
+        name_too_long = false;
+        size = 0;
+        has_size = false;
+    }
+    
+    void set_name(const char* value, size_t length) {
+        // GNU names end in NUL padding
+        length = field_length(reinterpret_cast<const uint8_t*>(value), length);
+        has_name = true;
+        name_too_long = length >= sizeof(name);
+        if (!name_too_long) {
+            memcpy(name, value, length);
+            name[length] = '\0';
+        }
+    }
+};
+
+// Parse pax records ("<length> <key>=<value>\n"); path and size are
+// honoured, other keys (times, owners, attributes) are ignored
+static bool parse_pax(const char* data, size_t size, TarOverride& next) {
+    size_t pos = 0;
+    while (pos < size) {
+        size_t length = 0;
+        size_t i = pos;
+        while (i < size && data[i] >= '0' && data[i] <= '9') {
+            length = length * 10 + static_cast<size_t>(data[i++] - '0');
+        }
+        if (i == pos || i >= size || data[i] != ' ' || length < i - pos + 2 || length > size - pos ||
+            data[pos + length - 1] != '\n') {
+            return false;
+        }
+        
+        const char* key = data + i + 1;
+        const char* end = data + pos + length - 1;
+        const char* equals = static_cast<const char*>(memchr(key, '=', static_cast<size_t>(end - key)));
+        if (!equals) {
+            return false;
+        }
+        size_t key_length = static_cast<size_t>(equals - key);
+        const char* value = equals + 1;
+        size_t value_length = static_cast<size_t>(end - value);
+        if (key_length == 4 && memcmp(key, "path", 4) == 0) {
+            next.set_name(value, value_length);
+        } else if (key_length == 4 && memcmp(key, "size", 4) == 0) {
+            next.size = 0;
+            for (size_t j = 0; j < value_length; j++) {
+                if (value[j] < '0' || value[j] > '9') {
+                    return false;
+                }
+                next.size = next.size * 10 + static_cast<uint64_t>(value[j] - '0');
+            }
+            next.has_size = true;
+        }
+        pos += length;
+    }
+    return true;
+}
+
+FSResult tar_import(FileSys& fs, const char* root, uint8_t* buffer, size_t buffer_size,
+                    TarReadFn read, void* context, TarStats& stats) {
+    if (!buffer || !read || buffer_size < TAR_BLOCK_SIZE) {
+        return FSResult::ERROR_INVALID;
+    }
+    stats = TarStats();
+    
+    FSResult result = fs.mkdir_p(root);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    TarReader reader = { buffer, buffer_size, 0, 0, read, context };
+    char path[MAX_PATH_LENGTH];
+    TarOverride next;
+    for (;;) {
+        bool eof;
+        result = reader.fill(TAR_BLOCK_SIZE, eof);
+        if (result != FSResult::OK) {
+            return result;
+        }
+        if (eof) {
+            // A stream cut short of the end blocks still ends cleanly at a header boundary
+            return reader.end == reader.start ? FSResult::OK : FSResult::ERROR_CORRUPT;
+        }
+        
+        const uint8_t* header = reader.buffer + reader.start;
+        if (is_zero_block(header)) {
+            return FSResult::OK;
+        }
+        if (get_octal(header + TAR_CHECKSUM, 8) != header_checksum(header)) {
+            return FSResult::ERROR_CORRUPT;
+        }
+        
+        char type = static_cast<char>(header[TAR_TYPE]);
+        uint64_t size = get_octal(header + TAR_SIZE, 12);
+        uint32_t modified_time = static_cast<uint32_t>(get_octal(header + TAR_MTIME, 12));
+        reader.start += TAR_BLOCK_SIZE;
+        
+        // Data of every entry is padded to whole blocks
+        uint64_t padded = (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+        
+        if (type == TAR_TYPE_LONG_NAME || type == TAR_TYPE_PAX) {
+            // Parsed in place, so the records must fit the buffer
+            if (padded > reader.size) {
+                return FSResult::ERROR_NOT_SUPPORTED;
+            }
+            bool eof;
+            result = reader.fill(static_cast<size_t>(padded), eof);
+            if (result != FSResult::OK) {
+                return result;
+            }
+            if (eof) {
+                return FSResult::ERROR_CORRUPT;
+            }
+            const char* data = reinterpret_cast<const char*>(reader.buffer + reader.start);
+            if (type == TAR_TYPE_LONG_NAME) {
+                next.set_name(data, static_cast<size_t>(size));
+            } else if (!parse_pax(data, static_cast<size_t>(size), next)) {
+                return FSResult::ERROR_CORRUPT;
+            }
+            reader.start += static_cast<size_t>(padded);
+            continue;
+        }
+        
+        if (next.has_size) {
+            size = next.size;
+            padded = (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+        }
+        bool valid_path = !next.name_too_long &&
+                          entry_path(header, next.has_name ? next.name : nullptr, root, path, sizeof(path));
+        next.clear();
+        
+        if (type == TAR_TYPE_DIRECTORY) {
+            if (!valid_path) {
+                return FSResult::ERROR_INVALID;
+            }
+            result = fs.mkdir_p(path);
+            if (result == FSResult::OK) {
+                result = reader.take(padded, nullptr, nullptr);
+            }
+            stats.directories++;
+        } else if (type == TAR_TYPE_FILE || type == TAR_TYPE_FILE_OLD) {
+            if (!valid_path) {
+                return FSResult::ERROR_INVALID;
+            }
+            FileHandle file;
+            result = fs.open(file, path, OpenMode::WRITE | OpenMode::CREATE | OpenMode::TRUNC);
+            if (result == FSResult::OK) {
+                result = reader.take(size, &fs, &file);
+                FSResult close_result = fs.close(file);
+                if (result == FSResult::OK) {
+                    result = close_result;
+                }
+            }
+            if (result == FSResult::OK) {
+                result = reader.take(padded - size, nullptr, nullptr);
+            }
+            stats.files++;
+            stats.bytes += size;
+        } else {
+            result = reader.take(padded, nullptr, nullptr);
+            if (result != FSResult::OK) {
+                return result;
+            }
+            stats.skipped++;
+            continue;
+        }
+        if (result != FSResult::OK) {
+            return result;
+        }
+        
+        // Not every backend keeps times; that is not an error
+        if (modified_time != 0) {
+            fs.set_modified_time(path, modified_time);
+        }
+    }
+}
+
+} // namespace EmbeddedFS
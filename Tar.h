@@ -0,0 +1,48 @@
+#ifndef TAR_H
+#define TAR_H
+
+#include "FileSys.h"
+
+namespace EmbeddedFS {
+
+static constexpr size_t TAR_BLOCK_SIZE = 512;
+
+// Byte sink for tar_export (UART, USB, a FileSys file, ...); anything but
+// OK aborts the export with that result
+typedef FSResult (*TarWriteFn)(void* context, const uint8_t* data, size_t size);
+
+// Byte source for tar_import; bytes_read == 0 means end of stream
+typedef FSResult (*TarReadFn)(void* context, uint8_t* data, size_t size, size_t& bytes_read);
+
+// Counters of a tar_export/tar_import run
+struct TarStats {
+    uint32_t files;
+    uint32_t directories;
+    uint32_t skipped;               // Import: links, devices and other entries not restored
+    uint64_t bytes;                 // File contents, without headers or padding
+    
+    TarStats() : files(0), directories(0), skipped(0), bytes(0) {}
+};
+
+// Stream the tree under root as a ustar archive. Entry names are relative
+// to root; FileInfo::modified_time is carried as the tar mtime where the
+// backend keeps one. buffer (a multiple of TAR_BLOCK_SIZE) collects headers
+// and file data, and the sink is called once per full buffer, so a larger
+// buffer means fewer, longer transfers.
+FSResult tar_export(FileSys& fs, const char* root, uint8_t* buffer, size_t buffer_size,
+                    TarWriteFn write, void* context, TarStats& stats);
+
+// Unpack a ustar archive below root, creating directories as needed and
+// overwriting existing files. Regular files and directories are restored;
+// other entry types are skipped. Long names from GNU 'L' and pax 'x'
+// headers (path and size records) are honoured; such a header must fit in
+// buffer, else ERROR_NOT_SUPPORTED. Names containing ".." or too long for
+// MAX_PATH_LENGTH are rejected with ERROR_INVALID; a bad header checksum
+// or a truncated archive gives ERROR_CORRUPT. buffer must hold at least
+// TAR_BLOCK_SIZE bytes.
+FSResult tar_import(FileSys& fs, const char* root, uint8_t* buffer, size_t buffer_size,
+                    TarReadFn read, void* context, TarStats& stats);
+
+} // namespace EmbeddedFS
+
+#endif // TAR_H
@@ -0,0 +1,365 @@
+#include "Transaction.h"
+#include <cstring>
+#include <cstdio>
+
+namespace EmbeddedFS {
+
+// Journal record: magic, entry count, then per entry a 16-bit length and
+// the target path, closed by a CRC-32 over everything before it. All
+// integers are little-endian.
+static constexpr uint32_t JOURNAL_MAGIC = 0x314A5854; // "TXJ1"
+
+static void put_u16(uint8_t* out, uint16_t value) {
+    out[0] = static_cast<uint8_t>(value);
+    out[1] = static_cast<uint8_t>(value >> 8);
+}
+
+static void put_u32(uint8_t* out, uint32_t value) {
+    out[0] = static_cast<uint8_t>(value);
+    out[1] = static_cast<uint8_t>(value >> 8);
+    out[2] = static_cast<uint8_t>(value >> 16);
+    out[3] = static_cast<uint8_t>(value >> 24);
+}
+
+static uint32_t get_u32(const uint8_t* in) {
+    return static_cast<uint32_t>(in[0]) | static_cast<uint32_t>(in[1]) << 8 |
+           static_cast<uint32_t>(in[2]) << 16 | static_cast<uint32_t>(in[3]) << 24;
+}
+
+// Write all bytes and fold them into the running CRC
+static FSResult write_all(FileSys& fs, FileHandle& handle, const void* data, size_t size, uint32_t& crc) {
+    size_t written;
+    FSResult result = fs.write(handle, data, size, written);
+    if (result == FSResult::OK && written != size) {
+        result = FSResult::ERROR_NO_SPC;
+    }
+    crc = FileSys::crc32(crc, data, size);
+    return result;
+}
+
+// Read exactly size bytes and fold them into the running CRC
+static FSResult read_all(FileSys& fs, FileHandle& handle, void* data, size_t size, uint32_t& crc) {
+    size_t read;
+    FSResult result = fs.read(handle, data, size, read);
+    if (result == FSResult::OK && read != size) {
+        result = FSResult::ERROR_CORRUPT;
+    }
+    crc = FileSys::crc32(crc, data, size);
+    return result;
+}
+
+// Constructor
+Transaction::Transaction(FileSys& fs, const char* journal_path)
+    : fs_(fs), journal_path_(journal_path), count_(0), active_(false) {
+    memset(handles_, 0, sizeof(handles_));
+}
+
+// Destructor - an unfinished transaction is rolled back
+Transaction::~Transaction() {
+    if (active_) {
+        abort();
+    }
+}
+
+// Start collecting files
+FSResult Transaction::begin() {
+    if (active_) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    count_ = 0;
+    active_ = true;
+    return FSResult::OK;
+}
+
+// Open the shadow that will replace path on commit
+FSResult Transaction::stage(FileHandle& handle, const char* path) {
+    if (!active_) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    if (count_ >= MAX_TRANSACTION_FILES) {
+        return FSResult::ERROR_NO_MEM;
+    }
+    
+    if (!path || strlen(path) >= MAX_PATH_LENGTH) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    char shadow[MAX_PATH_LENGTH];
+    if (!shadow_path(shadow, journal_path_, count_)) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    FSResult result = fs_.open(handle, shadow, OpenMode::WRITE | OpenMode::CREATE | OpenMode::TRUNC);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    strcpy(targets_[count_], path);
+    handles_[count_] = &handle;
+    count_++;
+    
+    return FSResult::OK;
+}
+
+// Publish all staged files
+FSResult Transaction::commit() {
+    if (!active_) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    // Shadow content must be durable before it is published
+    FSResult result = close_staged();
+    if (result != FSResult::OK) {
+        abort();
+        return result;
+    }
+    
+    result = swap_staged();
+    if (result == FSResult::OK) {
+        // Published: the shadows now hold the old content
+        active_ = false;
+        return remove_shadows();
+    }
+    if (result != FSResult::ERROR_NOT_SUPPORTED && result != FSResult::ERROR_NO_ENT) {
+        abort();
+        return result;
+    }
+    
+    result = write_journal();
+    if (result != FSResult::OK) {
+        abort();
+        return result;
+    }
+    
+    // Committed: from here on a reset is completed by recover()
+    active_ = false;
+    
+    for (size_t i = 0; i < count_; i++) {
+        char shadow[MAX_PATH_LENGTH];
+        shadow_path(shadow, journal_path_, i);
+        
+        result = move_shadow(fs_, shadow, targets_[i]);
+        if (result != FSResult::OK) {
+            return result; // Journal stays; recover() retries the moves
+        }
+    }
+    
+    count_ = 0;
+    return fs_.remove(journal_path_);
+}
+
+// Drop all staged files
+FSResult Transaction::abort() {
+    if (!active_) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    close_staged();
+    remove_shadows();
+    active_ = false;
+    return FSResult::OK;
+}
+
+// Finish or roll back a transaction interrupted by a reset
+FSResult Transaction::recover(FileSys& fs, const char* journal_path) {
+    FSResult result = replay_journal(fs, journal_path, false);
+    
+    if (result == FSResult::OK) {
+        // Complete record: redo the moves (already moved shadows are skipped)
+        result = replay_journal(fs, journal_path, true);
+        if (result != FSResult::OK) {
+            return result;
+        }
+        return fs.remove(journal_path);
+    }
+    
+    if (result != FSResult::ERROR_NO_ENT && result != FSResult::ERROR_CORRUPT) {
+        return result;
+    }
+    
+    // No commit happened: discard any shadows and a torn journal
+    for (size_t i = 0; i < MAX_TRANSACTION_FILES; i++) {
+        char shadow[MAX_PATH_LENGTH];
+        if (shadow_path(shadow, journal_path, i)) {
+            fs.remove(shadow);
+        }
+    }
+    if (result == FSResult::ERROR_CORRUPT) {
+        fs.remove(journal_path);
+    }
+    
+    return FSResult::OK;
+}
+
+// Close every staged handle, keeping the first error
+FSResult Transaction::close_staged() {
+    FSResult first_error = FSResult::OK;
+    
+    for (size_t i = 0; i < count_; i++) {
+        if (handles_[i] && handles_[i]->is_open) {
+            FSResult result = fs_.close(*handles_[i]);
+            if (result != FSResult::OK && first_error == FSResult::OK) {
+                first_error = result;
+            }
+        }
+        handles_[i] = nullptr;
+    }
+    
+    return first_error;
+}
+
+// Swap every target with its shadow in one metadata write where the
+// backend can. That write is then the commit point and no journal is
+// needed: after a reset the shadows hold either the unpublished new
+// content or the old one, and recover() discards them either way.
+FSResult Transaction::swap_staged() {
+    const char* targets[MAX_TRANSACTION_FILES];
+    const char* shadows[MAX_TRANSACTION_FILES];
+    char shadow_paths[MAX_TRANSACTION_FILES][MAX_PATH_LENGTH];
+    
+    for (size_t i = 0; i < count_; i++) {
+        shadow_path(shadow_paths[i], journal_path_, i);
+        targets[i] = targets_[i];
+        shadows[i] = shadow_paths[i];
+    }
+    
+    return fs_.swap_contents(targets, shadows, count_);
+}
+
+// Delete every shadow, keeping the first error
+FSResult Transaction::remove_shadows() {
+    FSResult first_error = FSResult::OK;
+    
+    for (size_t i = 0; i < count_; i++) {
+        char shadow[MAX_PATH_LENGTH];
+        shadow_path(shadow, journal_path_, i);
+        FSResult result = fs_.remove(shadow);
+        if (result != FSResult::OK && result != FSResult::ERROR_NO_ENT && first_error == FSResult::OK) {
+            first_error = result;
+        }
+    }
+    
+    count_ = 0;
+    return first_error;
+}
+
+// Write the commit record; closing the journal is the commit point
+FSResult Transaction::write_journal() {
+    FileHandle journal;
+    FSResult result = fs_.open(journal, journal_path_, OpenMode::WRITE | OpenMode::CREATE | OpenMode::TRUNC);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    uint32_t crc = 0;
+    uint8_t header[8];
+    put_u32(header, JOURNAL_MAGIC);
+    put_u16(header + 4, static_cast<uint16_t>(count_));
+    put_u16(header + 6, 0);
+    result = write_all(fs_, journal, header, sizeof(header), crc);
+    
+    for (size_t i = 0; i < count_ && result == FSResult::OK; i++) {
+        uint16_t length = static_cast<uint16_t>(strlen(targets_[i]));
+        uint8_t length_bytes[2];
+        put_u16(length_bytes, length);
+        result = write_all(fs_, journal, length_bytes, sizeof(length_bytes), crc);
+        if (result == FSResult::OK) {
+            result = write_all(fs_, journal, targets_[i], length, crc);
+        }
+    }
+    
+    if (result == FSResult::OK) {
+        uint8_t crc_bytes[4];
+        uint32_t unused = 0;
+        put_u32(crc_bytes, crc);
+        result = write_all(fs_, journal, crc_bytes, sizeof(crc_bytes), unused);
+    }
+    
+    FSResult close_result = fs_.close(journal);
+    if (result == FSResult::OK) {
+        result = close_result;
+    }
+    if (result != FSResult::OK) {
+        fs_.remove(journal_path_);
+    }
+    
+    return result;
+}
+
+// Shadow N is the journal path with ".N" appended, so transactions with
+// different journals never share shadows, even in one directory
+bool Transaction::shadow_path(char* out, const char* journal_path, size_t index) {
+    int length = snprintf(out, MAX_PATH_LENGTH, "%s.%u", journal_path, static_cast<unsigned>(index));
+    return length > 0 && static_cast<size_t>(length) < MAX_PATH_LENGTH;
+}
+
+// Move a shadow over its target; FatFS will not rename onto an existing file
+FSResult Transaction::move_shadow(FileSys& fs, const char* shadow, const char* target) {
+    FSResult result = fs.rename(shadow, target);
+    if (result == FSResult::ERROR_EXIST) {
+        result = fs.remove(target);
+        if (result == FSResult::OK) {
+            result = fs.rename(shadow, target);
+        }
+    }
+    return result;
+}
+
+// Validate the journal (apply = false) or redo its moves (apply = true).
+// Returns ERROR_CORRUPT for a torn or foreign record.
+FSResult Transaction::replay_journal(FileSys& fs, const char* journal_path, bool apply) {
+    FileHandle journal;
+    FSResult result = fs.open(journal, journal_path, OpenMode::READ);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    uint32_t crc = 0;
+    uint8_t header[8];
+    result = read_all(fs, journal, header, sizeof(header), crc);
+    
+    uint16_t count = static_cast<uint16_t>(header[4] | header[5] << 8);
+    if (result != FSResult::OK || get_u32(header) != JOURNAL_MAGIC || count > MAX_TRANSACTION_FILES) {
+        fs.close(journal);
+        return FSResult::ERROR_CORRUPT;
+    }
+    
+    for (uint16_t i = 0; i < count && result == FSResult::OK; i++) {
+        uint8_t length_bytes[2];
+        char target[MAX_PATH_LENGTH];
+        
+        result = read_all(fs, journal, length_bytes, sizeof(length_bytes), crc);
+        uint16_t length = static_cast<uint16_t>(length_bytes[0] | length_bytes[1] << 8);
+        if (result != FSResult::OK || length >= MAX_PATH_LENGTH) {
+            result = FSResult::ERROR_CORRUPT;
+            break;
+        }
+        result = read_all(fs, journal, target, length, crc);
+        target[length] = '\0';
+        
+        if (result == FSResult::OK && apply) {
+            char shadow[MAX_PATH_LENGTH];
+            FileInfo info;
+            shadow_path(shadow, journal_path, i);
+            if (fs.stat(shadow, info) == FSResult::OK) {
+                result = move_shadow(fs, shadow, target);
+            }
+        }
+    }
+    
+    if (result == FSResult::OK && !apply) {
+        uint8_t crc_bytes[4];
+        uint32_t unused = 0;
+        result = read_all(fs, journal, crc_bytes, sizeof(crc_bytes), unused);
+        if (result != FSResult::OK || get_u32(crc_bytes) != crc) {
+            result = FSResult::ERROR_CORRUPT;
+        }
+    }
+    
+    fs.close(journal);
+    return result;
+}
+
+} // namespace EmbeddedFS
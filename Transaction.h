@@ -0,0 +1,80 @@
+#ifndef TRANSACTION_H
+#define TRANSACTION_H
+
+#include "FileSys.h"
+
+namespace EmbeddedFS {
+
+static constexpr size_t MAX_TRANSACTION_FILES = 8;
+
+// Publishes updates to several files as one unit.
+//
+// Each staged file is written to a shadow named after the journal
+// ("journal.txj.N"). commit() closes the shadows, writes one journal
+// record naming every target (the commit point), moves the shadows over
+// their targets and deletes the journal. After a reset, recover() finishes
+// the moves if a complete journal record exists and otherwise throws the
+// shadows away, so the set is always seen either entirely old or entirely
+// new. Every concurrent transaction needs its own journal path.
+//
+// Where FileSys::swap_contents can exchange every existing target with its
+// shadow in one metadata write (FatFS, all entries in one directory
+// sector), that write is the commit point instead and the journal and the
+// moves are skipped. Keep the journal in the targets' directory for this.
+//
+// Atomicity costs writes on LittleFS: each shadow is created and closed,
+// the journal is created and closed, each move is a rename and the journal
+// is removed, about 3N+3 metadata commits for N files against N for
+// rewriting each file in place. Use a transaction where the files must
+// change together, not to save commits.
+//
+// Usage:
+//   Transaction tx(fs, "/cal/journal.txj");
+//   tx.begin();
+//   tx.stage(h1, "/cal/gain.bin");   fs.write(h1, ...);
+//   tx.stage(h2, "/cal/offset.bin"); fs.write(h2, ...);
+//   tx.commit();
+class Transaction {
+public:
+    Transaction(FileSys& fs, const char* journal_path);
+    ~Transaction();
+    
+    FSResult begin();
+    
+    // Open handle on the shadow of path; write through FileSys as usual but
+    // leave closing to commit/abort
+    FSResult stage(FileHandle& handle, const char* path);
+    
+    FSResult commit();
+    FSResult abort();
+    
+    size_t staged_count() const { return count_; }
+    
+    // Call once after mount, before touching the files of a transaction
+    static FSResult recover(FileSys& fs, const char* journal_path);
+
+private:
+    FileSys& fs_;
+    const char* journal_path_;
+    FileHandle* handles_[MAX_TRANSACTION_FILES];
+    char targets_[MAX_TRANSACTION_FILES][MAX_PATH_LENGTH];
+    size_t count_;
+    bool active_;
+    
+    FSResult close_staged();
+    FSResult swap_staged();
+    FSResult remove_shadows();
+    FSResult write_journal();
+    
+    static bool shadow_path(char* out, const char* journal_path, size_t index);
+    static FSResult move_shadow(FileSys& fs, const char* shadow, const char* target);
+    static FSResult replay_journal(FileSys& fs, const char* journal_path, bool apply);
+    
+    // Disable copy construction and assignment
+    Transaction(const Transaction&) = delete;
+    Transaction& operator=(const Transaction&) = delete;
+};
+
+} // namespace EmbeddedFS
+
+#endif // TRANSACTION_H
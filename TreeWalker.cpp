@@ -0,0 +1,154 @@
+#include "TreeWalker.h"
+#include <cstring>
+
+namespace EmbeddedFS {
+
+TreeWalker::TreeWalker(FileSys& fs)
+    : fs_(fs), root_length_(0), depth_(0), descend_(false), active_(false) {
+    path_[0] = '\0';
+}
+
+TreeWalker::~TreeWalker() {
+    stop();
+}
+
+FSResult TreeWalker::start(const char* root) {
+    stop();
+    
+    size_t length = strlen(root);
+    if (length >= sizeof(path_)) {
+        return FSResult::ERROR_INVALID;
+    }
+    memcpy(path_, root, length + 1);
+    while (length > 1 && path_[length - 1] == '/') {
+        path_[--length] = '\0';
+    }
+    
+    FSResult result = fs_.opendir(dir_, path_);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    root_length_ = length;
+    dir_length_[0] = length;
+    visited_[0] = 0;
+    depth_ = 0;
+    descend_ = false;
+    active_ = true;
+    return FSResult::OK;
+}
+
+FSResult TreeWalker::next(FileInfo& info) {
+    info.name[0] = '\0';
+    if (!active_) {
+        return FSResult::OK;
+    }
+    
+    if (descend_) {
+        descend_ = false;
+        if (depth_ == MAX_TREE_DEPTH) {
+            stop();
+            return FSResult::ERROR_NO_MEM;
+        }
+        
+        fs_.closedir(dir_);
+        depth_++;
+        dir_length_[depth_] = strlen(path_);
+        visited_[depth_] = 0;
+        
+        FSResult result = fs_.opendir(dir_, path_);
+        if (result != FSResult::OK) {
+            active_ = false;
+            return result;
+        }
+    }
+    
+    for (;;) {
+        path_[dir_length_[depth_]] = '\0';
+        
+        FSResult result = fs_.readdir(dir_, info);
+        if (result != FSResult::OK) {
+            stop();
+            return result;
+        }
+        
+        if (info.name[0] == '\0') {
+            // End of this directory
+            if (depth_ == 0) {
+                stop();
+                return FSResult::OK;
+            }
+            result = reopen_parent();
+            if (result != FSResult::OK) {
+                return result;
+            }
+            continue;
+        }
+        if (is_dot_entry(info)) {
+            continue;
+        }
+        
+        visited_[depth_]++;
+        if (!FileSys::join_path(path_, sizeof(path_), path_, info.name)) {
+            stop();
+            return FSResult::ERROR_INVALID;
+        }
+        descend_ = info.is_directory;
+        return FSResult::OK;
+    }
+}
+
+// Go up one level and resume after the entries returned there before
+FSResult TreeWalker::reopen_parent() {
+    fs_.closedir(dir_);
+    depth_--;
+    path_[dir_length_[depth_]] = '\0';
+    
+    FSResult result = fs_.opendir(dir_, path_);
+    if (result != FSResult::OK) {
+        active_ = false;
+        return result;
+    }
+    
+    FileInfo skipped;
+    for (uint32_t i = 0; i < visited_[depth_];) {
+        result = fs_.readdir(dir_, skipped);
+        if (result != FSResult::OK) {
+            stop();
+            return result;
+        }
+        if (skipped.name[0] == '\0') {
+            break;
+        }
+        if (!is_dot_entry(skipped)) {
+            i++;
+        }
+    }
+    return FSResult::OK;
+}
+
+void TreeWalker::skip_children() {
+    descend_ = false;
+}
+
+void TreeWalker::stop() {
+    if (active_) {
+        fs_.closedir(dir_);
+        active_ = false;
+    }
+    descend_ = false;
+}
+
+const char* TreeWalker::relative_path() const {
+    const char* relative = path_ + root_length_;
+    if (*relative == '/') {
+        relative++;
+    }
+    return relative;
+}
+
+bool TreeWalker::is_dot_entry(const FileInfo& info) {
+    return strcmp(info.name, ".") == 0 || strcmp(info.name, "..") == 0;
+}
+
+} // namespace EmbeddedFS
@@ -0,0 +1,67 @@
+#ifndef TREE_WALKER_H
+#define TREE_WALKER_H
+
+#include "FileSys.h"
+
+namespace EmbeddedFS {
+
+static constexpr size_t MAX_TREE_DEPTH = 16;
+
+// Depth-first walk over a directory tree holding one open directory.
+//
+// Entries come in pre-order: a directory is returned before its contents,
+// and the walk enters it on the following next() unless skip_children()
+// is called first. Coming back up reopens the parent and skips the
+// entries already returned, so the tree must not change during the walk.
+// The skip rereads the parent from its start after each subdirectory, so a
+// directory of n entries with d subdirectories costs about d * n / 2 extra
+// readdir calls: quadratic when most entries are directories.
+//
+// Usage:
+//   TreeWalker walker(fs);
+//   walker.start("/logs");
+//   FileInfo info;
+//   while (walker.next(info) == FSResult::OK && info.name[0] != '\0') {
+//       use(walker.path(), info);
+//   }
+class TreeWalker {
+public:
+    explicit TreeWalker(FileSys& fs);
+    ~TreeWalker();
+    
+    FSResult start(const char* root);
+    
+    // Next entry; the end of the tree is signalled like readdir (OK with
+    // an empty name)
+    FSResult next(FileInfo& info);
+    
+    void skip_children();           // Do not enter the directory just returned
+    void stop();
+    
+    const char* path() const { return path_; }             // Full path of the entry just returned
+    const char* relative_path() const;                     // The same, relative to the root
+    size_t depth() const { return depth_; }                 // 0 for entries directly in the root
+
+private:
+    FileSys& fs_;
+    DirHandle dir_;
+    char path_[MAX_PATH_LENGTH];
+    size_t root_length_;
+    size_t dir_length_[MAX_TREE_DEPTH + 1];     // Length of the directory's path at each level
+    uint32_t visited_[MAX_TREE_DEPTH + 1];      // Entries already returned at each level
+    size_t depth_;
+    bool descend_;
+    bool active_;
+    
+    FSResult reopen_parent();
+    
+    static bool is_dot_entry(const FileInfo& info);
+    
+    // Disable copy construction and assignment
+    TreeWalker(const TreeWalker&) = delete;
+    TreeWalker& operator=(const TreeWalker&) = delete;
+};
+
+} // namespace EmbeddedFS
+
+#endif // TREE_WALKER_H
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <atomic>
 #include <cstring>
 
 // Include underlying file system headers
@@ -17,6 +18,19 @@ static constexpr size_t MAX_FILENAME_LENGTH = 64;
 static constexpr size_t MAX_OPEN_FILES = 8;
 static constexpr size_t MAX_OPEN_DIRS = 4;
 static constexpr size_t BUFFER_SIZE = 512;
+static constexpr size_t MAX_DIR_INDEXES = 2;
+static constexpr uint8_t NO_DIR_INDEX = 0xFF;
+static constexpr uint8_t ALL_DIR_INDEXES = 0xFE;
+static constexpr size_t MAX_IO_WAITERS = 8;
+
+// LittleFS modification times (enable_modified_times). Define as 0 to drop
+// the per-handle attribute state and directory path they need.
+#ifndef FILESYS_LFS_TIMES
+#define FILESYS_LFS_TIMES 1
+#endif
+
+// Sibling used to stage atomic replacements (valid as a FAT short name)
+static constexpr const char* REPLACE_TEMP_NAME = "~replace.tmp";
 
 // Error codes
 enum class FSResult : int8_t {
@@ -34,7 +48,8 @@ enum class FSResult : int8_t {
     ERROR_NO_MEM = -11,
     ERROR_INVALID = -12,
     ERROR_NOT_MOUNTED = -13,
-    ERROR_NOT_SUPPORTED = -14
+    ERROR_NOT_SUPPORTED = -14,
+    IN_PROGRESS = 1             // Not an error: poll-driven operation still running (see PollOp)
 };
 
 // File open modes
@@ -59,15 +74,168 @@ struct FileInfo {
     char name[MAX_FILENAME_LENGTH];
     uint32_t size;
     bool is_directory;
-    uint32_t modified_time;
+    uint32_t modified_time;     // Unix seconds, 0 when unknown (FatFS: 2 s resolution)
     
     FileInfo() : size(0), is_directory(false), modified_time(0) {
         name[0] = '\0';
     }
 };
 
+// Stable identifier of a file's directory entry (see FileSys::open_by_id)
+struct FileId {
+    uint32_t sector;            // Directory sector holding the entry
+    uint16_t offset;            // Byte offset of the entry within that sector
+    uint16_t reserved;
+    uint32_t tag;               // Hash of the entry's short name and creation time, detects reuse
+    
+    FileId() : sector(0), offset(0), reserved(0), tag(0) {}
+};
+
+// Directory search filter (see FileSys::findfirst). The pattern ignores
+// ASCII case on both backends, as FAT lookups do; other bytes must match
+// exactly.
+struct FindFilter {
+    const char* pattern;        // '*'/'?' glob, nullptr matches everything; must outlive the search
+    uint32_t min_size;
+    uint32_t max_size;
+    uint32_t modified_after;    // Inclusive lower bound on modified_time, 0 disables
+    uint32_t modified_before;   // Exclusive upper bound on modified_time, 0 disables
+    bool include_directories;
+    
+    FindFilter() : pattern(nullptr), min_size(0), max_size(UINT32_MAX),
+                   modified_after(0), modified_before(0), include_directories(true) {}
+    
+    // Size/time predicates, checked before any FileInfo is filled in
+    bool accepts(uint32_t size, bool is_directory, uint32_t modified_time) const {
+        if (is_directory) {
+            return include_directories;
+        }
+        if (size < min_size || size > max_size) {
+            return false;
+        }
+        if (modified_after != 0 && modified_time < modified_after) {
+            return false;
+        }
+        if (modified_before != 0 && modified_time >= modified_before) {
+            return false;
+        }
+        return true;
+    }
+};
+
+// Slot of an in-RAM directory index (storage supplied by the caller,
+// see FileSys::enable_dir_index)
+struct DirIndexEntry {
+    uint32_t name_hash;
+    uint16_t name_check;
+    uint16_t fdate;
+    uint32_t size;
+    uint16_t ftime;
+    uint8_t attr;
+    uint8_t state;
+};
+
+// Operating system services for sharing one FileSys between tasks (see
+// FileSys::set_os_hooks). lock/unlock implement a recursive mutex. wait
+// behaves like a condition variable: it releases the lock at every
+// recursion level, blocks until notify_all or timeout_ms (0 = no timeout)
+// and re-acquires it to the same depth. FileSys only waits from the
+// outermost level, but other tasks must be able to take the lock meanwhile.
+struct OsHooks {
+    void* context;
+    void (*lock)(void* context);
+    void (*unlock)(void* context);
+    void (*wait)(void* context, uint32_t timeout_ms);
+    void (*notify_all)(void* context);
+    uint32_t (*tick_ms)(void* context);     // Free-running millisecond counter
+};
+
+// I/O scheduler priority classes, most urgent first (see FileSys::enable_io_scheduler)
+enum class IoPriority : uint8_t {
+    FOREGROUND = 0,
+    NORMAL = 1,
+    BACKGROUND = 2
+};
+static constexpr size_t IO_PRIORITY_COUNT = 3;
+
+// I/O scheduler counters; waits are measured from arrival to admission
+struct IoSchedulerStats {
+    uint32_t requests[IO_PRIORITY_COUNT];
+    uint32_t total_wait_ms[IO_PRIORITY_COUNT];
+    uint32_t max_wait_ms[IO_PRIORITY_COUNT];
+    uint32_t deadline_misses;   // Requests admitted after their deadline
+    uint32_t slices;            // Background write slices that yielded the device
+    
+    IoSchedulerStats() : deadline_misses(0), slices(0) {
+        memset(requests, 0, sizeof(requests));
+        memset(total_wait_ms, 0, sizeof(total_wait_ms));
+        memset(max_wait_ms, 0, sizeof(max_wait_ms));
+    }
+};
+
+// Token bucket limiting the bandwidth of one client; every handle the
+// client attaches with FileSys::set_budget draws from it. Storage is owned
+// by the caller and must outlive the handles.
+struct IoBudget {
+    uint32_t bytes_per_s;       // 0 = unlimited
+    uint32_t ops_per_s;         // 0 = unlimited
+    uint32_t burst_bytes;       // Bucket depth, also the largest piece charged at once; 0 = 100 ms worth
+    uint32_t burst_ops;         // 0 = 100 ms worth
+    
+    // Runtime state, in thousandths of a byte or operation
+    uint64_t byte_credit;
+    uint64_t op_credit;
+    uint32_t last_refill;
+    uint32_t throttled_ms;      // Total time requests spent waiting for credit
+    
+    IoBudget(uint32_t bytes_rate = 0, uint32_t ops_rate = 0)
+        : bytes_per_s(bytes_rate), ops_per_s(ops_rate), burst_bytes(0), burst_ops(0),
+          byte_credit(0), op_credit(0), last_refill(0), throttled_ms(0) {}
+};
+
+// Group commit counters (see FileSys::enable_group_commit)
+struct GroupCommitStats {
+    uint32_t batches;           // Flush passes run
+    uint32_t requests;          // sync calls served by those passes
+    uint16_t last_batch;        // Handles flushed by the latest pass
+    uint16_t max_batch;
+    uint32_t batch_sizes[4];    // Passes that flushed 1, 2, 3-4 and 5+ handles
+    
+    GroupCommitStats() : batches(0), requests(0), last_batch(0), max_batch(0) {
+        memset(batch_sizes, 0, sizeof(batch_sizes));
+    }
+};
+
+// Automatic sync rules for a handle (see FileSys::set_durability). Each
+// limit is off when 0; with all limits off (the default) the file is only
+// committed by explicit sync or close.
+struct DurabilityPolicy {
+    uint32_t max_unsynced_bytes;    // Sync once this many bytes were written since the last sync
+    uint32_t max_unsynced_ms;       // Sync once the oldest unsynced write is this old
+    bool sync_on_record;            // Sync at every FileSys::end_record
+    
+    DurabilityPolicy() : max_unsynced_bytes(0), max_unsynced_ms(0), sync_on_record(false) {}
+};
+
+// What a LittleFS volume mostly holds (see FileSys::tune_littlefs)
+enum class LfsWorkload : uint8_t {
+    SMALL_FILES,        // Many files of up to a few hundred bytes: settings, calibration, logs
+    STREAMING           // Few large files written and read sequentially: recordings, images
+};
+
 // Forward declarations
 class IFileSystemImpl;
+struct FileHandle;
+class ChangeFeed;
+
+// Produces the new content for FileSys::atomic_replace. It gets an open,
+// empty handle and must not sync, truncate or close it; returning anything
+// but OK abandons the replacement and leaves the old file untouched.
+typedef FSResult (*ReplaceWriter)(FileHandle& handle, void* context);
+
+// Wall clock for file timestamps: seconds since 1970-01-01 UTC, or 0 when
+// the time is not known (see FileSys::set_time_source)
+typedef uint32_t (*TimeSource)(void* context);
 
 // File handle structure
 struct FileHandle {
@@ -77,8 +245,31 @@ struct FileHandle {
         lfs_file_t lfs_file;
         FIL fat_file;
     };
+    uint8_t dir_index;          // Directory index tracking this file, or NO_DIR_INDEX
+    uint16_t name_check;
+    uint32_t name_hash;
+    FSResult sync_result;       // Outcome of the last group commit covering this handle
+    uint32_t sync_batch;        // Group commit batch the handle is queued in, 0 if none
+    DurabilityPolicy durability;
+    uint32_t unsynced_bytes;    // Written since the last successful sync
+    uint32_t dirty_since;       // Tick of the oldest unsynced write, valid while unsynced_bytes > 0
+    IoPriority io_priority;
+    uint32_t io_deadline_ms;    // Admission deadline relative to arrival, 0 for none
+    IoBudget* budget;           // Bandwidth limit shared with other handles, or nullptr
+#if FILESYS_LFS_TIMES
+    struct lfs_attr lfs_time_attr;          // LittleFS time attribute, committed by lfs at sync/close
+    struct lfs_file_config lfs_file_cfg;
+    uint8_t lfs_time[4];                    // Its value, Unix seconds little-endian
+    bool time_pending;                      // Written since the time was last stamped
+#endif
     
-    FileHandle() : is_open(false), fs_impl(nullptr) {}
+    FileHandle() : is_open(false), fs_impl(nullptr), dir_index(NO_DIR_INDEX), name_check(0), name_hash(0),
+                   sync_result(FSResult::OK), sync_batch(0), unsynced_bytes(0), dirty_since(0),
+                   io_priority(IoPriority::NORMAL), io_deadline_ms(0), budget(nullptr) {
+#if FILESYS_LFS_TIMES
+        time_pending = false;
+#endif
+    }
 };
 
 // Directory handle structure
@@ -89,8 +280,16 @@ struct DirHandle {
         lfs_dir_t lfs_dir;
         DIR fat_dir;
     };
+    FindFilter filter;          // Active filter when opened with findfirst
+#if FILESYS_LFS_TIMES
+    char path[MAX_PATH_LENGTH]; // Opened directory, kept by LittleFS for per-entry time lookups
+#endif
     
-    DirHandle() : is_open(false), fs_impl(nullptr) {}
+    DirHandle() : is_open(false), fs_impl(nullptr) {
+#if FILESYS_LFS_TIMES
+        path[0] = '\0';
+#endif
+    }
 };
 
 // Abstract file system interface
@@ -117,8 +316,12 @@ public:
     virtual FSResult remove(const char* path) = 0;
     virtual FSResult rename(const char* old_path, const char* new_path) = 0;
     virtual FSResult stat(const char* path, FileInfo& info) = 0;
+    virtual FSResult exists(const char* path) = 0;                      // OK or ERROR_NO_ENT
+    virtual FSResult file_size(const char* path, uint32_t& size) = 0;
+    virtual FSResult file_size(FileHandle& handle, uint32_t& size) = 0;
     virtual FSResult mkdir(const char* path) = 0;
     virtual FSResult rmdir(const char* path) = 0;
+    virtual FSResult atomic_replace(const char* path, ReplaceWriter writer, void* context) = 0;
     
     // Directory operations
     virtual FSResult opendir(DirHandle& handle, const char* path) = 0;
@@ -126,6 +329,42 @@ public:
     virtual FSResult readdir(DirHandle& handle, FileInfo& info) = 0;
     virtual FSResult rewinddir(DirHandle& handle) = 0;
     
+    // Filtered directory search, closed with closedir
+    virtual FSResult findfirst(DirHandle& handle, const char* path, const FindFilter& filter, FileInfo& info) = 0;
+    virtual FSResult findnext(DirHandle& handle, FileInfo& info) = 0;
+    
+    // Optional in-RAM directory index
+    virtual FSResult enable_dir_index(const char* /*dir_path*/, DirIndexEntry* /*slots*/, size_t /*slot_count*/) {
+        return FSResult::ERROR_NOT_SUPPORTED;
+    }
+    virtual FSResult disable_dir_index(const char* /*dir_path*/) {
+        return FSResult::ERROR_NOT_SUPPORTED;
+    }
+    
+    // Optional path-free access through a directory entry ID
+    virtual FSResult get_file_id(const char* /*path*/, FileId& /*id*/) {
+        return FSResult::ERROR_NOT_SUPPORTED;
+    }
+    virtual FSResult get_handle_id(FileHandle& /*handle*/, FileId& /*id*/) {
+        return FSResult::ERROR_NOT_SUPPORTED;
+    }
+    virtual FSResult open_by_id(FileHandle& /*handle*/, const FileId& /*id*/, OpenMode /*mode*/) {
+        return FSResult::ERROR_NOT_SUPPORTED;
+    }
+    
+    // Optional timestamp update, in Unix seconds like FileInfo::modified_time
+    virtual FSResult set_modified_time(const char* /*path*/, uint32_t /*modified_time*/) {
+        return FSResult::ERROR_NOT_SUPPORTED;
+    }
+    virtual FSResult enable_modified_times(bool /*enable*/) {
+        return FSResult::ERROR_NOT_SUPPORTED;
+    }
+    
+    // Optional exchange of several files' contents in one metadata commit
+    virtual FSResult swap_contents(const char* const* /*paths*/, const char* const* /*others*/, size_t /*count*/) {
+        return FSResult::ERROR_NOT_SUPPORTED;
+    }
+    
     // File system information
     virtual FSResult get_free_space(uint64_t& free_bytes) = 0;
     virtual FSResult get_total_space(uint64_t& total_bytes) = 0;
@@ -154,21 +393,37 @@ public:
     FSResult remove(const char* path) override;
     FSResult rename(const char* old_path, const char* new_path) override;
     FSResult stat(const char* path, FileInfo& info) override;
+    FSResult exists(const char* path) override;
+    FSResult file_size(const char* path, uint32_t& size) override;
+    FSResult file_size(FileHandle& handle, uint32_t& size) override;
     FSResult mkdir(const char* path) override;
     FSResult rmdir(const char* path) override;
+    FSResult atomic_replace(const char* path, ReplaceWriter writer, void* context) override;
     
     FSResult opendir(DirHandle& handle, const char* path) override;
     FSResult closedir(DirHandle& handle) override;
     FSResult readdir(DirHandle& handle, FileInfo& info) override;
     FSResult rewinddir(DirHandle& handle) override;
     
+    FSResult findfirst(DirHandle& handle, const char* path, const FindFilter& filter, FileInfo& info) override;
+    FSResult findnext(DirHandle& handle, FileInfo& info) override;
+    
     FSResult get_free_space(uint64_t& free_bytes) override;
     FSResult get_total_space(uint64_t& total_bytes) override;
+    
+    FSResult set_modified_time(const char* path, uint32_t modified_time) override;
+    FSResult enable_modified_times(bool enable) override;
 
 private:
     lfs_t lfs_;
     lfs_config_t* config_;
     bool mounted_;
+    bool times_enabled_;
+    
+    int open_file(FileHandle& handle, const char* path, int lfs_flags);
+    void stamp_time(FileHandle& handle);
+    uint32_t read_time(const char* path);
+    uint32_t read_entry_time(const DirHandle& handle, const char* name);
     
     FSResult convert_lfs_error(int lfs_error);
     uint8_t convert_open_mode(OpenMode mode);
@@ -197,24 +452,81 @@ public:
     FSResult remove(const char* path) override;
     FSResult rename(const char* old_path, const char* new_path) override;
     FSResult stat(const char* path, FileInfo& info) override;
+    FSResult exists(const char* path) override;
+    FSResult file_size(const char* path, uint32_t& size) override;
+    FSResult file_size(FileHandle& handle, uint32_t& size) override;
     FSResult mkdir(const char* path) override;
     FSResult rmdir(const char* path) override;
+    FSResult atomic_replace(const char* path, ReplaceWriter writer, void* context) override;
     
     FSResult opendir(DirHandle& handle, const char* path) override;
     FSResult closedir(DirHandle& handle) override;
     FSResult readdir(DirHandle& handle, FileInfo& info) override;
     FSResult rewinddir(DirHandle& handle) override;
     
+    FSResult findfirst(DirHandle& handle, const char* path, const FindFilter& filter, FileInfo& info) override;
+    FSResult findnext(DirHandle& handle, FileInfo& info) override;
+    
+    FSResult enable_dir_index(const char* dir_path, DirIndexEntry* slots, size_t slot_count) override;
+    FSResult disable_dir_index(const char* dir_path) override;
+    
+    FSResult get_file_id(const char* path, FileId& id) override;
+    FSResult get_handle_id(FileHandle& handle, FileId& id) override;
+    FSResult open_by_id(FileHandle& handle, const FileId& id, OpenMode mode) override;
+    
+    FSResult set_modified_time(const char* path, uint32_t modified_time) override;
+    FSResult enable_modified_times(bool enable) override;
+    
+    FSResult swap_contents(const char* const* paths, const char* const* others, size_t count) override;
+    
     FSResult get_free_space(uint64_t& free_bytes) override;
     FSResult get_total_space(uint64_t& total_bytes) override;
 
 private:
+    // Hash index over one directory's entries, built lazily from a single
+    // readdir pass and kept current by open/sync/close/remove/rename/mkdir
+    struct DirIndex {
+        char path[MAX_PATH_LENGTH];
+        DirIndexEntry* slots;
+        size_t slot_count;
+        size_t used;            // Slots not empty, tombstones included
+        size_t deleted;         // Tombstones, reclaimed by compact_dir_index
+        size_t excess;          // While overflowed: removals to wait for before rebuilding
+        bool built;
+        bool overflowed;
+    };
+    
     FATFS fatfs_;
     char drive_path_[8];
     bool mounted_;
+    DirIndex dir_indexes_[MAX_DIR_INDEXES];
     
     FSResult convert_fatfs_error(FRESULT fresult);
     BYTE convert_open_mode(OpenMode mode);
+    FRESULT stat_entry(const char* path, FILINFO& fno);
+    FSResult find_match(DirHandle& handle, FILINFO& fno, FileInfo& info);
+    
+    // Directory index helpers
+    uint8_t locate_dir_index(const char* path, uint32_t& name_hash, uint16_t& name_check);
+    DirIndexEntry* lookup_dir_index(DirIndex& index, uint32_t name_hash, uint16_t name_check);
+    bool insert_dir_index(DirIndex& index, uint32_t name_hash, uint16_t name_check,
+                          uint8_t state, const FILINFO* fno);
+    void erase_dir_index(DirIndex& index, uint32_t name_hash, uint16_t name_check);
+    void compact_dir_index(DirIndex& index);
+    void note_dir_removal(const char* path);
+    void invalidate_dir_indexes(const char* path);
+    FSResult build_dir_index(DirIndex& index);
+    void mark_dir_index_stale(FileHandle& handle);
+    
+    // Directory entry access for file IDs and atomic replace
+    bool valid_dir_entry(uint32_t sector, uint16_t offset);
+    FSResult read_dir_entry(uint32_t sector, uint16_t offset, BYTE* entry);
+    FSResult write_dir_entries(uint32_t sector, uint16_t offset, const BYTE* entry,
+                               uint16_t second_offset = 0, const BYTE* second_entry = nullptr);
+    FSResult write_dir_sector(uint32_t sector, const uint16_t* offsets, const BYTE* entries, size_t count);
+    
+    // Atomic replace helper
+    FSResult swap_chain(const FileId& target, const FileId& temp);
 };
 
 // Main file system class - uses composition with polymorphism
@@ -227,62 +539,298 @@ public:
     // Destructor
     ~FileSys();
     
+    // Install OS services so several tasks can share this file system; every
+    // call below then runs under hooks->lock. Pass nullptr to go back to
+    // single-task use. The hooks must outlive the FileSys.
+    void set_os_hooks(const OsHooks* hooks) { hooks_ = hooks; }
+    
     // Mount/unmount operations
-    FSResult mount() { return impl_->mount(); }
-    FSResult unmount() { return impl_->unmount(); }
+    FSResult mount() { Guard guard(this); return impl_->mount(); }
+    FSResult unmount() { Guard guard(this); return impl_->unmount(); }
     bool is_mounted() const { return impl_->is_mounted(); }
     
     // File operations
-    FSResult open(FileHandle& handle, const char* path, OpenMode mode) {
-        return impl_->open(handle, path, mode);
-    }
-    FSResult close(FileHandle& handle) { return impl_->close(handle); }
-    FSResult read(FileHandle& handle, void* buffer, size_t size, size_t& bytes_read) {
-        return impl_->read(handle, buffer, size, bytes_read);
-    }
-    FSResult write(FileHandle& handle, const void* buffer, size_t size, size_t& bytes_written) {
-        return impl_->write(handle, buffer, size, bytes_written);
-    }
+    FSResult open(FileHandle& handle, const char* path, OpenMode mode);
+    FSResult close(FileHandle& handle);
+    FSResult read(FileHandle& handle, void* buffer, size_t size, size_t& bytes_read);
+    FSResult write(FileHandle& handle, const void* buffer, size_t size, size_t& bytes_written);
     FSResult seek(FileHandle& handle, int32_t offset, SeekOrigin origin) {
+        Guard guard(this, handle);
         return impl_->seek(handle, offset, origin);
     }
     FSResult tell(FileHandle& handle, uint32_t& position) {
+        Guard guard(this, handle);
         return impl_->tell(handle, position);
     }
-    FSResult sync(FileHandle& handle) { return impl_->sync(handle); }
-    FSResult truncate(FileHandle& handle, uint32_t size) {
-        return impl_->truncate(handle, size);
+    FSResult sync(FileHandle& handle);
+    FSResult truncate(FileHandle& handle, uint32_t size);
+    
+    // Durability policy, enforced by write (byte and age limits) and by
+    // end_record. Age limits need OS hooks with tick_ms and are only checked
+    // when the handle is used, so an idle writer should call check_durability
+    // periodically. The policy stays with the FileHandle across reopens.
+    FSResult set_durability(FileHandle& handle, const DurabilityPolicy& policy);
+    FSResult end_record(FileHandle& handle);        // Mark a record boundary
+    FSResult check_durability(FileHandle& handle);  // Sync if the age limit has passed
+    
+    // I/O scheduler: with OS hooks installed, requests are admitted in order
+    // of priority class, then deadline, then arrival, and a request whose
+    // deadline has passed goes ahead of every class. Background writes are
+    // cut into slice_bytes pieces and give the device up between pieces, so
+    // urgent reads wait for at most one slice. A slice size of 0 turns it off.
+    FSResult enable_io_scheduler(uint32_t slice_bytes);
+    FSResult set_io_priority(FileHandle& handle, IoPriority priority, uint32_t deadline_ms = 0);
+    IoSchedulerStats get_io_stats() {
+        Guard guard(this);
+        return scheduler_.stats;
+    }
+    
+    // Bandwidth throttling: reads, writes and syncs through handle draw on
+    // budget (nullptr detaches) and wait, with the lock released, until it
+    // has credit. Large transfers are charged in burst_bytes pieces.
+    // FOREGROUND handles are never throttled. Needs OS hooks.
+    FSResult set_budget(FileHandle& handle, IoBudget* budget);
+    
+    // Group commit: sync calls arriving within window_ms of the first one are
+    // served by a single flush pass and released together. Needs OS hooks
+    // with wait, notify_all and tick_ms; a window of 0 turns it off.
+    FSResult enable_group_commit(uint32_t window_ms);
+    GroupCommitStats get_group_commit_stats() {
+        Guard guard(this);
+        return group_commit_.stats;
+    }
+    
+    // Change notifications: creations, removals, renames and files closed
+    // after writing are posted to feed (nullptr stops them). Telling a
+    // creation from opening an existing file costs an exists() per CREATE
+    // open (free under a FatFS directory index).
+    // Files opened with open_by_id are not reported. One feed per FileSys.
+    void set_change_feed(ChangeFeed* feed) {
+        Guard guard(this);
+        changes_ = feed;
     }
     
     // File system operations
-    FSResult remove(const char* path) { return impl_->remove(path); }
-    FSResult rename(const char* old_path, const char* new_path) {
-        return impl_->rename(old_path, new_path);
+    FSResult remove(const char* path);
+    FSResult rename(const char* old_path, const char* new_path);
+    FSResult stat(const char* path, FileInfo& info) { Guard guard(this); return impl_->stat(path, info); }
+    
+    // Existence and size checks that fill no FileInfo. The handle form of
+    // file_size reads the open file's own state (pending writes included)
+    // without touching the device.
+    bool exists(const char* path) { Guard guard(this); return impl_->exists(path) == FSResult::OK; }
+    FSResult file_size(const char* path, uint32_t& size) { Guard guard(this); return impl_->file_size(path, size); }
+    FSResult file_size(FileHandle& handle, uint32_t& size) {
+        Guard guard(this, handle);
+        return impl_->file_size(handle, size);
+    }
+    FSResult mkdir(const char* path);
+    FSResult set_modified_time(const char* path, uint32_t modified_time) {
+        Guard guard(this);
+        return impl_->set_modified_time(path, modified_time);
     }
-    FSResult stat(const char* path, FileInfo& info) { return impl_->stat(path, info); }
-    FSResult mkdir(const char* path) { return impl_->mkdir(path); }
-    FSResult rmdir(const char* path) { return impl_->rmdir(path); }
+    FSResult rmdir(const char* path);
+    
+    // Modification times on LittleFS. The time is stored in a custom
+    // attribute and stamped from the time source when a written file is
+    // synced or closed, in the same commit as the data; stat, readdir and
+    // findnext then read it back, which costs one lookup per entry. Call
+    // before opening files. Returns ERROR_NOT_SUPPORTED when built with
+    // FILESYS_LFS_TIMES 0. FatFS always keeps times: enabling returns OK and
+    // disabling ERROR_NOT_SUPPORTED.
+    FSResult enable_modified_times(bool enable) {
+        Guard guard(this);
+        return impl_->enable_modified_times(enable);
+    }
+    
+    // Replace a file's content so that after a reset either the old or the
+    // new version is found, never a mix. LittleFS rewrites the file in place
+    // and commits once at close; FatFS writes a sibling temp file and swaps
+    // its cluster chain into the original directory entry with one sector
+    // write. New files are written under the temp name and renamed. A reset
+    // at worst strands the chain in flight until a disk check; the temp is
+    // discarded by the next replacement (not supported on exFAT).
+    FSResult atomic_replace(const char* path, ReplaceWriter writer, void* context);
+    
+    // Exchange the contents of paths[i] and others[i] for every i with one
+    // metadata write, so that after a reset either every pair or none is
+    // swapped. The files must exist and be closed. FatFS does it when all
+    // the entries lie in one directory sector, as a few short-named files
+    // in a small directory do; otherwise, and on LittleFS and exFAT, the
+    // result is ERROR_NOT_SUPPORTED.
+    FSResult swap_contents(const char* const* paths, const char* const* others, size_t count);
+    
+    // Tree operations
+    FSResult mkdir_p(const char* path);         // Create path and any missing parents
+    FSResult remove_tree(const char* path);     // Remove a file or a directory with all its contents
     
     // Directory operations
     FSResult opendir(DirHandle& handle, const char* path) {
+        Guard guard(this);
         return impl_->opendir(handle, path);
     }
-    FSResult closedir(DirHandle& handle) { return impl_->closedir(handle); }
+    FSResult closedir(DirHandle& handle) { Guard guard(this); return impl_->closedir(handle); }
     FSResult readdir(DirHandle& handle, FileInfo& info) {
+        Guard guard(this);
         return impl_->readdir(handle, info);
     }
-    FSResult rewinddir(DirHandle& handle) { return impl_->rewinddir(handle); }
+    FSResult rewinddir(DirHandle& handle) { Guard guard(this); return impl_->rewinddir(handle); }
+    
+    // Filtered directory search; end of results is signalled like readdir
+    // (OK with an empty name). Close the handle with closedir.
+    FSResult findfirst(DirHandle& handle, const char* path, const FindFilter& filter, FileInfo& info) {
+        Guard guard(this);
+        return impl_->findfirst(handle, path, filter, info);
+    }
+    FSResult findnext(DirHandle& handle, FileInfo& info) {
+        Guard guard(this);
+        return impl_->findnext(handle, info);
+    }
+    
+    // In-RAM index for a large directory (FatFS only). The index covers the
+    // entries directly inside dir_path; slot_count must be a power of two
+    // comfortably above the entry count (twice is a good choice). dir_path
+    // must be absolute and '/'-separated; a file path spelled any other way
+    // ("0:/d/f", "/d//f", relative) drops every index until it is rebuilt.
+    FSResult enable_dir_index(const char* dir_path, DirIndexEntry* slots, size_t slot_count) {
+        Guard guard(this);
+        return impl_->enable_dir_index(dir_path, slots, slot_count);
+    }
+    FSResult disable_dir_index(const char* dir_path) {
+        Guard guard(this);
+        return impl_->disable_dir_index(dir_path);
+    }
+    
+    // Path-free access (FatFS only). An ID taken once with get_file_id or
+    // get_handle_id reopens the file without resolving its path again;
+    // open_by_id fails with ERROR_NO_ENT if the entry was since reused. A
+    // slot reused for the same short name within one creation-time tick
+    // (10 ms, or always without a clock behind get_fattime) still matches.
+    FSResult get_file_id(const char* path, FileId& id) { Guard guard(this); return impl_->get_file_id(path, id); }
+    FSResult get_handle_id(FileHandle& handle, FileId& id) { Guard guard(this, handle); return impl_->get_handle_id(handle, id); }
+    FSResult open_by_id(FileHandle& handle, const FileId& id, OpenMode mode) {
+        Guard guard(this, handle);
+        return impl_->open_by_id(handle, id, mode);
+    }
     
     // File system information
-    FSResult get_free_space(uint64_t& free_bytes) { return impl_->get_free_space(free_bytes); }
-    FSResult get_total_space(uint64_t& total_bytes) { return impl_->get_total_space(total_bytes); }
+    FSResult get_free_space(uint64_t& free_bytes) { Guard guard(this); return impl_->get_free_space(free_bytes); }
+    FSResult get_total_space(uint64_t& total_bytes) { Guard guard(this); return impl_->get_total_space(total_bytes); }
     
     // Utility functions
     static bool is_valid_filename(const char* filename);
     static void sanitize_path(char* path);
+    static bool match_pattern(const char* pattern, const char* name);
+    static bool join_path(char* out, size_t out_size, const char* dir, const char* name);
+    static bool sibling_path(char* out, size_t out_size, const char* path, const char* name);
+    static uint32_t crc32(uint32_t crc, const void* data, size_t size);
+    
+    // Clock used to stamp modification times, on LittleFS and through
+    // get_fattime on FatFS; nullptr leaves times unset
+    static void set_time_source(TimeSource source, void* context);
+    static uint32_t current_time();
+    
+    // Between Unix seconds and FAT packed time (date << 16 | time). Both map
+    // 0 to 0, and unix_to_fat maps times outside 1980..2107 to 0.
+    static uint32_t fat_to_unix(uint32_t fat_time);
+    static uint32_t unix_to_fat(uint32_t unix_time);
+    
+    // LittleFS tuning from the device geometry and the workload. The caller
+    // sets the callbacks and read_size, prog_size, block_size, block_count;
+    // tune_littlefs fills in cache_size, lookahead_size, metadata_max and
+    // inline_max and carves the read, program and lookahead buffers out of
+    // buffers. SMALL_FILES keeps files of up to about cache_size inline in
+    // their metadata pair, with metadata blocks that still compact quickly;
+    // STREAMING gets large caches for fewer, longer transfers, a wide
+    // lookahead window for block allocation, and small metadata. When
+    // buffers is short of littlefs_buffer_size the caches shrink to fit;
+    // ERROR_NO_MEM if prog_size caches do not fit either. Every open file
+    // takes another cache_size bytes from littlefs.
+    static size_t littlefs_buffer_size(const lfs_config_t& config, LfsWorkload workload);
+    static FSResult tune_littlefs(lfs_config_t& config, LfsWorkload workload, uint8_t* buffers, size_t buffers_size);
 
 private:
+    // Holds the OS lock, when hooks are installed, for the scope of a call,
+    // and passes the call through the I/O scheduler when that is enabled
+    class Guard {
+    public:
+        explicit Guard(FileSys* fs, IoPriority priority = IoPriority::NORMAL, uint32_t deadline_ms = 0)
+            : fs_(fs), hooks_(fs->hooks_) {
+            if (hooks_) {
+                fs_->enter(priority, deadline_ms);
+            }
+        }
+        Guard(FileSys* fs, const FileHandle& handle) : Guard(fs, handle.io_priority, handle.io_deadline_ms) {}
+        ~Guard() {
+            if (hooks_) {
+                fs_->leave();
+            }
+        }
+    
+    private:
+        FileSys* fs_;
+        const OsHooks* hooks_;
+    };
+    
+    // Request waiting for the device
+    struct IoWaiter {
+        uint32_t ticket;            // Arrival order
+        uint32_t deadline;          // Absolute tick, valid if has_deadline
+        IoPriority priority;
+        bool has_deadline;
+        bool used;
+    };
+    
+    // I/O scheduler state, guarded by the OS lock. The lock is held for the
+    // whole of a call, so device_busy only matters while the owner waits
+    // (group commit window) or yields (between background slices).
+    struct IoScheduler {
+        uint32_t slice_bytes;               // 0 when disabled
+        uint32_t next_ticket;
+        bool device_busy;
+        IoPriority owner_priority;
+        IoWaiter waiters[MAX_IO_WAITERS];
+        IoSchedulerStats stats;
+        
+        IoScheduler() : slice_bytes(0), next_ticket(0), device_busy(false), owner_priority(IoPriority::NORMAL) {
+            memset(waiters, 0, sizeof(waiters));
+        }
+    };
+    
+    // Group commit state, guarded by the OS lock
+    struct GroupCommit {
+        uint32_t window_ms;                 // 0 when disabled
+        uint32_t open_batch;                // Batch that new sync requests join
+        uint32_t done_batch;                // Latest batch that has been flushed
+        bool leader_active;                 // A task is collecting open_batch
+        uint8_t pending_count;
+        FileHandle* pending[MAX_OPEN_FILES];
+        GroupCommitStats stats;
+        
+        GroupCommit() : window_ms(0), open_batch(1), done_batch(0), leader_active(false), pending_count(0) {}
+    };
+    
+    FSResult sync_grouped(FileHandle& handle);
+    FSResult sync_locked(FileHandle& handle);
+    bool durability_due(const FileHandle& handle);
+    void enter(IoPriority priority, uint32_t deadline_ms);
+    void leave();
+    void admit(IoPriority priority, uint32_t deadline_ms, bool yielding = false);
+    bool runs_before(const IoWaiter& a, const IoWaiter& b, uint32_t now) const;
+    void os_wait(uint32_t timeout_ms);
+    void park(uint32_t timeout_ms);
+    void yield_device();
+    bool throttled(const FileHandle& handle) const;
+    void throttle(FileHandle& handle, uint32_t bytes, uint32_t ops);
+    void flush_group(uint32_t batch);
+    
     IFileSystemImpl* impl_;
+    const OsHooks* hooks_ = nullptr;
+    GroupCommit group_commit_;
+    IoScheduler scheduler_;
+    ChangeFeed* changes_ = nullptr;
+    uint8_t lock_depth_ = 0;            // Nesting of Guards in the task holding the OS lock
+    std::atomic<uint16_t> arriving_{0}; // Tasks in enter() waiting for the OS lock
     
     // Static storage for implementations to avoid dynamic allocation
     union {
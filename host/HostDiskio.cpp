@@ -0,0 +1,47 @@
+#include "HostDiskio.h"
+
+namespace EmbeddedFS {
+
+static AsyncBlockAdapter* g_adapter = nullptr;
+static uint32_t g_epoch = 0;
+
+void host_diskio_attach(AsyncBlockAdapter* adapter) {
+    g_adapter = adapter;
+}
+
+static uint32_t fixed_time(void*) {
+    return g_epoch;
+}
+
+void host_diskio_set_time(uint32_t epoch_seconds) {
+    g_epoch = epoch_seconds;
+    FileSys::set_time_source(fixed_time, nullptr);
+}
+
+} // namespace EmbeddedFS
+
+using EmbeddedFS::g_adapter;
+
+extern "C" {
+
+DSTATUS disk_initialize(BYTE /*pdrv*/) {
+    return g_adapter ? 0 : STA_NOINIT | STA_NODISK;
+}
+
+DSTATUS disk_status(BYTE /*pdrv*/) {
+    return g_adapter ? 0 : STA_NOINIT | STA_NODISK;
+}
+
+DRESULT disk_read(BYTE /*pdrv*/, BYTE* buff, LBA_t sector, UINT count) {
+    return g_adapter ? g_adapter->disk_read(buff, sector, count) : RES_NOTRDY;
+}
+
+DRESULT disk_write(BYTE /*pdrv*/, const BYTE* buff, LBA_t sector, UINT count) {
+    return g_adapter ? g_adapter->disk_write(buff, sector, count) : RES_NOTRDY;
+}
+
+DRESULT disk_ioctl(BYTE /*pdrv*/, BYTE cmd, void* buff) {
+    return g_adapter ? g_adapter->disk_ioctl(cmd, buff) : RES_NOTRDY;
+}
+
+}
@@ -0,0 +1,17 @@
+#ifndef HOST_DISKIO_H
+#define HOST_DISKIO_H
+
+#include "../BlockDevice.h"
+
+namespace EmbeddedFS {
+
+// FatFS diskio layer for host tools: every physical drive is routed to one
+// AsyncBlockAdapter (nullptr reports "no disk"). host_diskio_set_time
+// installs a fixed FileSys time source, so FatFS entries get the same time
+// and images come out byte-identical from run to run.
+void host_diskio_attach(AsyncBlockAdapter* adapter);
+void host_diskio_set_time(uint32_t epoch_seconds);
+
+} // namespace EmbeddedFS
+
+#endif // HOST_DISKIO_H
@@ -0,0 +1,127 @@
+#include "MmapBlockDevice.h"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace EmbeddedFS {
+
+MmapBlockDevice::MmapBlockDevice(uint32_t erase_size)
+    : fd_(-1), map_(nullptr), size_(0), erase_size_(erase_size), read_only_(false),
+      dirty_begin_(UINT64_MAX), dirty_end_(0) {
+}
+
+MmapBlockDevice::~MmapBlockDevice() {
+    close();
+}
+
+FSResult MmapBlockDevice::open(const char* image_path, uint64_t size, bool create, bool read_only) {
+    close();
+    
+    read_only_ = read_only && !create;
+    fd_ = ::open(image_path, read_only_ ? O_RDONLY : (O_RDWR | (create ? O_CREAT | O_TRUNC : 0)), 0644);
+    if (fd_ < 0) {
+        return create ? FSResult::ERROR_IO : FSResult::ERROR_NO_ENT;
+    }
+    
+    if (create) {
+        if (ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+            close();
+            return FSResult::ERROR_NO_SPC;
+        }
+    } else if (size == 0) {
+        struct stat st;
+        if (fstat(fd_, &st) != 0) {
+            close();
+            return FSResult::ERROR_IO;
+        }
+        size = static_cast<uint64_t>(st.st_size);
+    }
+    
+    void* map = mmap(nullptr, size, read_only_ ? PROT_READ : (PROT_READ | PROT_WRITE), MAP_SHARED, fd_, 0);
+    if (map == MAP_FAILED) {
+        close();
+        return FSResult::ERROR_NO_MEM;
+    }
+    
+    map_ = static_cast<uint8_t*>(map);
+    size_ = size;
+    if (create) {
+        memset(map_, 0xFF, size_);
+        dirty_begin_ = 0;
+        dirty_end_ = size_;
+    }
+    return FSResult::OK;
+}
+
+void MmapBlockDevice::close() {
+    if (map_) {
+        flush();
+        munmap(map_, size_);
+        map_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    size_ = 0;
+}
+
+FSResult MmapBlockDevice::submit(BlockRequest& request) {
+    if (!map_) {
+        return FSResult::ERROR_NOT_MOUNTED;
+    }
+    if (request.address + request.size > size_) {
+        return FSResult::ERROR_INVALID;
+    }
+    if (read_only_ && (request.op == BlockOp::PROGRAM || request.op == BlockOp::ERASE)) {
+        request.status = FSResult::ERROR_IO;
+        return FSResult::OK;
+    }
+    
+    uint8_t* data = map_ + request.address;
+    FSResult result = FSResult::OK;
+    switch (request.op) {
+        case BlockOp::READ:
+            memcpy(request.buffer, data, request.size);
+            break;
+        case BlockOp::PROGRAM:
+        case BlockOp::ERASE:
+            if (request.op == BlockOp::PROGRAM) {
+                memcpy(data, request.buffer, request.size);
+            } else {
+                memset(data, 0xFF, request.size);
+            }
+            if (request.address < dirty_begin_) {
+                dirty_begin_ = request.address;
+            }
+            if (request.address + request.size > dirty_end_) {
+                dirty_end_ = request.address + request.size;
+            }
+            break;
+        case BlockOp::SYNC:
+            result = flush();
+            break;
+    }
+    
+    request.status = result;
+    return FSResult::OK;
+}
+
+// msync the dirty range, widened to page boundaries as msync requires
+FSResult MmapBlockDevice::flush() {
+    if (dirty_begin_ >= dirty_end_) {
+        return FSResult::OK;
+    }
+    
+    uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    uint64_t begin = dirty_begin_ - dirty_begin_ % page;
+    int res = msync(map_ + begin, dirty_end_ - begin, MS_SYNC);
+    
+    dirty_begin_ = UINT64_MAX;
+    dirty_end_ = 0;
+    return res == 0 ? FSResult::OK : FSResult::ERROR_IO;
+}
+
+} // namespace EmbeddedFS
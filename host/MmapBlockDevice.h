@@ -0,0 +1,46 @@
+#ifndef MMAP_BLOCK_DEVICE_H
+#define MMAP_BLOCK_DEVICE_H
+
+#include "../BlockDevice.h"
+
+namespace EmbeddedFS {
+
+// Host image-file device backed by a shared mapping, for image tools and
+// tests. Reads and programs are plain memory copies with no system call;
+// SYNC (LittleFS sync, FatFS CTRL_SYNC, so every FileSys::sync) runs
+// msync over the range written since the last sync. Tools that only
+// inspect an image can open it read-only and use data() directly.
+class MmapBlockDevice : public IAsyncBlockDevice {
+public:
+    explicit MmapBlockDevice(uint32_t erase_size);
+    ~MmapBlockDevice() override;
+    
+    // Map the image file; create also sizes it (new space reads as erased)
+    FSResult open(const char* image_path, uint64_t size, bool create, bool read_only = false);
+    void close();
+    
+    FSResult submit(BlockRequest& request) override;
+    
+    uint32_t erase_size() const override { return erase_size_; }
+    uint64_t capacity() const override { return size_; }
+    const uint8_t* data() const { return map_; }
+
+private:
+    int fd_;
+    uint8_t* map_;
+    uint64_t size_;
+    uint32_t erase_size_;
+    bool read_only_;
+    uint64_t dirty_begin_;          // Range written since the last msync
+    uint64_t dirty_end_;
+    
+    FSResult flush();
+    
+    // Disable copy construction and assignment
+    MmapBlockDevice(const MmapBlockDevice&) = delete;
+    MmapBlockDevice& operator=(const MmapBlockDevice&) = delete;
+};
+
+} // namespace EmbeddedFS
+
+#endif // MMAP_BLOCK_DEVICE_H
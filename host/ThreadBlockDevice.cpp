@@ -0,0 +1,92 @@
+#include "ThreadBlockDevice.h"
+#include <chrono>
+#include <cstring>
+
+namespace EmbeddedFS {
+
+ThreadBlockDevice::ThreadBlockDevice(uint8_t* image, uint64_t size, uint32_t erase_size,
+                                     uint32_t latency_us, uint32_t bytes_per_us)
+    : image_(image), size_(size), erase_size_(erase_size), latency_us_(latency_us),
+      bytes_per_us_(bytes_per_us ? bytes_per_us : 1), pending_(nullptr), completed_(nullptr),
+      result_(FSResult::OK), stop_(false),
+      worker_(&ThreadBlockDevice::run, this) {
+}
+
+ThreadBlockDevice::~ThreadBlockDevice() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+}
+
+FSResult ThreadBlockDevice::submit(BlockRequest& request) {
+    if (request.address + request.size > size_) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_ || completed_) {
+            return FSResult::ERROR_INVALID;
+        }
+        pending_ = &request;
+    }
+    cv_.notify_all();
+    return FSResult::OK;
+}
+
+// Stands in for "sleep until the DMA interrupt", and publishes the result
+// of a finished request
+void ThreadBlockDevice::idle() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait_for(lock, std::chrono::microseconds(50), [this] { return completed_ != nullptr; });
+    if (completed_) {
+        completed_->status = result_;
+        completed_ = nullptr;
+    }
+}
+
+void ThreadBlockDevice::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        cv_.wait(lock, [this] { return stop_ || pending_ != nullptr; });
+        if (stop_) {
+            return;
+        }
+        
+        BlockRequest* request = pending_;
+        lock.unlock();
+        
+        std::this_thread::sleep_for(std::chrono::microseconds(latency_us_ + request->size / bytes_per_us_));
+        FSResult result = execute(*request);
+        
+        lock.lock();
+        pending_ = nullptr;
+        completed_ = request;
+        result_ = result;
+        cv_.notify_all();
+    }
+}
+
+FSResult ThreadBlockDevice::execute(BlockRequest& request) {
+    uint8_t* data = image_ + request.address;
+    
+    switch (request.op) {
+        case BlockOp::READ:
+            memcpy(request.buffer, data, request.size);
+            break;
+        case BlockOp::PROGRAM:
+            memcpy(data, request.buffer, request.size);
+            break;
+        case BlockOp::ERASE:
+            memset(data, 0xFF, request.size);
+            break;
+        case BlockOp::SYNC:
+            break;
+    }
+    return FSResult::OK;
+}
+
+} // namespace EmbeddedFS
@@ -0,0 +1,51 @@
+#ifndef THREAD_BLOCK_DEVICE_H
+#define THREAD_BLOCK_DEVICE_H
+
+#include "../BlockDevice.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace EmbeddedFS {
+
+// Host emulation of a DMA-driven flash or SD device: a RAM image served by
+// a worker thread that takes as long as the modelled bus would. Lets the
+// overlap of AsyncBlockAdapter be measured on a PC (compare run time with
+// and without a staging buffer). The worker only records its result; it
+// is stored in request.status by idle() on the polling thread, so the
+// adapter's plain reads of the status never race with another thread.
+class ThreadBlockDevice : public IAsyncBlockDevice {
+public:
+    // Transfer time is latency_us per request plus size / bytes_per_us
+    ThreadBlockDevice(uint8_t* image, uint64_t size, uint32_t erase_size,
+                      uint32_t latency_us, uint32_t bytes_per_us);
+    ~ThreadBlockDevice() override;
+    
+    FSResult submit(BlockRequest& request) override;
+    void idle() override;
+    
+    uint32_t erase_size() const override { return erase_size_; }
+    uint64_t capacity() const override { return size_; }
+
+private:
+    uint8_t* image_;
+    uint64_t size_;
+    uint32_t erase_size_;
+    uint32_t latency_us_;
+    uint32_t bytes_per_us_;
+    
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    BlockRequest* pending_;         // Submitted, not yet taken by the worker
+    BlockRequest* completed_;       // Finished, result not yet published by idle()
+    FSResult result_;
+    bool stop_;
+    std::thread worker_;
+    
+    void run();
+    FSResult execute(BlockRequest& request);
+};
+
+} // namespace EmbeddedFS
+
+#endif // THREAD_BLOCK_DEVICE_H
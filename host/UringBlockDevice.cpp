@@ -0,0 +1,256 @@
+#include "UringBlockDevice.h"
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace EmbeddedFS {
+
+UringBlockDevice::UringBlockDevice(uint32_t erase_size, size_t queue_depth, size_t pool_threads)
+    : fd_(-1), size_(0), erase_size_(erase_size), queue_depth_(queue_depth ? queue_depth : 1),
+      queue_(queue_depth_), queued_(0), uring_ready_(false), generation_(0), batch_size_(0),
+      next_entry_(0), finished_(0), batch_failed_(false), stop_(false) {
+#ifdef EMBEDDEDFS_HAVE_URING
+    uring_ready_ = io_uring_queue_init(static_cast<unsigned>(queue_depth_), &ring_, 0) == 0;
+#endif
+    if (!uring_ready_) {
+        for (size_t i = 0; i < (pool_threads ? pool_threads : 1); i++) {
+            pool_.emplace_back(&UringBlockDevice::pool_worker, this);
+        }
+    }
+}
+
+UringBlockDevice::~UringBlockDevice() {
+    close();
+    
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex_);
+        stop_ = true;
+    }
+    pool_cv_.notify_all();
+    for (std::thread& worker : pool_) {
+        worker.join();
+    }
+
+#ifdef EMBEDDEDFS_HAVE_URING
+    if (uring_ready_) {
+        io_uring_queue_exit(&ring_);
+    }
+#endif
+}
+
+FSResult UringBlockDevice::open(const char* image_path, uint64_t size, bool create) {
+    close();
+    
+    fd_ = ::open(image_path, O_RDWR | (create ? O_CREAT : 0), 0644);
+    if (fd_ < 0) {
+        return create ? FSResult::ERROR_IO : FSResult::ERROR_NO_ENT;
+    }
+    if (create && ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+        close();
+        return FSResult::ERROR_NO_SPC;
+    }
+    
+    size_ = size;
+    return FSResult::OK;
+}
+
+void UringBlockDevice::close() {
+    if (fd_ >= 0) {
+        flush_queue();
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+FSResult UringBlockDevice::submit(BlockRequest& request) {
+    if (fd_ < 0) {
+        return FSResult::ERROR_NOT_MOUNTED;
+    }
+    if (request.address + request.size > size_) {
+        return FSResult::ERROR_INVALID;
+    }
+    
+    FSResult result = FSResult::OK;
+    switch (request.op) {
+        case BlockOp::PROGRAM:
+            result = queue_write(request.address, request.buffer, request.size, 0);
+            break;
+        case BlockOp::ERASE:
+            result = queue_write(request.address, nullptr, request.size, 0xFF);
+            break;
+        case BlockOp::READ:
+            result = flush_queue();
+            if (result == FSResult::OK) {
+                result = read_at(request.address, request.buffer, request.size);
+            }
+            break;
+        case BlockOp::SYNC:
+            result = flush_queue();
+            if (result == FSResult::OK && fdatasync(fd_) != 0) {
+                result = FSResult::ERROR_IO;
+            }
+            break;
+    }
+    
+    request.status = result;
+    return FSResult::OK;
+}
+
+// Queue a copy of data (or size bytes of fill when data is null). The
+// kernel and the pool may write one batch in any order, so its entries
+// never overlap: a write inside a queued range is merged into that entry
+// (the usual erase followed by programs of the block), any other overlap
+// flushes the queue first.
+FSResult UringBlockDevice::queue_write(uint64_t address, const void* data, uint32_t size, uint8_t fill) {
+    uint64_t end = address + size;
+    for (size_t i = 0; i < queued_; i++) {
+        QueuedWrite& entry = queue_[i];
+        uint64_t entry_end = entry.address + entry.data.size();
+        if (end <= entry.address || address >= entry_end) {
+            continue;
+        }
+        if (address >= entry.address && end <= entry_end) {
+            uint8_t* target = entry.data.data() + (address - entry.address);
+            if (data) {
+                memcpy(target, data, size);
+            } else {
+                memset(target, fill, size);
+            }
+            return FSResult::OK;
+        }
+        
+        FSResult result = flush_queue();
+        if (result != FSResult::OK) {
+            return result;
+        }
+        break;
+    }
+    
+    if (queued_ == queue_depth_) {
+        FSResult result = flush_queue();
+        if (result != FSResult::OK) {
+            return result;
+        }
+    }
+    
+    QueuedWrite& entry = queue_[queued_++];
+    entry.address = address;
+    entry.data.resize(size);
+    if (data) {
+        memcpy(entry.data.data(), data, size);
+    } else {
+        memset(entry.data.data(), fill, size);
+    }
+    return FSResult::OK;
+}
+
+FSResult UringBlockDevice::flush_queue() {
+    if (queued_ == 0) {
+        return FSResult::OK;
+    }
+    
+    FSResult result = uring_ready_ ? flush_uring() : flush_pool();
+    queued_ = 0;
+    return result;
+}
+
+// One submission for the whole queue, then reap every completion. The
+// entries do not overlap (see queue_write), so they need no ordering.
+FSResult UringBlockDevice::flush_uring() {
+#ifdef EMBEDDEDFS_HAVE_URING
+    FSResult result = FSResult::OK;
+    size_t prepared = 0;
+    for (; prepared < queued_; prepared++) {
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+        if (!sqe) {
+            // Submission queue full: hand over what is there and retry
+            if (io_uring_submit(&ring_) < 0 || !(sqe = io_uring_get_sqe(&ring_))) {
+                result = FSResult::ERROR_IO;
+                break;
+            }
+        }
+        const QueuedWrite& entry = queue_[prepared];
+        io_uring_prep_write(sqe, fd_, entry.data.data(), static_cast<unsigned>(entry.data.size()),
+                            static_cast<__u64>(entry.address));
+        sqe->user_data = prepared;
+    }
+    
+    if (io_uring_submit_and_wait(&ring_, static_cast<unsigned>(prepared)) < 0) {
+        return FSResult::ERROR_IO;
+    }
+    
+    for (size_t done = 0; done < prepared; done++) {
+        struct io_uring_cqe* cqe;
+        if (io_uring_wait_cqe(&ring_, &cqe) != 0) {
+            return FSResult::ERROR_IO;
+        }
+        const QueuedWrite& entry = queue_[cqe->user_data];
+        if (cqe->res < 0 || static_cast<size_t>(cqe->res) != entry.data.size()) {
+            result = FSResult::ERROR_IO;
+        }
+        io_uring_cqe_seen(&ring_, cqe);
+    }
+    return result;
+#else
+    return flush_pool();
+#endif
+}
+
+// Hand the queue to the pool and wait until every entry is written; as
+// the entries do not overlap, the workers may take them in any order
+FSResult UringBlockDevice::flush_pool() {
+    std::unique_lock<std::mutex> lock(pool_mutex_);
+    batch_size_ = queued_;
+    next_entry_ = 0;
+    finished_ = 0;
+    batch_failed_ = false;
+    generation_++;
+    pool_cv_.notify_all();
+    
+    pool_cv_.wait(lock, [this] { return finished_ >= batch_size_; });
+    return batch_failed_ ? FSResult::ERROR_IO : FSResult::OK;
+}
+
+void UringBlockDevice::pool_worker() {
+    uint32_t seen = 0;
+    std::unique_lock<std::mutex> lock(pool_mutex_);
+    
+    for (;;) {
+        pool_cv_.wait(lock, [this, seen] { return stop_ || generation_ != seen; });
+        if (stop_) {
+            return;
+        }
+        seen = generation_;
+        
+        // Claim under the lock, so no worker can take an index of the next
+        // batch against the size of this one; only the pwrite runs unlocked
+        while (generation_ == seen && next_entry_ < batch_size_) {
+            const QueuedWrite& entry = queue_[next_entry_++];
+            lock.unlock();
+            ssize_t n = pwrite(fd_, entry.data.data(), entry.data.size(), static_cast<off_t>(entry.address));
+            bool failed = n < 0 || static_cast<size_t>(n) != entry.data.size();
+            lock.lock();
+            
+            batch_failed_ = batch_failed_ || failed;
+            if (++finished_ >= batch_size_) {
+                pool_cv_.notify_all();
+            }
+        }
+    }
+}
+
+FSResult UringBlockDevice::read_at(uint64_t address, void* buffer, uint32_t size) {
+    uint8_t* out = static_cast<uint8_t*>(buffer);
+    while (size > 0) {
+        ssize_t n = pread(fd_, out, size, static_cast<off_t>(address));
+        if (n <= 0) {
+            return FSResult::ERROR_IO;
+        }
+        out += n;
+        address += static_cast<uint64_t>(n);
+        size -= static_cast<uint32_t>(n);
+    }
+    return FSResult::OK;
+}
+
+} // namespace EmbeddedFS
@@ -0,0 +1,87 @@
+#ifndef URING_BLOCK_DEVICE_H
+#define URING_BLOCK_DEVICE_H
+
+#include "../BlockDevice.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<liburing.h>)
+#include <liburing.h>
+#define EMBEDDEDFS_HAVE_URING 1
+#endif
+#endif
+
+namespace EmbeddedFS {
+
+// Host image-file device for soak tests on large images. Programs and
+// erases are queued and acknowledged at once; the queue goes to the kernel
+// as one io_uring batch when it fills, before a read and at sync (followed
+// by fdatasync). Without io_uring (no liburing, or io_uring_queue_init
+// fails) the batch is spread over a small pread/pwrite thread pool. A
+// write landing inside a queued one is merged into it and any other
+// overlap flushes first, so no two writes of a batch touch the same byte.
+// Requests complete inside submit, so AsyncBlockAdapter needs no staging
+// buffer with this device; use it for both the lfs_config_t callbacks and
+// the FatFS diskio shims.
+class UringBlockDevice : public IAsyncBlockDevice {
+public:
+    UringBlockDevice(uint32_t erase_size, size_t queue_depth = 64, size_t pool_threads = 4);
+    ~UringBlockDevice() override;
+    
+    // Open (and with create, size) the image file
+    FSResult open(const char* image_path, uint64_t size, bool create);
+    void close();
+    
+    FSResult submit(BlockRequest& request) override;
+    
+    uint32_t erase_size() const override { return erase_size_; }
+    uint64_t capacity() const override { return size_; }
+    bool using_uring() const { return uring_ready_; }
+
+private:
+    struct QueuedWrite {
+        uint64_t address;
+        std::vector<uint8_t> data;
+    };
+    
+    int fd_;
+    uint64_t size_;
+    uint32_t erase_size_;
+    size_t queue_depth_;
+    std::vector<QueuedWrite> queue_;
+    size_t queued_;
+    bool uring_ready_;
+#ifdef EMBEDDEDFS_HAVE_URING
+    struct io_uring ring_;
+#endif
+    
+    // Fallback pool: workers claim queue entries by index under pool_mutex_,
+    // one generation per batch
+    std::vector<std::thread> pool_;
+    std::mutex pool_mutex_;
+    std::condition_variable pool_cv_;
+    uint32_t generation_;
+    size_t batch_size_;
+    size_t next_entry_;
+    size_t finished_;
+    bool batch_failed_;
+    bool stop_;
+    
+    FSResult queue_write(uint64_t address, const void* data, uint32_t size, uint8_t fill);
+    FSResult flush_queue();
+    FSResult flush_uring();
+    FSResult flush_pool();
+    void pool_worker();
+    FSResult read_at(uint64_t address, void* buffer, uint32_t size);
+    
+    // Disable copy construction and assignment
+    UringBlockDevice(const UringBlockDevice&) = delete;
+    UringBlockDevice& operator=(const UringBlockDevice&) = delete;
+};
+
+} // namespace EmbeddedFS
+
+#endif // URING_BLOCK_DEVICE_H
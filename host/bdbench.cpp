@@ -0,0 +1,199 @@
+// Block device throughput comparison on a host image file: mmap
+// (MmapBlockDevice), plain pread/pwrite, and batched (UringBlockDevice).
+// Then the overlap gain of AsyncBlockAdapter: programs to a RAM image
+// behind a modelled bus (ThreadBlockDevice), each followed by CPU work,
+// without and with a staging buffer.
+//
+// Usage: bdbench <image-path> [size-MiB] [io-size]
+
+#include "MmapBlockDevice.h"
+#include "ThreadBlockDevice.h"
+#include "UringBlockDevice.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <random>
+#include <unistd.h>
+#include <vector>
+
+using namespace EmbeddedFS;
+
+// Baseline: one system call per request
+class PosixBlockDevice : public IAsyncBlockDevice {
+public:
+    PosixBlockDevice(const char* path, uint64_t size) : size_(size) {
+        fd_ = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd_ >= 0 && ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+            close(fd_);
+            fd_ = -1;
+        }
+    }
+    ~PosixBlockDevice() override {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+    
+    bool is_open() const { return fd_ >= 0; }
+    
+    FSResult submit(BlockRequest& request) override {
+        ssize_t n = static_cast<ssize_t>(request.size);
+        off_t offset = static_cast<off_t>(request.address);
+        switch (request.op) {
+            case BlockOp::READ:
+                n = pread(fd_, request.buffer, request.size, offset);
+                break;
+            case BlockOp::PROGRAM:
+                n = pwrite(fd_, request.buffer, request.size, offset);
+                break;
+            case BlockOp::ERASE:
+                break;
+            case BlockOp::SYNC:
+                n = fdatasync(fd_) == 0 ? n : -1;
+                break;
+        }
+        request.status = n == static_cast<ssize_t>(request.size) ? FSResult::OK : FSResult::ERROR_IO;
+        return FSResult::OK;
+    }
+    
+    uint32_t erase_size() const override { return 4096; }
+    uint64_t capacity() const override { return size_; }
+
+private:
+    int fd_;
+    uint64_t size_;
+};
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool run(IAsyncBlockDevice& device, BlockOp op, uint64_t address, void* buffer, uint32_t size) {
+    BlockRequest request;
+    request.op = op;
+    request.address = address;
+    request.buffer = buffer;
+    request.size = size;
+    request.status = FSResult::IN_PROGRESS;
+    
+    if (device.submit(request) != FSResult::OK) {
+        return false;
+    }
+    while (request.status == FSResult::IN_PROGRESS) {
+        device.idle();
+    }
+    return request.status == FSResult::OK;
+}
+
+// Sequential program of the whole image plus one sync, then as many random reads
+static bool bench(const char* name, IAsyncBlockDevice& device, uint32_t io_size) {
+    uint64_t count = device.capacity() / io_size;
+    std::vector<uint8_t> buffer(io_size, 0xA5);
+    
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < count; i++) {
+        if (!run(device, BlockOp::PROGRAM, i * io_size, buffer.data(), io_size)) {
+            return false;
+        }
+    }
+    if (!run(device, BlockOp::SYNC, 0, nullptr, 0)) {
+        return false;
+    }
+    double write_s = seconds_since(start);
+    
+    std::mt19937_64 rng(1);
+    start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < count; i++) {
+        if (!run(device, BlockOp::READ, (rng() % count) * io_size, buffer.data(), io_size)) {
+            return false;
+        }
+    }
+    double read_s = seconds_since(start);
+    
+    double mib = static_cast<double>(device.capacity()) / (1024.0 * 1024.0);
+    printf("%-12s write+sync %8.1f MiB/s   random read %8.1f MiB/s\n", name, mib / write_s, mib / read_s);
+    return true;
+}
+
+// Busy CPU time standing in for building the next page
+static void spin_us(uint32_t us) {
+    auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(us);
+    while (std::chrono::steady_clock::now() < end) {
+    }
+}
+
+// Bus modelled on a 4-bit SD card at 20 MB/s with 100 us per command; the
+// CPU work per program is about the transfer time, where overlap gains most
+static constexpr uint32_t OVERLAP_PROGRAMS = 1000;
+static constexpr uint32_t BUS_LATENCY_US = 100;
+static constexpr uint32_t BUS_BYTES_PER_US = 20;
+
+static bool overlap(uint32_t io_size) {
+    uint32_t sectors = io_size / 512;
+    if (sectors == 0) {
+        return false;
+    }
+    uint32_t work_us = BUS_LATENCY_US + io_size / BUS_BYTES_PER_US;
+    std::vector<uint8_t> image(static_cast<size_t>(OVERLAP_PROGRAMS) * sectors * 512);
+    std::vector<uint8_t> page(sectors * 512, 0x5A);
+    std::vector<uint8_t> staging(page.size());
+    ThreadBlockDevice device(image.data(), image.size(), 4096, BUS_LATENCY_US, BUS_BYTES_PER_US);
+    
+    double seconds[2];
+    for (int staged = 0; staged < 2; staged++) {
+        AsyncBlockAdapter adapter(device, staged ? staging.data() : nullptr, staged ? staging.size() : 0);
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < OVERLAP_PROGRAMS; i++) {
+            if (adapter.disk_write(page.data(), static_cast<LBA_t>(i) * sectors, sectors) != RES_OK) {
+                return false;
+            }
+            spin_us(work_us);
+        }
+        if (adapter.flush() != FSResult::OK) {
+            return false;
+        }
+        seconds[staged] = seconds_since(start);
+    }
+    
+    printf("%-12s %u programs + %u us work each: %7.1f ms unstaged  %7.1f ms staged  (%.2fx)\n", "overlap",
+           OVERLAP_PROGRAMS, work_us, seconds[0] * 1000.0, seconds[1] * 1000.0, seconds[0] / seconds[1]);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <image-path> [size-MiB] [io-size]\n", argv[0]);
+        return 2;
+    }
+    uint64_t size = (argc > 2 ? strtoull(argv[2], nullptr, 0) : 64) * 1024 * 1024;
+    uint32_t io_size = argc > 3 ? static_cast<uint32_t>(strtoul(argv[3], nullptr, 0)) : 4096;
+    
+    {
+        MmapBlockDevice device(4096);
+        if (device.open(argv[1], size, true) != FSResult::OK || !bench("mmap", device, io_size)) {
+            fprintf(stderr, "mmap run failed\n");
+            return 1;
+        }
+    }
+    {
+        PosixBlockDevice device(argv[1], size);
+        if (!device.is_open() || !bench("pread/pwrite", device, io_size)) {
+            fprintf(stderr, "pread/pwrite run failed\n");
+            return 1;
+        }
+    }
+    {
+        UringBlockDevice device(4096);
+        if (device.open(argv[1], size, true) != FSResult::OK ||
+            !bench(device.using_uring() ? "io_uring" : "write pool", device, io_size)) {
+            fprintf(stderr, "batched run failed\n");
+            return 1;
+        }
+    }
+    if (!overlap(io_size)) {
+        fprintf(stderr, "overlap run failed\n");
+        return 1;
+    }
+    return 0;
+}
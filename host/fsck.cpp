@@ -0,0 +1,855 @@
+// Check a LittleFS or FAT image for metadata and data-structure damage.
+//
+// Usage: fsck [--type lfs|fat|auto] [--block-size N] [--jobs N] [--max-report N] <image>
+//
+// The image is mapped read-only and parsed directly, without mounting it:
+//   LittleFS: every metadata pair on the tail list is fetched like lfs
+//     does (tag chain, commit CRCs, newest valid revision), directory
+//     references are matched against the pairs found, and every file's
+//     CTZ skip list is walked. Blocks claimed twice are cross-links.
+//   FAT: the FAT copies are compared, directories are walked from the
+//     root, every chain is followed (range, free/bad entries, length
+//     against file size, cross-links), and allocated clusters that no
+//     file reaches are reported as lost.
+// Directory/file work is spread over a thread pool. Exit status is 0 for
+// a clean image, 1 if problems were found and 2 if it could not be read.
+
+#include "MmapBlockDevice.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace EmbeddedFS;
+
+static uint16_t le16(const uint8_t* p) {
+    return static_cast<uint16_t>(p[0] | p[1] << 8);
+}
+
+static uint32_t le32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+           static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+static uint32_t be32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) << 24 | static_cast<uint32_t>(p[1]) << 16 |
+           static_cast<uint32_t>(p[2]) << 8 | static_cast<uint32_t>(p[3]);
+}
+
+// Problems found by any thread; the first max_report are printed
+class Report {
+public:
+    explicit Report(uint32_t max_report) : max_report_(max_report), errors_(0), warnings_(0) {}
+    
+    void error(const char* format, ...) {
+        va_list args;
+        va_start(args, format);
+        add("error", errors_, format, args);
+        va_end(args);
+    }
+    
+    void warning(const char* format, ...) {
+        va_list args;
+        va_start(args, format);
+        add("warning", warnings_, format, args);
+        va_end(args);
+    }
+    
+    uint32_t errors() const { return errors_; }
+    uint32_t warnings() const { return warnings_; }
+
+private:
+    void add(const char* level, uint32_t& counter, const char* format, va_list args) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (errors_ + warnings_ < max_report_) {
+            char line[512];
+            vsnprintf(line, sizeof(line), format, args);
+            printf("%s: %s\n", level, line);
+        }
+        counter++;
+    }
+    
+    std::mutex mutex_;
+    uint32_t max_report_;
+    uint32_t errors_;
+    uint32_t warnings_;
+};
+
+// Thread pool over a queue of work items; items may queue more items.
+// run() returns when the queue is empty and every worker is idle.
+template <typename Item>
+class WorkQueue {
+public:
+    void push(const Item& item) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(item);
+        cv_.notify_one();
+    }
+    
+    void run(uint32_t threads, const std::function<void(const Item&)>& work) {
+        std::vector<std::thread> pool;
+        for (uint32_t i = 0; i < threads; i++) {
+            pool.emplace_back([this, &work] {
+                std::unique_lock<std::mutex> lock(mutex_);
+                for (;;) {
+                    cv_.wait(lock, [this] { return !queue_.empty() || active_ == 0; });
+                    if (queue_.empty()) {
+                        cv_.notify_all();
+                        return;
+                    }
+                    Item item = queue_.front();
+                    queue_.pop_front();
+                    active_++;
+                    lock.unlock();
+                    work(item);
+                    lock.lock();
+                    active_--;
+                    cv_.notify_all();
+                }
+            });
+        }
+        for (std::thread& thread : pool) {
+            thread.join();
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Item> queue_;
+    uint32_t active_ = 0;
+};
+
+// Run one parallel pass over [0, count) in contiguous ranges
+static void parallel_for(uint32_t threads, uint64_t count, const std::function<void(uint64_t, uint64_t)>& work) {
+    std::vector<std::thread> pool;
+    uint64_t step = (count + threads - 1) / threads;
+    for (uint64_t begin = 0; begin < count; begin += step) {
+        uint64_t end = begin + step < count ? begin + step : count;
+        pool.emplace_back(work, begin, end);
+    }
+    for (std::thread& thread : pool) {
+        thread.join();
+    }
+}
+
+// One claim flag per block or cluster; a second claim is a cross-link
+class ClaimMap {
+public:
+    explicit ClaimMap(uint64_t count) : count_(count), flags_(new std::atomic<uint8_t>[count]()) {}
+    
+    bool in_range(uint64_t index) const { return index < count_; }
+    bool claim(uint64_t index) { return flags_[index].exchange(1) == 0; }
+    bool claimed(uint64_t index) const { return flags_[index].load() != 0; }
+
+private:
+    uint64_t count_;
+    std::unique_ptr<std::atomic<uint8_t>[]> flags_;
+};
+
+class Timer {
+public:
+    Timer() : start_(std::chrono::steady_clock::now()) {}
+    double ms() const {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start_;
+};
+
+// ---------------------------------------------------------------------------
+// LittleFS
+// ---------------------------------------------------------------------------
+
+// lfs_crc: reflected CRC-32 without the final inversion
+static uint32_t lfs_crc(uint32_t crc, const uint8_t* data, size_t size) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+        0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+        0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+    for (size_t i = 0; i < size; i++) {
+        crc = (crc >> 4) ^ table[(crc ^ data[i]) & 0xf];
+        crc = (crc >> 4) ^ table[(crc ^ (data[i] >> 4)) & 0xf];
+    }
+    return crc;
+}
+
+static constexpr uint32_t LFS_BLOCK_NULL = 0xffffffff;
+
+// State of one id in a metadata pair after replaying its valid commits
+struct LfsEntry {
+    uint16_t name_type;     // 0x001 file, 0x002 directory, 0x0ff superblock
+    uint16_t struct_type;   // 0x200 dir, 0x201 inline, 0x202 ctz
+    uint32_t a;             // Dir pair[0] or CTZ head
+    uint32_t b;             // Dir pair[1] or CTZ size
+    uint32_t c;             // Third word of an inline struct
+    std::string name;
+};
+
+struct LfsBlockState {
+    bool valid;                 // At least one commit passed its CRC
+    uint32_t revision;
+    uint32_t commits;
+    bool torn;                  // Tags after the last good commit failed their CRC
+    std::vector<LfsEntry> entries;
+    uint16_t tail_type;         // 0x600 soft, 0x601 hard, 0 none
+    uint32_t tail[2];
+};
+
+class LfsChecker {
+public:
+    LfsChecker(const uint8_t* image, uint64_t size, uint32_t block_size, uint32_t jobs, Report& report)
+        : image_(image), block_size_(block_size), block_count_(static_cast<uint32_t>(size / block_size)),
+          jobs_(jobs), report_(report), claims_(size / block_size), pairs_(0), files_(0), blocks_(0) {}
+    
+    bool run();
+
+private:
+    struct Tag {
+        uint16_t type;
+        uint16_t id;
+        uint32_t offset;    // Data offset in the block
+        uint32_t size;
+    };
+    
+    struct CtzJob {
+        uint32_t head;
+        uint32_t size;
+        std::string name;
+    };
+    
+    const uint8_t* block(uint32_t index) const { return image_ + static_cast<uint64_t>(index) * block_size_; }
+    
+    LfsBlockState fetch(uint32_t index) const;
+    void apply(LfsBlockState& state, const std::vector<Tag>& tags, const uint8_t* data) const;
+    bool check_pair(const uint32_t pair[2], LfsBlockState& state);
+    void check_ctz(const CtzJob& job);
+    
+    const uint8_t* image_;
+    uint32_t block_size_;
+    uint32_t block_count_;
+    uint32_t jobs_;
+    Report& report_;
+    ClaimMap claims_;
+    std::atomic<uint32_t> pairs_;
+    std::atomic<uint32_t> files_;
+    std::atomic<uint64_t> blocks_;
+};
+
+// Parse one block of a metadata pair like lfs_dir_fetch: walk the tag
+// chain, check each commit's CRC and keep what the valid commits say
+LfsBlockState LfsChecker::fetch(uint32_t index) const {
+    const uint8_t* data = block(index);
+    LfsBlockState state = {};
+    state.revision = le32(data);
+    
+    uint32_t crc = lfs_crc(0xffffffff, data, 4);
+    uint32_t ptag = 0xffffffff;
+    uint32_t off = 4;
+    std::vector<Tag> pending;
+    
+    while (off + 4 <= block_size_) {
+        crc = lfs_crc(crc, data + off, 4);
+        uint32_t tag = be32(data + off) ^ ptag;
+        if (tag & 0x80000000) {
+            break;                          // Not programmed yet
+        }
+        
+        uint32_t size = tag & 0x3ff;
+        uint32_t dsize = size == 0x3ff ? 0 : size;
+        if (off + 4 + dsize > block_size_) {
+            break;
+        }
+        ptag = tag;
+        
+        uint16_t type = static_cast<uint16_t>((tag >> 20) & 0x7ff);
+        if ((type & 0x780) == 0x500) {
+            // Commit CRC
+            if (off + 8 > block_size_ || le32(data + off + 4) != crc) {
+                state.torn = !pending.empty() || state.valid;
+                return state;
+            }
+            apply(state, pending, data);
+            pending.clear();
+            state.valid = true;
+            state.commits++;
+            ptag ^= static_cast<uint32_t>(type & 1) << 31;
+            crc = 0xffffffff;
+        } else {
+            crc = lfs_crc(crc, data + off + 4, dsize);
+            pending.push_back(Tag{type, static_cast<uint16_t>((tag >> 10) & 0x3ff), off + 4, dsize});
+        }
+        off += 4 + dsize;
+    }
+    
+    state.torn = !pending.empty();
+    return state;
+}
+
+void LfsChecker::apply(LfsBlockState& state, const std::vector<Tag>& tags, const uint8_t* data) const {
+    std::vector<LfsEntry>& entries = state.entries;
+    
+    for (const Tag& tag : tags) {
+        uint16_t type1 = tag.type & 0x700;
+        if (type1 == 0x600) {
+            if (tag.size >= 8) {
+                state.tail_type = tag.type;
+                state.tail[0] = le32(data + tag.offset);
+                state.tail[1] = le32(data + tag.offset + 4);
+            }
+            continue;
+        }
+        if (type1 != 0x000 && type1 != 0x200 && type1 != 0x400) {
+            continue;                       // User attributes, global state
+        }
+        if (tag.id == 0x3ff) {
+            continue;
+        }
+        
+        if (tag.type == 0x401) {
+            entries.insert(entries.begin() + (tag.id < entries.size() ? tag.id : entries.size()), LfsEntry());
+            continue;
+        }
+        if (tag.type == 0x4ff) {
+            if (tag.id < entries.size()) {
+                entries.erase(entries.begin() + tag.id);
+            }
+            continue;
+        }
+        
+        if (tag.id >= entries.size()) {
+            entries.resize(tag.id + 1);
+        }
+        LfsEntry& entry = entries[tag.id];
+        if (type1 == 0x000) {
+            entry.name_type = tag.type;
+            entry.name.assign(reinterpret_cast<const char*>(data + tag.offset), tag.size);
+        } else if (type1 == 0x200) {
+            entry.struct_type = tag.type;
+            entry.a = tag.size >= 4 ? le32(data + tag.offset) : 0;
+            entry.b = tag.size >= 8 ? le32(data + tag.offset + 4) : tag.size;
+            entry.c = tag.size >= 12 ? le32(data + tag.offset + 8) : 0;
+        }
+    }
+}
+
+// Fetch both blocks and pick the newest valid one, as lfs does
+bool LfsChecker::check_pair(const uint32_t pair[2], LfsBlockState& state) {
+    if (pair[0] >= block_count_ || pair[1] >= block_count_ || pair[0] == pair[1]) {
+        report_.error("metadata pair {%u, %u} is out of range or degenerate", pair[0], pair[1]);
+        return false;
+    }
+    
+    LfsBlockState first = fetch(pair[0]);
+    LfsBlockState second = fetch(pair[1]);
+    if (!first.valid && !second.valid) {
+        report_.error("metadata pair {%u, %u} has no valid commit", pair[0], pair[1]);
+        return false;
+    }
+    
+    bool use_second = second.valid && (!first.valid || static_cast<int32_t>(second.revision - first.revision) > 0);
+    state = use_second ? second : first;
+    if (state.torn) {
+        report_.warning("metadata pair {%u, %u}: uncommitted tail after the last commit (power loss?)",
+                        pair[0], pair[1]);
+    }
+    
+    for (int i = 0; i < 2; i++) {
+        if (!claims_.claim(pair[i])) {
+            report_.error("block %u of metadata pair {%u, %u} is also used elsewhere", pair[i], pair[0], pair[1]);
+        }
+    }
+    pairs_++;
+    blocks_ += 2;
+    return true;
+}
+
+// Index of the CTZ block holding the byte at off (lfs_ctz_index)
+static uint32_t ctz_index(uint32_t block_size, uint32_t off) {
+    uint32_t b = block_size - 2 * 4;
+    uint32_t i = off / b;
+    if (i == 0) {
+        return 0;
+    }
+    return (off - 4 * (__builtin_popcount(i - 1) + 2)) / b;
+}
+
+// Follow the skip list from the head through the first pointer of each block
+void LfsChecker::check_ctz(const CtzJob& job) {
+    if (job.size == 0) {
+        return;
+    }
+    
+    uint32_t current = job.head;
+    uint32_t index = ctz_index(block_size_, job.size - 1);
+    files_++;
+    for (;;) {
+        if (current >= block_count_) {
+            report_.error("file '%s': block %u out of range", job.name.c_str(), current);
+            return;
+        }
+        if (!claims_.claim(current)) {
+            report_.error("file '%s': block %u is cross-linked", job.name.c_str(), current);
+            return;
+        }
+        blocks_++;
+        if (index == 0) {
+            return;
+        }
+        current = le32(block(current));
+        index--;
+    }
+}
+
+bool LfsChecker::run() {
+    Timer timer;
+    
+    // Superblock
+    uint32_t root[2] = {0, 1};
+    LfsBlockState super;
+    if (!check_pair(root, super)) {
+        return false;
+    }
+    if (super.entries.empty() || super.entries[0].name_type != 0x0ff || super.entries[0].name != "littlefs") {
+        report_.error("superblock entry missing");
+        return false;
+    }
+    // Inline superblock: version, block_size, block_count, ...
+    const LfsEntry& superblock = super.entries[0];
+    if (superblock.struct_type != 0x201) {
+        report_.error("superblock has no inline struct");
+    } else if (superblock.b != block_size_) {
+        report_.error("superblock block size %u, checking with %u (use --block-size)", superblock.b, block_size_);
+        return false;
+    } else if (superblock.c > block_count_) {
+        report_.error("superblock block count %u exceeds the image (%u blocks)", superblock.c, block_count_);
+    }
+    
+    // Walk the metadata list; file data goes to the pool
+    WorkQueue<CtzJob> ctz_jobs;
+    std::set<std::pair<uint32_t, uint32_t>> seen;
+    std::vector<std::pair<uint32_t, uint32_t>> referenced;
+    uint32_t pair[2] = {super.tail[0], super.tail[1]};
+    LfsBlockState state = super;
+    seen.insert(std::make_pair(0u, 1u));
+    
+    for (;;) {
+        for (const LfsEntry& entry : state.entries) {
+            if (entry.struct_type == 0x202 && entry.name_type == 0x001) {
+                ctz_jobs.push(CtzJob{entry.a, entry.b, entry.name});
+            } else if (entry.struct_type == 0x200 && entry.name_type == 0x002) {
+                referenced.push_back(std::make_pair(entry.a < entry.b ? entry.a : entry.b,
+                                                    entry.a < entry.b ? entry.b : entry.a));
+            }
+        }
+        
+        if (state.tail_type == 0 || state.tail[0] == LFS_BLOCK_NULL || state.tail[1] == LFS_BLOCK_NULL) {
+            break;
+        }
+        pair[0] = state.tail[0];
+        pair[1] = state.tail[1];
+        std::pair<uint32_t, uint32_t> key(pair[0] < pair[1] ? pair[0] : pair[1], pair[0] < pair[1] ? pair[1] : pair[0]);
+        if (!seen.insert(key).second) {
+            report_.error("metadata tail list loops back to {%u, %u}", pair[0], pair[1]);
+            break;
+        }
+        if (!check_pair(pair, state)) {
+            break;
+        }
+    }
+    double metadata_ms = timer.ms();
+    
+    // Every directory must point at a pair on the list
+    for (const auto& ref : referenced) {
+        if (!seen.count(ref)) {
+            report_.error("directory points at metadata pair {%u, %u} that is not on the tail list",
+                          ref.first, ref.second);
+        }
+    }
+    
+    Timer data_timer;
+    ctz_jobs.run(jobs_, [this](const CtzJob& job) { check_ctz(job); });
+    
+    printf("littlefs: %u metadata pairs, %u files, %llu of %u blocks in use\n",
+           pairs_.load(), files_.load(), static_cast<unsigned long long>(blocks_.load()), block_count_);
+    printf("time: metadata %.1f ms, file data %.1f ms\n", metadata_ms, data_timer.ms());
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// FAT
+// ---------------------------------------------------------------------------
+
+class FatChecker {
+public:
+    FatChecker(const uint8_t* image, uint64_t size, uint32_t jobs, Report& report)
+        : image_(image), image_size_(size), jobs_(jobs), report_(report), files_(0), directories_(0) {}
+    
+    bool run();
+
+private:
+    struct DirJob {
+        uint32_t cluster;       // 0: FAT12/16 root area
+        std::string path;
+    };
+    
+    bool parse_boot();
+    uint32_t entry(uint32_t cluster) const;
+    bool is_eoc(uint32_t value) const { return value >= eoc_; }
+    bool is_bad(uint32_t value) const { return value == eoc_ - 1; }
+    const uint8_t* cluster_data(uint32_t cluster) const {
+        return volume_ + (static_cast<uint64_t>(data_start_) + static_cast<uint64_t>(cluster - 2) * cluster_sectors_) *
+                         sector_size_;
+    }
+    bool follow(uint32_t start, const std::string& path, std::vector<uint32_t>* chain, uint32_t& length);
+    void check_directory(const DirJob& job, WorkQueue<DirJob>& queue);
+    
+    const uint8_t* image_;
+    uint64_t image_size_;
+    uint32_t jobs_;
+    Report& report_;
+    
+    const uint8_t* volume_ = nullptr;
+    uint32_t sector_size_;
+    uint32_t cluster_sectors_;
+    uint32_t fat_start_;
+    uint32_t fat_sectors_;
+    uint32_t fat_count_;
+    uint32_t root_entries_;
+    uint32_t root_start_;
+    uint32_t data_start_;
+    uint32_t clusters_;         // Data clusters; valid numbers are 2 .. clusters_ + 1
+    uint32_t root_cluster_ = 0;
+    uint32_t eoc_;              // First end-of-chain value; eoc_ - 1 marks a bad cluster
+    int fat_bits_;
+    
+    std::unique_ptr<ClaimMap> claims_;
+    std::atomic<uint32_t> files_;
+    std::atomic<uint32_t> directories_;
+};
+
+bool FatChecker::parse_boot() {
+    volume_ = image_;
+    const uint8_t* boot = image_;
+    uint64_t offset = 0;
+    
+    // No BPB at sector 0: take the first MBR partition
+    bool has_bpb = (boot[0] == 0xEB || boot[0] == 0xE9) && le16(boot + 11) >= 512;
+    if (!has_bpb && boot[510] == 0x55 && boot[511] == 0xAA) {
+        offset = static_cast<uint64_t>(le32(boot + 0x1C6)) * 512;
+        if (offset + 512 > image_size_) {
+            report_.error("partition start is beyond the image");
+            return false;
+        }
+        volume_ = image_ + offset;
+        boot = volume_;
+    }
+    
+    sector_size_ = le16(boot + 11);
+    cluster_sectors_ = boot[13];
+    uint32_t reserved = le16(boot + 14);
+    fat_count_ = boot[16];
+    root_entries_ = le16(boot + 17);
+    uint32_t total = le16(boot + 19) ? le16(boot + 19) : le32(boot + 32);
+    fat_sectors_ = le16(boot + 22) ? le16(boot + 22) : le32(boot + 36);
+    
+    if (sector_size_ < 512 || (sector_size_ & (sector_size_ - 1)) || cluster_sectors_ == 0 ||
+        fat_count_ == 0 || fat_sectors_ == 0) {
+        report_.error("no valid FAT boot sector");
+        return false;
+    }
+    if (offset + static_cast<uint64_t>(total) * sector_size_ > image_size_) {
+        report_.error("volume (%u sectors) is larger than the image", total);
+        return false;
+    }
+    
+    fat_start_ = reserved;
+    root_start_ = reserved + fat_count_ * fat_sectors_;
+    uint32_t root_sectors = (root_entries_ * 32 + sector_size_ - 1) / sector_size_;
+    data_start_ = root_start_ + root_sectors;
+    clusters_ = (total - data_start_) / cluster_sectors_;
+    
+    if (clusters_ < 4085) {
+        fat_bits_ = 12;
+        eoc_ = 0xFF8;
+    } else if (clusters_ < 65525) {
+        fat_bits_ = 16;
+        eoc_ = 0xFFF8;
+    } else {
+        fat_bits_ = 32;
+        eoc_ = 0x0FFFFFF8;
+        root_cluster_ = le32(boot + 44);
+    }
+    
+    uint64_t needed = (static_cast<uint64_t>(clusters_) + 2) * fat_bits_ / 8;
+    if (needed > static_cast<uint64_t>(fat_sectors_) * sector_size_) {
+        report_.error("FAT (%u sectors) is too small for %u clusters", fat_sectors_, clusters_);
+        return false;
+    }
+    return true;
+}
+
+uint32_t FatChecker::entry(uint32_t cluster) const {
+    const uint8_t* fat = volume_ + static_cast<uint64_t>(fat_start_) * sector_size_;
+    switch (fat_bits_) {
+        case 12: {
+            uint16_t value = le16(fat + cluster + cluster / 2);
+            return cluster & 1 ? value >> 4 : value & 0xFFF;
+        }
+        case 16:
+            return le16(fat + cluster * 2);
+        default:
+            return le32(fat + cluster * 4) & 0x0FFFFFFF;
+    }
+}
+
+// Claim every cluster of a chain and count them; false (after reporting)
+// if the chain is broken or cross-linked
+bool FatChecker::follow(uint32_t start, const std::string& path, std::vector<uint32_t>* chain, uint32_t& length) {
+    length = 0;
+    uint32_t cluster = start;
+    
+    for (;;) {
+        if (cluster < 2 || cluster >= clusters_ + 2) {
+            report_.error("%s: cluster %u out of range", path.c_str(), cluster);
+            return false;
+        }
+        if (!claims_->claim(cluster)) {
+            report_.error("%s: cluster %u is cross-linked", path.c_str(), cluster);
+            return false;
+        }
+        length++;
+        if (chain) {
+            chain->push_back(cluster);
+        }
+        
+        uint32_t next = entry(cluster);
+        if (is_eoc(next)) {
+            return true;
+        }
+        if (next == 0) {
+            report_.error("%s: chain runs into free cluster after %u", path.c_str(), cluster);
+            return false;
+        }
+        if (is_bad(next)) {
+            report_.error("%s: chain runs into a bad cluster after %u", path.c_str(), cluster);
+            return false;
+        }
+        cluster = next;
+    }
+}
+
+void FatChecker::check_directory(const DirJob& job, WorkQueue<DirJob>& queue) {
+    directories_++;
+    
+    // Collect the directory's bytes: fixed root area or cluster chain
+    std::vector<const uint8_t*> parts;
+    uint32_t part_size;
+    if (job.cluster == 0) {
+        parts.push_back(volume_ + static_cast<uint64_t>(root_start_) * sector_size_);
+        part_size = root_entries_ * 32;
+    } else {
+        std::vector<uint32_t> chain;
+        uint32_t length;
+        follow(job.cluster, job.path.empty() ? "/" : job.path, &chain, length);
+        for (uint32_t cluster : chain) {
+            parts.push_back(cluster_data(cluster));
+        }
+        part_size = cluster_sectors_ * sector_size_;
+    }
+    
+    uint32_t cluster_bytes = cluster_sectors_ * sector_size_;
+    for (const uint8_t* part : parts) {
+        for (uint32_t off = 0; off + 32 <= part_size; off += 32) {
+            const uint8_t* e = part + off;
+            if (e[0] == 0x00) {
+                return;                             // End of directory
+            }
+            uint8_t attr = e[11];
+            if (e[0] == 0xE5 || (attr & 0x3F) == 0x0F || (attr & 0x08)) {
+                continue;                           // Deleted, long name, volume label
+            }
+            if (e[0] == '.' && (e[1] == ' ' || (e[1] == '.' && e[2] == ' '))) {
+                continue;
+            }
+            
+            char name[13];
+            size_t n = 0;
+            for (int i = 0; i < 8 && e[i] != ' '; i++) {
+                name[n++] = static_cast<char>(e[i] == 0x05 ? 0xE5 : e[i]);
+            }
+            if (e[8] != ' ') {
+                name[n++] = '.';
+                for (int i = 8; i < 11 && e[i] != ' '; i++) {
+                    name[n++] = static_cast<char>(e[i]);
+                }
+            }
+            name[n] = '\0';
+            std::string path = job.path + "/" + name;
+            
+            uint32_t start = le16(e + 26) | (fat_bits_ == 32 ? static_cast<uint32_t>(le16(e + 20)) << 16 : 0);
+            uint32_t size = le32(e + 28);
+            
+            if (attr & 0x10) {
+                if (start == 0) {
+                    report_.error("%s: directory without clusters", path.c_str());
+                } else {
+                    queue.push(DirJob{start, path});
+                }
+                continue;
+            }
+            
+            files_++;
+            uint32_t expected = (size + cluster_bytes - 1) / cluster_bytes;
+            if (start == 0) {
+                if (size != 0) {
+                    report_.error("%s: size %u but no clusters", path.c_str(), size);
+                }
+                continue;
+            }
+            uint32_t length;
+            if (follow(start, path, nullptr, length) && length != expected) {
+                report_.error("%s: chain has %u clusters, size %u needs %u", path.c_str(), length, size, expected);
+            }
+        }
+    }
+}
+
+bool FatChecker::run() {
+    Timer timer;
+    if (!parse_boot()) {
+        return false;
+    }
+    claims_.reset(new ClaimMap(static_cast<uint64_t>(clusters_) + 2));
+    
+    // FAT copies must match
+    uint64_t fat_bytes = static_cast<uint64_t>(fat_sectors_) * sector_size_;
+    const uint8_t* first_fat = volume_ + static_cast<uint64_t>(fat_start_) * sector_size_;
+    for (uint32_t copy = 1; copy < fat_count_; copy++) {
+        const uint8_t* other = first_fat + copy * fat_bytes;
+        std::atomic<uint32_t> differing(0);
+        parallel_for(jobs_, fat_sectors_, [&](uint64_t begin, uint64_t end) {
+            for (uint64_t s = begin; s < end; s++) {
+                if (memcmp(first_fat + s * sector_size_, other + s * sector_size_, sector_size_) != 0) {
+                    differing++;
+                }
+            }
+        });
+        if (differing) {
+            report_.error("FAT copy %u differs from the first in %u sectors", copy + 1, differing.load());
+        }
+    }
+    double fat_ms = timer.ms();
+    
+    // Directory tree
+    Timer tree_timer;
+    WorkQueue<DirJob> queue;
+    queue.push(DirJob{fat_bits_ == 32 ? root_cluster_ : 0, ""});
+    queue.run(jobs_, [this, &queue](const DirJob& job) { check_directory(job, queue); });
+    double tree_ms = tree_timer.ms();
+    
+    // Allocated but unreachable clusters
+    Timer lost_timer;
+    std::atomic<uint32_t> lost(0);
+    std::atomic<uint32_t> used(0);
+    parallel_for(jobs_, clusters_, [&](uint64_t begin, uint64_t end) {
+        for (uint64_t i = begin; i < end; i++) {
+            uint32_t cluster = static_cast<uint32_t>(i) + 2;
+            uint32_t value = entry(cluster);
+            if (value == 0 || is_bad(value)) {
+                continue;
+            }
+            used++;
+            if (!claims_->claimed(cluster)) {
+                lost++;
+            }
+        }
+    });
+    if (lost) {
+        report_.error("%u allocated clusters are not reachable from any file (lost)", lost.load());
+    }
+    
+    printf("fat%d: %u directories, %u files, %u of %u clusters in use\n",
+           fat_bits_, directories_.load(), files_.load(), used.load(), clusters_);
+    printf("time: FAT copies %.1f ms, tree %.1f ms, lost scan %.1f ms\n", fat_ms, tree_ms, lost_timer.ms());
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+    const char* type = "auto";
+    uint32_t block_size = 4096;
+    uint32_t jobs = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 4;
+    uint32_t max_report = 100;
+    const char* image = nullptr;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--type") == 0 && i + 1 < argc) {
+            type = argv[++i];
+        } else if (strcmp(argv[i], "--block-size") == 0 && i + 1 < argc) {
+            block_size = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 0));
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 0));
+        } else if (strcmp(argv[i], "--max-report") == 0 && i + 1 < argc) {
+            max_report = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 0));
+        } else if (!image && argv[i][0] != '-') {
+            image = argv[i];
+        } else {
+            image = nullptr;
+            break;
+        }
+    }
+    if (!image || block_size < 128 || jobs == 0) {
+        fprintf(stderr, "usage: %s [--type lfs|fat|auto] [--block-size N] [--jobs N] [--max-report N] <image>\n",
+                argv[0]);
+        return 2;
+    }
+    
+    MmapBlockDevice device(block_size);
+    if (device.open(image, 0, false, true) != FSResult::OK || device.capacity() < 1024) {
+        fprintf(stderr, "fsck: cannot map %s\n", image);
+        return 2;
+    }
+    const uint8_t* data = device.data();
+    uint64_t size = device.capacity();
+    
+    if (strcmp(type, "auto") == 0) {
+        // The LittleFS superblock name sits right after the first tag
+        bool lfs = size >= 2ull * block_size && (memcmp(data + 8, "littlefs", 8) == 0 ||
+                                                 memcmp(data + block_size + 8, "littlefs", 8) == 0);
+        type = lfs ? "lfs" : "fat";
+    }
+    
+    Report report(max_report);
+    Timer timer;
+    bool ok;
+    if (strcmp(type, "lfs") == 0) {
+        LfsChecker checker(data, size, block_size, jobs, report);
+        ok = checker.run();
+    } else {
+        FatChecker checker(data, size, jobs, report);
+        ok = checker.run();
+    }
+    
+    printf("%s: %u errors, %u warnings, %.1f ms with %u threads\n", image, report.errors(), report.warnings(),
+           timer.ms(), jobs);
+    if (!ok) {
+        return 2;
+    }
+    return report.errors() ? 1 : 0;
+}
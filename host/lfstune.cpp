@@ -0,0 +1,283 @@
+// LittleFS tuning sweep: a small-file and a streaming workload run against
+// a range of cache sizes, with and without inline files, and against the
+// FileSys::tune_littlefs profile for each workload.
+//
+// Usage: lfstune <image-path> [block-size] [prog-size] [block-count]
+//
+// Each run formats a fresh image. Throughput is device time from a cost
+// model of a serial NOR flash (W25Q-class at 50 MHz: a read command plus
+// transfer, 256-byte page programs, 4 KiB sector erases) applied to the
+// transfers littlefs issues, so it ranks configurations by their traffic
+// rather than by host memory speed.
+
+#include "MmapBlockDevice.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <unistd.h>
+#include <vector>
+
+using namespace EmbeddedFS;
+
+static constexpr double READ_COMMAND_US = 1.0;          // Opcode, address and dummy cycles
+static constexpr double TRANSFER_US_PER_BYTE = 0.16;    // 50 MHz single SPI
+static constexpr double PAGE_PROGRAM_US = 400.0;        // Per page touched
+static constexpr uint32_t PAGE_SIZE = 256;
+static constexpr double SECTOR_ERASE_US = 45000.0;      // Per 4 KiB
+static constexpr uint32_t SECTOR_SIZE = 4096;
+
+static constexpr uint32_t SMALL_FILES = 400;
+static constexpr uint32_t SMALL_MAX = 384;              // Sizes 16..SMALL_MAX bytes
+static constexpr uint32_t STREAM_BYTES = 1 << 20;
+static constexpr uint32_t STREAM_CHUNK = 4096;
+
+// Passes requests through to the image and charges them to the model
+class TimedDevice : public IAsyncBlockDevice {
+public:
+    explicit TimedDevice(MmapBlockDevice& device) : device_(device), elapsed_us_(0) {}
+    
+    FSResult submit(BlockRequest& request) override {
+        switch (request.op) {
+            case BlockOp::READ:
+                elapsed_us_ += READ_COMMAND_US + request.size * TRANSFER_US_PER_BYTE;
+                break;
+            case BlockOp::PROGRAM: {
+                uint64_t first = request.address / PAGE_SIZE;
+                uint64_t last = (request.address + request.size - 1) / PAGE_SIZE;
+                elapsed_us_ += (last - first + 1) * PAGE_PROGRAM_US + request.size * TRANSFER_US_PER_BYTE;
+                break;
+            }
+            case BlockOp::ERASE:
+                elapsed_us_ += (request.size + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_ERASE_US;
+                break;
+            case BlockOp::SYNC:
+                break;
+        }
+        return device_.submit(request);
+    }
+    
+    uint32_t erase_size() const override { return device_.erase_size(); }
+    uint64_t capacity() const override { return device_.capacity(); }
+    
+    double elapsed_us() const { return elapsed_us_; }
+    void reset() { elapsed_us_ = 0; }
+
+private:
+    MmapBlockDevice& device_;
+    double elapsed_us_;
+};
+
+struct Geometry {
+    uint32_t block_size;
+    uint32_t prog_size;
+    uint32_t block_count;
+};
+
+// Device seconds for each phase of both workloads
+struct RunResult {
+    bool ok;
+    double small_write_s;
+    double small_read_s;
+    double stream_write_s;
+    double stream_read_s;
+};
+
+static bool run_small(FileSys& fs, TimedDevice& timed, RunResult& run) {
+    std::mt19937 random(1);
+    std::vector<uint8_t> data(SMALL_MAX);
+    char path[32];
+    
+    timed.reset();
+    for (uint32_t i = 0; i < SMALL_FILES; i++) {
+        uint32_t size = 16 + random() % (SMALL_MAX - 15);
+        for (uint32_t j = 0; j < size; j++) {
+            data[j] = static_cast<uint8_t>(random());
+        }
+        snprintf(path, sizeof(path), "/s/%04u.cfg", i);
+        
+        FileHandle file;
+        size_t written;
+        if (fs.open(file, path, OpenMode::WRITE | OpenMode::CREATE | OpenMode::TRUNC) != FSResult::OK ||
+            fs.write(file, data.data(), size, written) != FSResult::OK || fs.close(file) != FSResult::OK) {
+            return false;
+        }
+    }
+    run.small_write_s = timed.elapsed_us() / 1e6;
+    
+    timed.reset();
+    for (uint32_t i = 0; i < SMALL_FILES; i++) {
+        snprintf(path, sizeof(path), "/s/%04u.cfg", i);
+        FileHandle file;
+        size_t bytes_read;
+        if (fs.open(file, path, OpenMode::READ) != FSResult::OK ||
+            fs.read(file, data.data(), data.size(), bytes_read) != FSResult::OK) {
+            return false;
+        }
+        fs.close(file);
+    }
+    run.small_read_s = timed.elapsed_us() / 1e6;
+    return true;
+}
+
+static bool run_stream(FileSys& fs, TimedDevice& timed, RunResult& run) {
+    std::vector<uint8_t> chunk(STREAM_CHUNK);
+    for (size_t i = 0; i < chunk.size(); i++) {
+        chunk[i] = static_cast<uint8_t>(i * 31);
+    }
+    
+    FileHandle file;
+    timed.reset();
+    if (fs.open(file, "/stream.bin", OpenMode::WRITE | OpenMode::CREATE | OpenMode::TRUNC) != FSResult::OK) {
+        return false;
+    }
+    for (uint32_t done = 0; done < STREAM_BYTES; done += STREAM_CHUNK) {
+        size_t written;
+        if (fs.write(file, chunk.data(), chunk.size(), written) != FSResult::OK) {
+            fs.close(file);
+            return false;
+        }
+    }
+    if (fs.close(file) != FSResult::OK) {
+        return false;
+    }
+    run.stream_write_s = timed.elapsed_us() / 1e6;
+    
+    timed.reset();
+    if (fs.open(file, "/stream.bin", OpenMode::READ) != FSResult::OK) {
+        return false;
+    }
+    size_t bytes_read;
+    while (fs.read(file, chunk.data(), chunk.size(), bytes_read) == FSResult::OK && bytes_read > 0) {
+    }
+    fs.close(file);
+    run.stream_read_s = timed.elapsed_us() / 1e6;
+    return true;
+}
+
+// Format a fresh image with config (geometry and tuning fields already set)
+// and run both workloads on it
+static RunResult run(const char* path, const Geometry& geometry, lfs_config_t& config) {
+    RunResult result = {};
+    unlink(path);
+    MmapBlockDevice device(geometry.block_size);
+    if (device.open(path, static_cast<uint64_t>(geometry.block_size) * geometry.block_count, true) != FSResult::OK) {
+        return result;
+    }
+    TimedDevice timed(device);
+    AsyncBlockAdapter adapter(timed, nullptr, 0);
+    adapter.attach(config);
+    
+    {
+        // A blank image is formatted by mount
+        FileSys fs(&config);
+        result.ok = fs.mount() == FSResult::OK && fs.mkdir("/s") == FSResult::OK &&
+                    run_small(fs, timed, result) && run_stream(fs, timed, result);
+        fs.unmount();
+    }
+    device.close();
+    return result;
+}
+
+static void base_config(lfs_config_t& config, const Geometry& geometry) {
+    memset(&config, 0, sizeof(config));
+    config.read_size = geometry.prog_size;
+    config.prog_size = geometry.prog_size;
+    config.block_size = geometry.block_size;
+    config.block_count = geometry.block_count;
+    config.block_cycles = 500;
+}
+
+static void report(const char* label, const lfs_config_t& config, const RunResult& result) {
+    uint32_t inline_max = 0;
+#if LFS_VERSION >= 0x00020009
+    inline_max = config.inline_max;
+#endif
+    char inline_text[16];
+    if (inline_max == static_cast<uint32_t>(-1)) {
+        snprintf(inline_text, sizeof(inline_text), "off");
+    } else if (inline_max == 0) {
+        snprintf(inline_text, sizeof(inline_text), "auto");
+    } else {
+        snprintf(inline_text, sizeof(inline_text), "%u", inline_max);
+    }
+    
+    if (!result.ok) {
+        printf("%-10s %6u %6s %5u %6u   failed\n", label, config.cache_size, inline_text,
+               config.lookahead_size, config.metadata_max);
+        return;
+    }
+    printf("%-10s %6u %6s %5u %6u   %8.1f %8.1f   %8.1f %8.1f\n", label, config.cache_size, inline_text,
+           config.lookahead_size, config.metadata_max,
+           SMALL_FILES / result.small_write_s, SMALL_FILES / result.small_read_s,
+           STREAM_BYTES / 1024.0 / result.stream_write_s, STREAM_BYTES / 1024.0 / result.stream_read_s);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <image-path> [block-size] [prog-size] [block-count]\n", argv[0]);
+        return 2;
+    }
+    const char* path = argv[1];
+    Geometry geometry;
+    geometry.block_size = argc > 2 ? static_cast<uint32_t>(strtoul(argv[2], nullptr, 0)) : 4096;
+    geometry.prog_size = argc > 3 ? static_cast<uint32_t>(strtoul(argv[3], nullptr, 0)) : 256;
+    geometry.block_count = argc > 4 ? static_cast<uint32_t>(strtoul(argv[4], nullptr, 0)) : 1024;
+    
+    printf("block %u, prog %u, %u blocks; small: %u files of 16..%u bytes; stream: %u KiB\n",
+           geometry.block_size, geometry.prog_size, geometry.block_count, SMALL_FILES, SMALL_MAX,
+           STREAM_BYTES / 1024);
+    printf("%-10s %6s %6s %5s %6s   %17s   %17s\n", "", "cache", "inline", "look", "meta",
+           "small files/s", "stream KiB/s");
+    printf("%-10s %6s %6s %5s %6s   %8s %8s   %8s %8s\n", "", "", "", "", "", "write", "read", "write", "read");
+    
+    // Sweep: every valid cache size, inline files on (littlefs default
+    // limit) and off, 16-byte lookahead, full-block metadata
+    lfs_config_t config;
+    for (uint32_t cache = geometry.prog_size; cache <= geometry.block_size && cache <= 8192; cache *= 2) {
+        if (geometry.block_size % cache != 0) {
+            continue;
+        }
+        for (int inline_files = 1; inline_files >= 0; inline_files--) {
+#if LFS_VERSION < 0x00020009
+            if (!inline_files) {
+                continue;
+            }
+#endif
+            base_config(config, geometry);
+            config.cache_size = cache;
+            config.lookahead_size = 16;
+#if LFS_VERSION >= 0x00020009
+            config.inline_max = inline_files ? 0 : static_cast<lfs_size_t>(-1);
+#endif
+            std::vector<uint8_t> read_buffer(cache), prog_buffer(cache);
+            std::vector<uint32_t> lookahead_buffer(config.lookahead_size / 4);
+            config.read_buffer = read_buffer.data();
+            config.prog_buffer = prog_buffer.data();
+            config.lookahead_buffer = lookahead_buffer.data();
+            report("sweep", config, run(path, geometry, config));
+        }
+    }
+    
+    // The profiles
+    static const struct {
+        const char* label;
+        LfsWorkload workload;
+    } profiles[] = {
+        { "small", LfsWorkload::SMALL_FILES },
+        { "streaming", LfsWorkload::STREAMING },
+    };
+    for (const auto& profile : profiles) {
+        base_config(config, geometry);
+        std::vector<uint32_t> buffers((FileSys::littlefs_buffer_size(config, profile.workload) + 3) / 4);
+        if (FileSys::tune_littlefs(config, profile.workload, reinterpret_cast<uint8_t*>(buffers.data()),
+                                   buffers.size() * 4) != FSResult::OK) {
+            fprintf(stderr, "lfstune: no %s profile for this geometry\n", profile.label);
+            return 1;
+        }
+        report(profile.label, config, run(path, geometry, config));
+    }
+    
+    unlink(path);
+    return 0;
+}
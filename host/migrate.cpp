@@ -0,0 +1,273 @@
+// Copy a tree from one LittleFS or FAT image into another.
+//
+// Usage: migrate [options] <source-image> <dest-image>
+//   --from lfs|fat        Source file system (default lfs)
+//   --to lfs|fat          Destination file system (default lfs)
+//   --block-size N        Erase block size of both images (default 4096)
+//   --block-count N       Create the destination with N blocks if it does not exist
+//   --prog-size N         LittleFS program/read size (default 256)
+//   --buffer N            Copy buffer bytes (default 32768)
+//   --source-root PATH    Directory to copy (default /)
+//   --dest-root PATH      Where to put it (default /)
+//   --no-verify           Skip the read-back check of each file
+//
+// The copy itself is migrate_tree. Afterwards both trees are walked by two
+// threads at once, one per image, and the per-file CRC-32 lists compared.
+// Only one side can be FAT, as HostDiskio serves a single drive.
+
+#include "MmapBlockDevice.h"
+#include "HostDiskio.h"
+#include "../Migrate.h"
+#include "../TreeWalker.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+using namespace EmbeddedFS;
+
+struct Options {
+    bool from_fat = false;
+    bool to_fat = false;
+    bool verify = true;
+    uint32_t block_size = 4096;
+    uint32_t block_count = 0;
+    uint32_t prog_size = 256;
+    uint32_t buffer = 32768;
+    const char* source_root = "/";
+    const char* dest_root = "/";
+    const char* source = nullptr;
+    const char* dest = nullptr;
+};
+
+// One mounted image with the storage its file system needs
+class Volume {
+public:
+    Volume(uint32_t block_size, uint32_t prog_size)
+        : device_(block_size), adapter_(device_, nullptr, 0),
+          read_buffer_(prog_size), prog_buffer_(prog_size), lookahead_buffer_(16), prog_size_(prog_size) {}
+    
+    ~Volume() {
+        if (fs_) {
+            fs_->unmount();
+        }
+        if (fat_) {
+            host_diskio_attach(nullptr);
+        }
+        device_.close();
+    }
+    
+    bool open(const char* path, bool fat, uint64_t create_size) {
+        struct stat st;
+        bool exists = stat(path, &st) == 0;
+        uint64_t size = exists ? static_cast<uint64_t>(st.st_size) : create_size;
+        if (size == 0 || device_.open(path, size, !exists) != FSResult::OK) {
+            fprintf(stderr, "migrate: cannot open %s\n", path);
+            return false;
+        }
+        
+        fat_ = fat;
+        if (fat) {
+            host_diskio_attach(&adapter_);
+            if (!exists) {
+                MKFS_PARM parm;
+                memset(&parm, 0, sizeof(parm));
+                parm.fmt = FM_FAT | FM_FAT32;
+                parm.align = device_.erase_size() / 512;
+                std::vector<uint8_t> work(FF_MAX_SS);
+                if (f_mkfs("0:", &parm, work.data(), static_cast<UINT>(work.size())) != FR_OK) {
+                    fprintf(stderr, "migrate: f_mkfs failed on %s\n", path);
+                    return false;
+                }
+            }
+            fs_.reset(new FileSys("0:"));
+        } else {
+            memset(&lfs_cfg_, 0, sizeof(lfs_cfg_));
+            adapter_.attach(lfs_cfg_);
+            lfs_cfg_.read_size = prog_size_;
+            lfs_cfg_.prog_size = prog_size_;
+            lfs_cfg_.block_size = device_.erase_size();
+            lfs_cfg_.block_count = static_cast<lfs_size_t>(size / device_.erase_size());
+            lfs_cfg_.block_cycles = 500;
+            lfs_cfg_.cache_size = prog_size_;
+            lfs_cfg_.lookahead_size = static_cast<lfs_size_t>(lookahead_buffer_.size());
+            lfs_cfg_.read_buffer = read_buffer_.data();
+            lfs_cfg_.prog_buffer = prog_buffer_.data();
+            lfs_cfg_.lookahead_buffer = lookahead_buffer_.data();
+            fs_.reset(new FileSys(&lfs_cfg_));
+        }
+        
+        if (fs_->mount() != FSResult::OK) {
+            fprintf(stderr, "migrate: cannot mount %s\n", path);
+            fs_.reset();
+            return false;
+        }
+        return true;
+    }
+    
+    FileSys& fs() { return *fs_; }
+
+private:
+    MmapBlockDevice device_;
+    AsyncBlockAdapter adapter_;
+    lfs_config_t lfs_cfg_;
+    std::vector<uint8_t> read_buffer_;
+    std::vector<uint8_t> prog_buffer_;
+    std::vector<uint8_t> lookahead_buffer_;
+    uint32_t prog_size_;
+    bool fat_ = false;
+    std::unique_ptr<FileSys> fs_;
+};
+
+// Relative path -> CRC-32 of every file under root (directories map to 0)
+struct Listing {
+    std::map<std::string, uint32_t> files;
+    FSResult result = FSResult::OK;
+};
+
+static void list_tree(FileSys& fs, const char* root, size_t buffer_size, Listing& listing) {
+    std::vector<uint8_t> buffer(buffer_size);
+    TreeWalker walker(fs);
+    FSResult result = walker.start(root);
+    
+    FileInfo info;
+    while (result == FSResult::OK && (result = walker.next(info)) == FSResult::OK && info.name[0] != '\0') {
+        uint32_t crc = 0;
+        if (!info.is_directory) {
+            FileHandle file;
+            result = fs.open(file, walker.path(), OpenMode::READ);
+            size_t bytes_read;
+            while (result == FSResult::OK &&
+                   (result = fs.read(file, buffer.data(), buffer.size(), bytes_read)) == FSResult::OK &&
+                   bytes_read > 0) {
+                crc = FileSys::crc32(crc, buffer.data(), bytes_read);
+            }
+            if (file.is_open) {
+                fs.close(file);
+            }
+        }
+        listing.files[walker.relative_path()] = crc;
+    }
+    listing.result = result;
+}
+
+static bool parse_options(int argc, char** argv, Options& options) {
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        
+        if (strcmp(arg, "--no-verify") == 0) {
+            options.verify = false;
+        } else if (arg[0] == '-' && arg[1] == '-') {
+            if (!value) {
+                return false;
+            }
+            i++;
+            uint32_t number = static_cast<uint32_t>(strtoul(value, nullptr, 0));
+            if (strcmp(arg, "--from") == 0 || strcmp(arg, "--to") == 0) {
+                if (strcmp(value, "fat") != 0 && strcmp(value, "lfs") != 0) {
+                    return false;
+                }
+                (arg[2] == 'f' ? options.from_fat : options.to_fat) = strcmp(value, "fat") == 0;
+            } else if (strcmp(arg, "--block-size") == 0) {
+                options.block_size = number;
+            } else if (strcmp(arg, "--block-count") == 0) {
+                options.block_count = number;
+            } else if (strcmp(arg, "--prog-size") == 0) {
+                options.prog_size = number;
+            } else if (strcmp(arg, "--buffer") == 0) {
+                options.buffer = number;
+            } else if (strcmp(arg, "--source-root") == 0) {
+                options.source_root = value;
+            } else if (strcmp(arg, "--dest-root") == 0) {
+                options.dest_root = value;
+            } else {
+                return false;
+            }
+        } else if (positional == 0) {
+            options.source = arg;
+            positional++;
+        } else if (positional == 1) {
+            options.dest = arg;
+            positional++;
+        } else {
+            return false;
+        }
+    }
+    return options.source && options.dest && options.block_size != 0 && options.buffer != 0 &&
+           !(options.from_fat && options.to_fat);
+}
+
+static uint32_t host_tick_ms(void*) {
+    using namespace std::chrono;
+    return static_cast<uint32_t>(duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        fprintf(stderr, "usage: %s [--from lfs|fat] [--to lfs|fat] [--block-size N] [--block-count N]\n"
+                        "       [--prog-size N] [--buffer N] [--source-root P] [--dest-root P] [--no-verify]\n"
+                        "       <source-image> <dest-image>\n"
+                        "(at most one side may be fat)\n",
+                argv[0]);
+        return 2;
+    }
+    
+    Volume source(options.block_size, options.prog_size);
+    Volume dest(options.block_size, options.prog_size);
+    uint64_t create_size = static_cast<uint64_t>(options.block_size) * options.block_count;
+    if (!source.open(options.source, options.from_fat, 0) || !dest.open(options.dest, options.to_fat, create_size)) {
+        return 1;
+    }
+    
+    std::vector<uint8_t> buffer(options.buffer);
+    MigrateOptions migrate_options;
+    migrate_options.buffer = buffer.data();
+    migrate_options.buffer_size = buffer.size();
+    migrate_options.verify = options.verify;
+    migrate_options.tick_ms = host_tick_ms;
+    
+    MigrateStats stats;
+    FSResult result = migrate_tree(source.fs(), options.source_root, dest.fs(), options.dest_root,
+                                   migrate_options, stats);
+    printf("migrate: %u files, %u directories, %llu bytes in %u ms (%.1f MiB/s), %u times kept\n",
+           stats.files, stats.directories, static_cast<unsigned long long>(stats.bytes), stats.elapsed_ms,
+           stats.bytes_per_second() / 1048576.0, stats.times_preserved);
+    if (result != FSResult::OK) {
+        fprintf(stderr, "migrate: failed with error %d\n", static_cast<int>(result));
+        return 1;
+    }
+    if (!options.verify) {
+        return 0;
+    }
+    
+    // The two images are independent, so both trees can be read at once
+    Listing source_listing, dest_listing;
+    std::thread source_thread(list_tree, std::ref(source.fs()), options.source_root, buffer.size(),
+                              std::ref(source_listing));
+    list_tree(dest.fs(), options.dest_root, buffer.size(), dest_listing);
+    source_thread.join();
+    
+    if (source_listing.result != FSResult::OK || dest_listing.result != FSResult::OK) {
+        fprintf(stderr, "migrate: verification walk failed\n");
+        return 1;
+    }
+    uint32_t mismatches = 0;
+    for (const auto& entry : source_listing.files) {
+        auto it = dest_listing.files.find(entry.first);
+        if (it == dest_listing.files.end() || it->second != entry.second) {
+            fprintf(stderr, "migrate: %s differs\n", entry.first.c_str());
+            mismatches++;
+        }
+    }
+    printf("migrate: verified %zu entries, %u mismatched\n", source_listing.files.size(), mismatches);
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,362 @@
+// Pack a host directory tree into a LittleFS or FAT image.
+//
+// Usage: mkimage [options] <source-dir> <image>
+//   --type lfs|fat        File system (default lfs)
+//   --block-size N        Erase block size in bytes (default 4096)
+//   --block-count N       Number of erase blocks (required)
+//   --prog-size N         LittleFS program/read size (default 256)
+//   --cache-size N        LittleFS cache size (default prog size)
+//   --lookahead N         LittleFS lookahead bytes (default 16)
+//   --fat32               Force FAT32 (default: FatFS picks by size)
+//   --jobs N              Reader threads (default 4)
+//   --epoch SECONDS       Timestamp for FAT entries (default SOURCE_DATE_EPOCH, else 1980-01-01)
+//
+// Input files are read by a pool of threads a bounded window ahead of the
+// single writer, which adds them through FileSys in sorted path order.
+// With the same input and options the image is byte-identical every run:
+// the walk is sorted, time comes from --epoch, and the image starts erased.
+
+#include "MmapBlockDevice.h"
+#include "HostDiskio.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace EmbeddedFS;
+
+struct Options {
+    bool fat = false;
+    bool fat32 = false;
+    uint32_t block_size = 4096;
+    uint32_t block_count = 0;
+    uint32_t prog_size = 256;
+    uint32_t cache_size = 0;
+    uint32_t lookahead = 16;
+    uint32_t jobs = 4;
+    uint32_t epoch = 0;
+    const char* source = nullptr;
+    const char* image = nullptr;
+};
+
+struct Entry {
+    std::string path;               // Relative to the source, starting with '/'
+    bool is_directory;
+    std::vector<uint8_t> data;
+    bool loaded;
+    bool failed;
+};
+
+// Collect the tree below dir; symlinks and special files are skipped.
+// (std::filesystem rather than <dirent.h>, whose DIR clashes with FatFS.)
+static bool walk(const std::string& root, const std::string& relative, std::vector<Entry>& entries) {
+    std::error_code error;
+    std::vector<std::string> names;
+    for (std::filesystem::directory_iterator it(root + relative, error), end; !error && it != end; it.increment(error)) {
+        names.push_back(it->path().filename().string());
+    }
+    if (error) {
+        fprintf(stderr, "mkimage: cannot read %s%s\n", root.c_str(), relative.c_str());
+        return false;
+    }
+    std::sort(names.begin(), names.end());
+    
+    for (const std::string& name : names) {
+        std::string path = relative + "/" + name;
+        std::filesystem::file_status status = std::filesystem::symlink_status(root + path, error);
+        if (error) {
+            return false;
+        }
+        if (std::filesystem::is_directory(status)) {
+            entries.push_back(Entry{path, true, {}, true, false});
+            if (!walk(root, path, entries)) {
+                return false;
+            }
+        } else if (std::filesystem::is_regular_file(status)) {
+            entries.push_back(Entry{path, false, {}, false, false});
+        }
+    }
+    return true;
+}
+
+static bool read_file(const std::string& path, std::vector<uint8_t>& data) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    uint8_t chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+// Readers fill entries at most `window` ahead of the writer; the writer
+// consumes them in order and frees each one once written
+class Loader {
+public:
+    Loader(const std::string& root, std::vector<Entry>& entries, size_t window)
+        : root_(root), entries_(entries), window_(window), next_read_(0), next_write_(0) {}
+    
+    void start(uint32_t jobs) {
+        for (uint32_t i = 0; i < jobs; i++) {
+            threads_.emplace_back(&Loader::run, this);
+        }
+    }
+    
+    void join() {
+        for (std::thread& thread : threads_) {
+            thread.join();
+        }
+    }
+    
+    // Block until entry index is loaded
+    Entry& get(size_t index) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return entries_[index].loaded; });
+        return entries_[index];
+    }
+    
+    void release(size_t index) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<uint8_t>().swap(entries_[index].data);
+        next_write_ = index + 1;
+        cv_.notify_all();
+    }
+
+private:
+    void run() {
+        for (;;) {
+            size_t index;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [&] { return next_read_ >= entries_.size() || next_read_ < next_write_ + window_; });
+                if (next_read_ >= entries_.size()) {
+                    return;
+                }
+                index = next_read_++;
+            }
+            
+            Entry& entry = entries_[index];
+            std::vector<uint8_t> data;
+            bool ok = entry.is_directory || read_file(root_ + entry.path, data);
+            
+            std::lock_guard<std::mutex> lock(mutex_);
+            entry.data.swap(data);
+            entry.failed = !ok;
+            entry.loaded = true;
+            cv_.notify_all();
+        }
+    }
+    
+    const std::string& root_;
+    std::vector<Entry>& entries_;
+    size_t window_;
+    size_t next_read_;
+    size_t next_write_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<std::thread> threads_;
+};
+
+static bool parse_options(int argc, char** argv, Options& options) {
+    const char* epoch = getenv("SOURCE_DATE_EPOCH");
+    if (epoch) {
+        options.epoch = static_cast<uint32_t>(strtoul(epoch, nullptr, 0));
+    }
+    
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        
+        if (strcmp(arg, "--fat32") == 0) {
+            options.fat32 = true;
+            options.fat = true;
+        } else if (arg[0] == '-' && arg[1] == '-') {
+            if (!value) {
+                return false;
+            }
+            i++;
+            uint32_t number = static_cast<uint32_t>(strtoul(value, nullptr, 0));
+            if (strcmp(arg, "--type") == 0) {
+                if (strcmp(value, "fat") != 0 && strcmp(value, "lfs") != 0) {
+                    return false;
+                }
+                options.fat = strcmp(value, "fat") == 0;
+            } else if (strcmp(arg, "--block-size") == 0) {
+                options.block_size = number;
+            } else if (strcmp(arg, "--block-count") == 0) {
+                options.block_count = number;
+            } else if (strcmp(arg, "--prog-size") == 0) {
+                options.prog_size = number;
+            } else if (strcmp(arg, "--cache-size") == 0) {
+                options.cache_size = number;
+            } else if (strcmp(arg, "--lookahead") == 0) {
+                options.lookahead = number;
+            } else if (strcmp(arg, "--jobs") == 0) {
+                options.jobs = number ? number : 1;
+            } else if (strcmp(arg, "--epoch") == 0) {
+                options.epoch = number;
+            } else {
+                return false;
+            }
+        } else if (positional == 0) {
+            options.source = arg;
+            positional++;
+        } else if (positional == 1) {
+            options.image = arg;
+            positional++;
+        } else {
+            return false;
+        }
+    }
+    
+    if (options.cache_size == 0) {
+        options.cache_size = options.prog_size;
+    }
+    return options.source && options.image && options.block_count != 0 && options.block_size != 0;
+}
+
+// Add every entry through fs in order
+static bool populate(FileSys& fs, Loader& loader, std::vector<Entry>& entries) {
+    for (size_t i = 0; i < entries.size(); i++) {
+        Entry& entry = loader.get(i);
+        if (entry.failed) {
+            fprintf(stderr, "mkimage: cannot read %s\n", entry.path.c_str());
+            return false;
+        }
+        
+        FSResult result;
+        if (entry.is_directory) {
+            result = fs.mkdir_p(entry.path.c_str());
+        } else {
+            FileHandle file;
+            result = fs.open(file, entry.path.c_str(), OpenMode::WRITE | OpenMode::CREATE | OpenMode::TRUNC);
+            if (result == FSResult::OK) {
+                size_t written = 0;
+                if (!entry.data.empty()) {
+                    result = fs.write(file, entry.data.data(), entry.data.size(), written);
+                }
+                if (result == FSResult::OK && written != entry.data.size()) {
+                    result = FSResult::ERROR_NO_SPC;
+                }
+                FSResult close_result = fs.close(file);
+                if (result == FSResult::OK) {
+                    result = close_result;
+                }
+            }
+        }
+        
+        if (result != FSResult::OK) {
+            fprintf(stderr, "mkimage: %s: error %d\n", entry.path.c_str(), static_cast<int>(result));
+            return false;
+        }
+        loader.release(i);
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        fprintf(stderr, "usage: %s [--type lfs|fat] [--block-size N] --block-count N [--prog-size N]\n"
+                        "       [--cache-size N] [--lookahead N] [--fat32] [--jobs N] [--epoch S] <source-dir> <image>\n",
+                argv[0]);
+        return 2;
+    }
+    
+    std::string root = options.source;
+    while (root.size() > 1 && root.back() == '/') {
+        root.pop_back();
+    }
+    std::vector<Entry> entries;
+    if (!walk(root, "", entries)) {
+        return 1;
+    }
+    
+    MmapBlockDevice device(options.block_size);
+    uint64_t size = static_cast<uint64_t>(options.block_size) * options.block_count;
+    if (device.open(options.image, size, true) != FSResult::OK) {
+        fprintf(stderr, "mkimage: cannot create %s\n", options.image);
+        return 1;
+    }
+    AsyncBlockAdapter adapter(device, nullptr, 0);
+    
+    // Storage LittleFS needs for the lifetime of the file system
+    lfs_config_t lfs_cfg;
+    memset(&lfs_cfg, 0, sizeof(lfs_cfg));
+    std::vector<uint8_t> read_buffer(options.cache_size);
+    std::vector<uint8_t> prog_buffer(options.cache_size);
+    std::vector<uint8_t> lookahead_buffer(options.lookahead);
+    
+    std::unique_ptr<FileSys> fs;
+    if (options.fat) {
+        host_diskio_attach(&adapter);
+        host_diskio_set_time(options.epoch);
+        
+        MKFS_PARM parm;
+        memset(&parm, 0, sizeof(parm));
+        parm.fmt = options.fat32 ? FM_FAT32 : (FM_FAT | FM_FAT32);
+        parm.align = options.block_size / 512;
+        std::vector<uint8_t> work(FF_MAX_SS);
+        if (f_mkfs("0:", &parm, work.data(), static_cast<UINT>(work.size())) != FR_OK) {
+            fprintf(stderr, "mkimage: f_mkfs failed\n");
+            return 1;
+        }
+        fs.reset(new FileSys("0:"));
+    } else {
+        adapter.attach(lfs_cfg);
+        lfs_cfg.read_size = options.prog_size;
+        lfs_cfg.prog_size = options.prog_size;
+        lfs_cfg.block_size = options.block_size;
+        lfs_cfg.block_count = options.block_count;
+        lfs_cfg.block_cycles = 500;
+        lfs_cfg.cache_size = options.cache_size;
+        lfs_cfg.lookahead_size = options.lookahead;
+        lfs_cfg.read_buffer = read_buffer.data();
+        lfs_cfg.prog_buffer = prog_buffer.data();
+        lfs_cfg.lookahead_buffer = lookahead_buffer.data();
+        fs.reset(new FileSys(&lfs_cfg));
+    }
+    
+    // A blank image is formatted by the LittleFS mount
+    if (fs->mount() != FSResult::OK) {
+        fprintf(stderr, "mkimage: mount failed\n");
+        return 1;
+    }
+    
+    Loader loader(root, entries, options.jobs * 4);
+    loader.start(options.jobs);
+    bool ok = populate(*fs, loader, entries);
+    if (!ok) {
+        // Let the readers run out so they can be joined
+        for (size_t i = 0; i < entries.size(); i++) {
+            loader.get(i);
+            loader.release(i);
+        }
+    }
+    loader.join();
+    
+    if (fs->unmount() != FSResult::OK) {
+        ok = false;
+    }
+    host_diskio_attach(nullptr);
+    device.close();
+    
+    if (ok) {
+        printf("mkimage: %zu entries -> %s (%llu bytes)\n", entries.size(), options.image,
+               static_cast<unsigned long long>(size));
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,187 @@
+// Space and lookup time of many small blobs kept as individual files
+// versus one PackFile, on a fresh LittleFS or FAT image.
+//
+// Usage: packbench <image-path> [lfs|fat] [files] [blob-size] [lookups]
+//
+// The blobs go into /cal as one file each, then PackFile::build packs that
+// directory into /cal.pack. Space is the drop in free space each step
+// causes; lookups fetch random keys, by open/read/close of the file and by
+// PackFile::get on one open pack.
+
+#include "MmapBlockDevice.h"
+#include "HostDiskio.h"
+#include "../Pack.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <unistd.h>
+#include <vector>
+
+using namespace EmbeddedFS;
+
+static constexpr uint32_t BLOCK_SIZE = 4096;
+static constexpr uint32_t PROG_SIZE = 256;
+static constexpr uint64_t IMAGE_SIZE = 64ull << 20;
+
+static double elapsed_us(std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+static uint64_t free_space(FileSys& fs) {
+    uint64_t free_bytes = 0;
+    fs.get_free_space(free_bytes);
+    return free_bytes;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <image-path> [lfs|fat] [files] [blob-size] [lookups]\n", argv[0]);
+        return 2;
+    }
+    const char* path = argv[1];
+    bool fat = argc > 2 && strcmp(argv[2], "fat") == 0;
+    uint32_t files = argc > 3 ? static_cast<uint32_t>(strtoul(argv[3], nullptr, 0)) : 2000;
+    uint32_t blob_size = argc > 4 ? static_cast<uint32_t>(strtoul(argv[4], nullptr, 0)) : 64;
+    uint32_t lookups = argc > 5 ? static_cast<uint32_t>(strtoul(argv[5], nullptr, 0)) : 10000;
+    
+    unlink(path);
+    MmapBlockDevice device(BLOCK_SIZE);
+    if (device.open(path, IMAGE_SIZE, true) != FSResult::OK) {
+        fprintf(stderr, "packbench: cannot create %s\n", path);
+        return 1;
+    }
+    AsyncBlockAdapter adapter(device, nullptr, 0);
+    
+    lfs_config_t lfs_cfg;
+    std::vector<uint8_t> read_buffer(PROG_SIZE), prog_buffer(PROG_SIZE), lookahead_buffer(16);
+    std::vector<uint8_t> work(FF_MAX_SS);
+    if (fat) {
+        host_diskio_attach(&adapter);
+        MKFS_PARM parm;
+        memset(&parm, 0, sizeof(parm));
+        parm.fmt = FM_FAT | FM_FAT32;
+        parm.align = BLOCK_SIZE / 512;
+        if (f_mkfs("0:", &parm, work.data(), static_cast<UINT>(work.size())) != FR_OK) {
+            fprintf(stderr, "packbench: f_mkfs failed\n");
+            return 1;
+        }
+    } else {
+        memset(&lfs_cfg, 0, sizeof(lfs_cfg));
+        adapter.attach(lfs_cfg);
+        lfs_cfg.read_size = PROG_SIZE;
+        lfs_cfg.prog_size = PROG_SIZE;
+        lfs_cfg.block_size = BLOCK_SIZE;
+        lfs_cfg.block_count = static_cast<lfs_size_t>(IMAGE_SIZE / BLOCK_SIZE);
+        lfs_cfg.block_cycles = 500;
+        lfs_cfg.cache_size = PROG_SIZE;
+        lfs_cfg.lookahead_size = static_cast<lfs_size_t>(lookahead_buffer.size());
+        lfs_cfg.read_buffer = read_buffer.data();
+        lfs_cfg.prog_buffer = prog_buffer.data();
+        lfs_cfg.lookahead_buffer = lookahead_buffer.data();
+    }
+    
+    // A blank LittleFS image is formatted by mount
+    std::unique_ptr<FileSys> volume(fat ? new FileSys("0:") : new FileSys(&lfs_cfg));
+    FileSys& fs = *volume;
+    if (fs.mount() != FSResult::OK || fs.mkdir("/cal") != FSResult::OK) {
+        fprintf(stderr, "packbench: cannot mount %s\n", path);
+        return 1;
+    }
+    
+    // Calibration-style blobs keyed by device ID
+    std::mt19937 random(1);
+    std::vector<uint8_t> blob(blob_size);
+    char key[PACK_KEY_LENGTH];
+    char file_path[MAX_PATH_LENGTH];
+    uint64_t free_before = free_space(fs);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < files; i++) {
+        for (uint8_t& byte : blob) {
+            byte = static_cast<uint8_t>(random());
+        }
+        snprintf(key, sizeof(key), "dev-%06u", i);
+        FileSys::join_path(file_path, sizeof(file_path), "/cal", key);
+        
+        FileHandle file;
+        size_t written;
+        if (fs.open(file, file_path, OpenMode::WRITE | OpenMode::CREATE | OpenMode::TRUNC) != FSResult::OK ||
+            fs.write(file, blob.data(), blob.size(), written) != FSResult::OK || fs.close(file) != FSResult::OK) {
+            fprintf(stderr, "packbench: cannot write %s\n", file_path);
+            return 1;
+        }
+    }
+    double write_us = elapsed_us(start);
+    uint64_t files_space = free_before - free_space(fs);
+    
+    std::vector<PackEntry> scratch(files);
+    std::vector<uint8_t> buffer(4096);
+    PackStats stats;
+    free_before = free_space(fs);
+    start = std::chrono::steady_clock::now();
+    FSResult result = PackFile::build(fs, "/cal", "/cal.pack", scratch.data(), scratch.size(),
+                                      buffer.data(), buffer.size(), stats);
+    double build_us = elapsed_us(start);
+    uint64_t pack_space = free_before - free_space(fs);
+    if (result != FSResult::OK || stats.entries != files) {
+        fprintf(stderr, "packbench: build failed with error %d\n", static_cast<int>(result));
+        return 1;
+    }
+    
+    // Same random keys for both lookups
+    std::vector<uint32_t> order(lookups);
+    for (uint32_t& id : order) {
+        id = static_cast<uint32_t>(random() % files);
+    }
+    
+    start = std::chrono::steady_clock::now();
+    for (uint32_t id : order) {
+        snprintf(key, sizeof(key), "dev-%06u", id);
+        FileSys::join_path(file_path, sizeof(file_path), "/cal", key);
+        FileHandle file;
+        size_t bytes_read;
+        if (fs.open(file, file_path, OpenMode::READ) != FSResult::OK ||
+            fs.read(file, buffer.data(), buffer.size(), bytes_read) != FSResult::OK || bytes_read != blob_size) {
+            fprintf(stderr, "packbench: cannot read %s\n", file_path);
+            return 1;
+        }
+        fs.close(file);
+    }
+    double files_us = elapsed_us(start);
+    
+    PackFile pack(fs, "/cal.pack");
+    if (pack.open(false) != FSResult::OK) {
+        fprintf(stderr, "packbench: cannot open /cal.pack\n");
+        return 1;
+    }
+    start = std::chrono::steady_clock::now();
+    for (uint32_t id : order) {
+        snprintf(key, sizeof(key), "dev-%06u", id);
+        size_t size;
+        if (pack.get(key, buffer.data(), buffer.size(), size) != FSResult::OK || size != blob_size) {
+            fprintf(stderr, "packbench: cannot get %s\n", key);
+            return 1;
+        }
+    }
+    double pack_us = elapsed_us(start);
+    pack.close();
+    fs.unmount();
+    if (fat) {
+        host_diskio_attach(nullptr);
+    }
+    device.close();
+    
+    printf("%s: %u blobs of %u bytes, %u lookups\n", fat ? "fat" : "lfs", files, blob_size, lookups);
+    printf("individual files  %9llu bytes  %6.1f bytes/blob  write %8.0f us  lookup %7.2f us\n",
+           static_cast<unsigned long long>(files_space), static_cast<double>(files_space) / files,
+           write_us, files_us / lookups);
+    printf("pack              %9llu bytes  %6.1f bytes/blob  build %8.0f us  lookup %7.2f us  (%u passes)\n",
+           static_cast<unsigned long long>(pack_space), static_cast<double>(pack_space) / files,
+           build_us, pack_us / lookups, stats.passes);
+    printf("saving            %9.1fx space  %6.1fx lookup time\n",
+           pack_space ? static_cast<double>(files_space) / pack_space : 0.0, pack_us > 0 ? files_us / pack_us : 0.0);
+    return 0;
+}
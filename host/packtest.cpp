@@ -0,0 +1,233 @@
+// PackFile test on a fresh LittleFS or FAT image: build from a directory
+// with a scratch table smaller than the directory, lookups, put (new and
+// replaced keys, reopened after each), compact, and CRC failures of a
+// blob, the footer and the index.
+//
+// Usage: packtest <image-path> [lfs|fat]
+//
+// Exit status is 0 if every check passed.
+
+#include "MmapBlockDevice.h"
+#include "HostDiskio.h"
+#include "../Pack.h"
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace EmbeddedFS;
+
+static constexpr uint32_t BLOCK_SIZE = 4096;
+static constexpr uint32_t PROG_SIZE = 256;
+static constexpr uint64_t IMAGE_SIZE = 16ull << 20;
+static constexpr uint32_t FILES = 300;
+
+static uint32_t failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// Content of the blob stored under key number id
+static std::string blob_for(uint32_t id) {
+    return std::string(10 + id % 50, static_cast<char>('a' + id % 26));
+}
+
+static bool write_file(FileSys& fs, const char* path, const void* data, size_t size) {
+    FileHandle file;
+    size_t written;
+    return fs.open(file, path, OpenMode::WRITE | OpenMode::CREATE | OpenMode::TRUNC) == FSResult::OK &&
+           fs.write(file, data, size, written) == FSResult::OK && written == size && fs.close(file) == FSResult::OK;
+}
+
+// Invert one byte of a file in place
+static bool flip_byte(FileSys& fs, const char* path, uint32_t offset) {
+    FileHandle file;
+    uint8_t byte;
+    size_t done;
+    bool ok = fs.open(file, path, OpenMode::READ | OpenMode::WRITE) == FSResult::OK &&
+              fs.seek(file, static_cast<int32_t>(offset), SeekOrigin::SET) == FSResult::OK &&
+              fs.read(file, &byte, 1, done) == FSResult::OK && done == 1;
+    byte ^= 0xFF;
+    ok = ok && fs.seek(file, static_cast<int32_t>(offset), SeekOrigin::SET) == FSResult::OK &&
+         fs.write(file, &byte, 1, done) == FSResult::OK && done == 1;
+    return fs.close(file) == FSResult::OK && ok;
+}
+
+static bool matches(PackFile& pack, const char* key, const std::string& expected) {
+    uint8_t buffer[128];
+    size_t size;
+    return pack.get(key, buffer, sizeof(buffer), size) == FSResult::OK && size == expected.size() &&
+           memcmp(buffer, expected.data(), size) == 0;
+}
+
+static void test_pack(FileSys& fs) {
+    char key[PACK_KEY_LENGTH];
+    char path[MAX_PATH_LENGTH];
+    
+    // Keys out of order on disk, plus one name too long to be a key
+    check(fs.mkdir("/cal") == FSResult::OK, "mkdir /cal");
+    for (uint32_t i = 0; i < FILES; i++) {
+        snprintf(key, sizeof(key), "dev-%05u", (i * 7919) % 1000);
+        FileSys::join_path(path, sizeof(path), "/cal", key);
+        std::string blob = blob_for(i);
+        check(write_file(fs, path, blob.data(), blob.size()), "write source file");
+    }
+    static const char long_name[] = "/cal/this-name-is-far-too-long-for-a-key";
+    check(write_file(fs, long_name, "x", 1), "write long-named file");
+    
+    // A scratch table of 37 keys takes several passes; a 16-byte buffer
+    // splits every blob copy
+    PackEntry scratch[37];
+    uint8_t buffer[16];
+    PackStats stats;
+    check(PackFile::build(fs, "/cal", "/cal.pack", scratch, 37, buffer, sizeof(buffer), stats) == FSResult::OK,
+          "build");
+    check(stats.entries == FILES && stats.skipped == 1 && stats.passes > 3, "build stats");
+    
+    PackFile pack(fs, "/cal.pack");
+    check(pack.open(true) == FSResult::OK && pack.count() == FILES, "open built pack");
+    PackEntry entry;
+    PackEntry previous;
+    for (uint32_t i = 0; i < pack.count(); i++) {
+        check(pack.entry(i, entry) == FSResult::OK && (i == 0 || strcmp(previous.key, entry.key) < 0),
+              "index in key order");
+        previous = entry;
+    }
+    for (uint32_t i = 0; i < FILES; i++) {
+        snprintf(key, sizeof(key), "dev-%05u", (i * 7919) % 1000);
+        check(matches(pack, key, blob_for(i)), "get built blob");
+    }
+    uint8_t small[2];
+    size_t size;
+    check(pack.get("dev-99999", small, sizeof(small), size) == FSResult::ERROR_NO_ENT, "get missing key");
+    check(pack.get("dev-00000", small, sizeof(small), size) == FSResult::ERROR_NO_MEM && size == blob_for(0).size(),
+          "get into short buffer");
+    
+    // Each put must leave a pack that opens: the appended index and footer
+    // committed with the file size
+    static const struct {
+        const char* key;
+        const char* data;
+    } updates[] = {
+        { "aaa", "hello" },
+        { "zzz", "world!" },
+        { "dev-00919", "replaced" },
+    };
+    uint32_t expected_count = FILES;
+    for (const auto& put : updates) {
+        bool replacing = pack.get(put.key, small, 0, size) != FSResult::ERROR_NO_ENT;
+        check(pack.put(put.key, put.data, strlen(put.data)) == FSResult::OK, "put");
+        expected_count += replacing ? 0 : 1;
+        pack.close();
+        check(pack.open(true) == FSResult::OK && pack.count() == expected_count, "reopen after put");
+        check(matches(pack, put.key, put.data), "get put blob");
+    }
+    check(pack.dead_bytes() > 0, "put leaves dead space");
+    pack.close();
+    
+    check(PackFile::compact(fs, "/cal.pack", buffer, 7, stats) == FSResult::OK &&
+          stats.entries == expected_count && stats.reclaimed > 0, "compact");
+    check(pack.open(false) == FSResult::OK && pack.count() == expected_count && pack.dead_bytes() == 0,
+          "open compacted pack");
+    for (const auto& put : updates) {
+        check(matches(pack, put.key, put.data), "get after compact");
+    }
+    pack.close();
+    
+    // A new pack started by put
+    PackFile fresh(fs, "/new.pack");
+    check(fresh.open(true) == FSResult::OK && fresh.count() == 0, "create empty pack");
+    check(fresh.put("k", "abc", 3) == FSResult::OK, "put into new pack");
+    fresh.close();
+    check(fresh.open(false) == FSResult::OK && fresh.count() == 1 && matches(fresh, "k", "abc"), "reopen new pack");
+    fresh.close();
+    
+    // After compact "aaa" is the first blob: damage it, then the index
+    check(flip_byte(fs, "/cal.pack", PACK_HEADER_SIZE), "damage first blob");
+    check(pack.open(false) == FSResult::OK, "open with damaged blob");
+    check(pack.get("aaa", buffer, sizeof(buffer), size) == FSResult::ERROR_CORRUPT, "damaged blob fails its CRC");
+    check(matches(pack, "zzz", "world!"), "other blobs unaffected");
+    pack.close();
+    
+    uint32_t pack_size = 0;
+    FileHandle file;
+    if (fs.open(file, "/cal.pack", OpenMode::READ) == FSResult::OK) {
+        fs.file_size(file, pack_size);
+        fs.close(file);
+    }
+    check(flip_byte(fs, "/cal.pack", pack_size - 10), "damage footer");
+    check(pack.open(false) == FSResult::ERROR_CORRUPT, "damaged footer fails open");
+    check(flip_byte(fs, "/cal.pack", pack_size - 10), "restore footer");
+    check(pack.open(false) == FSResult::OK, "open with restored footer");
+    pack.close();
+    check(flip_byte(fs, "/cal.pack", pack_size - PACK_FOOTER_SIZE - 10), "damage index");
+    check(pack.open(false) == FSResult::ERROR_CORRUPT, "damaged index fails open");
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <image-path> [lfs|fat]\n", argv[0]);
+        return 2;
+    }
+    const char* path = argv[1];
+    bool fat = argc > 2 && strcmp(argv[2], "fat") == 0;
+    
+    unlink(path);
+    MmapBlockDevice device(BLOCK_SIZE);
+    if (device.open(path, IMAGE_SIZE, true) != FSResult::OK) {
+        fprintf(stderr, "packtest: cannot create %s\n", path);
+        return 2;
+    }
+    AsyncBlockAdapter adapter(device, nullptr, 0);
+    
+    lfs_config_t lfs_cfg;
+    std::vector<uint8_t> read_buffer(PROG_SIZE), prog_buffer(PROG_SIZE), lookahead_buffer(16);
+    std::vector<uint8_t> work(FF_MAX_SS);
+    if (fat) {
+        host_diskio_attach(&adapter);
+        MKFS_PARM parm;
+        memset(&parm, 0, sizeof(parm));
+        parm.fmt = FM_FAT | FM_FAT32;
+        parm.align = BLOCK_SIZE / 512;
+        if (f_mkfs("0:", &parm, work.data(), static_cast<UINT>(work.size())) != FR_OK) {
+            fprintf(stderr, "packtest: f_mkfs failed\n");
+            return 2;
+        }
+    } else {
+        memset(&lfs_cfg, 0, sizeof(lfs_cfg));
+        adapter.attach(lfs_cfg);
+        lfs_cfg.read_size = PROG_SIZE;
+        lfs_cfg.prog_size = PROG_SIZE;
+        lfs_cfg.block_size = BLOCK_SIZE;
+        lfs_cfg.block_count = static_cast<lfs_size_t>(IMAGE_SIZE / BLOCK_SIZE);
+        lfs_cfg.block_cycles = 500;
+        lfs_cfg.cache_size = PROG_SIZE;
+        lfs_cfg.lookahead_size = static_cast<lfs_size_t>(lookahead_buffer.size());
+        lfs_cfg.read_buffer = read_buffer.data();
+        lfs_cfg.prog_buffer = prog_buffer.data();
+        lfs_cfg.lookahead_buffer = lookahead_buffer.data();
+    }
+    
+    // A blank LittleFS image is formatted by mount
+    std::unique_ptr<FileSys> volume(fat ? new FileSys("0:") : new FileSys(&lfs_cfg));
+    if (volume->mount() != FSResult::OK) {
+        fprintf(stderr, "packtest: cannot mount %s\n", path);
+        return 2;
+    }
+    test_pack(*volume);
+    volume->unmount();
+    if (fat) {
+        host_diskio_attach(nullptr);
+    }
+    device.close();
+    unlink(path);
+    
+    printf("%s: %s\n", fat ? "fat" : "lfs", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,286 @@
+// Power-loss test of FileSys::atomic_replace on FAT.
+//
+// Usage: powerloss <image-path>
+//
+// One replacement is cut off after every possible number of device
+// writes in turn: later writes are dropped, as by a device that lost
+// power, and the image is remounted as after a reset. The file must then
+// hold the whole old or the whole new content. The temp file is removed
+// the way remove_tree would and the freed space is filled with other data,
+// which corrupts the file if its entry shared a chain with the temp; a
+// further replacement must succeed. Clusters no entry owns afterwards are
+// reported as stranded.
+//
+// Runs twice: with the temp entry in the same directory sector as the
+// file, and in a later sector. Exit status is 0 if every cut passed.
+
+#include "MmapBlockDevice.h"
+#include "HostDiskio.h"
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <vector>
+
+using namespace EmbeddedFS;
+
+static constexpr uint32_t BLOCK_SIZE = 4096;
+static constexpr uint64_t IMAGE_SIZE = 4ull << 20;     // FAT16 with 512-byte clusters
+static constexpr size_t CONTENT_SIZE = 3000;            // Six clusters
+static constexpr size_t FILL_SIZE = 64 * 1024;
+static constexpr uint32_t UNLIMITED = 0xFFFFFFFFu;
+
+// Forwards requests to the image until the write budget is spent, then
+// acknowledges programs and erases without storing them
+class CutDevice : public IAsyncBlockDevice {
+public:
+    explicit CutDevice(MmapBlockDevice& device) : device_(device), writes_(0), budget_(UNLIMITED) {}
+    
+    FSResult submit(BlockRequest& request) override {
+        if (request.op == BlockOp::PROGRAM || request.op == BlockOp::ERASE) {
+            if (writes_ >= budget_) {
+                request.status = FSResult::OK;
+                return FSResult::OK;
+            }
+            writes_++;
+        }
+        return device_.submit(request);
+    }
+    
+    uint32_t erase_size() const override { return device_.erase_size(); }
+    uint64_t capacity() const override { return device_.capacity(); }
+    
+    void cut_after(uint32_t writes) {
+        writes_ = 0;
+        budget_ = writes;
+    }
+    bool cut() const { return writes_ >= budget_; }
+
+private:
+    MmapBlockDevice& device_;
+    uint32_t writes_;
+    uint32_t budget_;
+};
+
+struct Scenario {
+    const char* name;
+    const char* dir;
+    uint32_t fillers;               // Files created after the target, pushing the temp entry on
+};
+
+static void fill(uint8_t* data, size_t size, uint8_t version) {
+    for (size_t i = 0; i < size; i++) {
+        data[i] = static_cast<uint8_t>(i * 7 + version * 31);
+    }
+}
+
+struct Replacement {
+    FileSys* fs;
+    uint8_t version;
+};
+
+static FSResult write_version(FileHandle& file, void* context) {
+    Replacement& replacement = *static_cast<Replacement*>(context);
+    uint8_t data[CONTENT_SIZE];
+    fill(data, sizeof(data), replacement.version);
+    size_t written;
+    return replacement.fs->write(file, data, sizeof(data), written);
+}
+
+static bool write_file(FileSys& fs, const char* path, size_t size, uint8_t version) {
+    std::vector<uint8_t> data(size);
+    fill(data.data(), size, version);
+    FileHandle file;
+    size_t written;
+    return fs.open(file, path, OpenMode::WRITE | OpenMode::CREATE | OpenMode::TRUNC) == FSResult::OK &&
+           fs.write(file, data.data(), size, written) == FSResult::OK && written == size &&
+           fs.close(file) == FSResult::OK;
+}
+
+// The version a file holds in full, or 0 if it holds none
+static uint8_t read_version(FileSys& fs, const char* path) {
+    uint8_t data[CONTENT_SIZE + 1];
+    uint8_t expected[CONTENT_SIZE];
+    FileHandle file;
+    size_t bytes_read;
+    if (fs.open(file, path, OpenMode::READ) != FSResult::OK) {
+        return 0;
+    }
+    FSResult result = fs.read(file, data, sizeof(data), bytes_read);
+    fs.close(file);
+    if (result != FSResult::OK || bytes_read != CONTENT_SIZE) {
+        return 0;
+    }
+    for (uint8_t version = 1; version <= 3; version++) {
+        fill(expected, sizeof(expected), version);
+        if (memcmp(data, expected, CONTENT_SIZE) == 0) {
+            return version;
+        }
+    }
+    return 0;
+}
+
+// Fresh volume holding version 1 of the file
+static bool prepare(const Scenario& scenario, const char* path) {
+    MKFS_PARM parm;
+    memset(&parm, 0, sizeof(parm));
+    parm.fmt = FM_FAT;
+    parm.au_size = 512;
+    parm.align = BLOCK_SIZE / 512;
+    std::vector<uint8_t> work(FF_MAX_SS);
+    if (f_mkfs("0:", &parm, work.data(), static_cast<UINT>(work.size())) != FR_OK) {
+        return false;
+    }
+    
+    FileSys fs("0:");
+    bool ok = fs.mount() == FSResult::OK && fs.mkdir(scenario.dir) == FSResult::OK &&
+              write_file(fs, path, CONTENT_SIZE, 1);
+    char filler[MAX_PATH_LENGTH];
+    for (uint32_t i = 0; ok && i < scenario.fillers; i++) {
+        snprintf(filler, sizeof(filler), "%s/f%02u.bin", scenario.dir, i);
+        ok = write_file(fs, filler, 16, 0);
+    }
+    fs.unmount();
+    return ok;
+}
+
+// Reboot checks after a cut; returns the version found, 0 on failure
+static uint8_t recover(const Scenario& scenario, const char* path, uint64_t& free_bytes) {
+    FileSys fs("0:");
+    if (fs.mount() != FSResult::OK) {
+        printf("%s: image does not mount\n", scenario.name);
+        return 0;
+    }
+    
+    uint8_t version = read_version(fs, path);
+    if (version != 1 && version != 2) {
+        printf("%s: file holds neither version\n", scenario.name);
+        return 0;
+    }
+    
+    // What remove_tree does to a leftover temp, then reuse of the space
+    char temp_path[MAX_PATH_LENGTH];
+    FileSys::sibling_path(temp_path, sizeof(temp_path), path, REPLACE_TEMP_NAME);
+    fs.remove(temp_path);
+    if (!write_file(fs, "/fill.bin", FILL_SIZE, 9) || read_version(fs, path) != version) {
+        printf("%s: file damaged by removing the temp\n", scenario.name);
+        return 0;
+    }
+    
+    Replacement next = { &fs, 3 };
+    if (fs.atomic_replace(path, write_version, &next) != FSResult::OK || read_version(fs, path) != 3) {
+        printf("%s: replacement after the reset failed\n", scenario.name);
+        return 0;
+    }
+    
+    fs.get_free_space(free_bytes);
+    fs.unmount();
+    return version;
+}
+
+static bool run(CutDevice& device, const Scenario& scenario) {
+    char path[MAX_PATH_LENGTH];
+    FileSys::join_path(path, sizeof(path), scenario.dir, "data.bin");
+    
+    // The uncut run gives the free space every recovered volume should have
+    device.cut_after(UNLIMITED);
+    uint64_t expected_free = 0;
+    {
+        if (!prepare(scenario, path)) {
+            printf("%s: cannot prepare the volume\n", scenario.name);
+            return false;
+        }
+        FileSys fs("0:");
+        Replacement next = { &fs, 2 };
+        if (fs.mount() != FSResult::OK || fs.atomic_replace(path, write_version, &next) != FSResult::OK) {
+            printf("%s: uncut replacement failed\n", scenario.name);
+            return false;
+        }
+        fs.unmount();
+        if (recover(scenario, path, expected_free) != 2) {
+            return false;
+        }
+    }
+    
+    uint32_t cuts = 0;
+    uint32_t old_found = 0;
+    uint32_t new_found = 0;
+    uint32_t stranded_cuts = 0;
+    uint64_t stranded_max = 0;
+    for (uint32_t writes = 0;; writes++) {
+        device.cut_after(UNLIMITED);
+        if (!prepare(scenario, path)) {
+            printf("%s: cannot prepare the volume\n", scenario.name);
+            return false;
+        }
+        
+        device.cut_after(writes);
+        {
+            FileSys fs("0:");
+            Replacement next = { &fs, 2 };
+            if (fs.mount() == FSResult::OK) {
+                fs.atomic_replace(path, write_version, &next);
+            }
+            fs.unmount();
+        }
+        bool finished = !device.cut();
+        device.cut_after(UNLIMITED);
+        
+        uint64_t free_bytes = 0;
+        uint8_t version = recover(scenario, path, free_bytes);
+        if (version == 0) {
+            printf("%s: failed with the power cut after %u writes\n", scenario.name, writes);
+            return false;
+        }
+        cuts++;
+        (version == 1 ? old_found : new_found)++;
+        if (free_bytes < expected_free) {
+            stranded_cuts++;
+            if (expected_free - free_bytes > stranded_max) {
+                stranded_max = expected_free - free_bytes;
+            }
+        }
+        if (finished) {
+            break;
+        }
+    }
+    
+    printf("%-12s %4u cuts  old %4u  new %4u  stranded after %u cuts (at most %llu bytes)\n",
+           scenario.name, cuts, old_found, new_found, stranded_cuts,
+           static_cast<unsigned long long>(stranded_max));
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <image-path>\n", argv[0]);
+        return 2;
+    }
+    const char* image = argv[1];
+    
+    unlink(image);
+    MmapBlockDevice image_device(BLOCK_SIZE);
+    if (image_device.open(image, IMAGE_SIZE, true) != FSResult::OK) {
+        fprintf(stderr, "powerloss: cannot create %s\n", image);
+        return 2;
+    }
+    CutDevice device(image_device);
+    AsyncBlockAdapter adapter(device, nullptr, 0);
+    host_diskio_attach(&adapter);
+    host_diskio_set_time(1700000000);
+    
+    // A subdirectory's first sector holds 16 entries: ".", "..", the file
+    // and the temp fit; 14 fillers push the temp into the next sector
+    static const Scenario scenarios[] = {
+        { "same-sector", "/same", 0 },
+        { "split-sector", "/split", 14 },
+    };
+    bool ok = true;
+    for (const Scenario& scenario : scenarios) {
+        ok = run(device, scenario) && ok;
+    }
+    
+    host_diskio_attach(nullptr);
+    image_device.close();
+    unlink(image);
+    return ok ? 0 : 1;
+}
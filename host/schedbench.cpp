@@ -0,0 +1,303 @@
+// Foreground read latency under a background writer, with the I/O
+// scheduler off and on, on a LittleFS image behind a device that takes real
+// time for each transfer.
+//
+// Usage: schedbench <image-path> [slice-bytes] [seconds]
+//
+// Two threads share one FileSys through OsHooks built on a mutex and a
+// condition variable; like most OS mutexes the lock is not fair, so a
+// thread that unlocks and relocks usually gets it back. The background
+// thread rewrites /bg.bin in 64 KiB writes at BACKGROUND priority. The
+// foreground thread, at FOREGROUND priority, seeks to a random offset in
+// /fg.bin and reads 256 bytes every 10 ms; each seek and read is timed as
+// one request.
+
+#include "MmapBlockDevice.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace EmbeddedFS;
+
+static constexpr uint32_t BLOCK_SIZE = 4096;
+static constexpr uint32_t PROG_SIZE = 256;
+static constexpr uint64_t IMAGE_SIZE = 16ull << 20;
+static constexpr uint32_t FG_FILE_SIZE = 1 << 20;
+static constexpr uint32_t FG_READ = 256;
+static constexpr uint32_t FG_PERIOD_MS = 10;
+static constexpr uint32_t BG_WRITE = 64 * 1024;
+static constexpr uint32_t BG_FILE_SIZE = 1 << 20;
+
+// Device time: a small SPI NAND or SD card, slow enough that a background
+// write holds the device for tens of milliseconds
+static constexpr double READ_US_PER_KIB = 40.0;
+static constexpr double PROGRAM_US_PER_KIB = 400.0;
+static constexpr double ERASE_US = 1000.0;              // Per block
+
+// Passes requests through to the image after sleeping for their device time
+class SlowDevice : public IAsyncBlockDevice {
+public:
+    explicit SlowDevice(MmapBlockDevice& device) : device_(device) {}
+    
+    FSResult submit(BlockRequest& request) override {
+        double us = 0;
+        switch (request.op) {
+            case BlockOp::READ:
+                us = request.size * READ_US_PER_KIB / 1024;
+                break;
+            case BlockOp::PROGRAM:
+                us = request.size * PROGRAM_US_PER_KIB / 1024;
+                break;
+            case BlockOp::ERASE:
+                us = (request.size + BLOCK_SIZE - 1) / BLOCK_SIZE * ERASE_US;
+                break;
+            case BlockOp::SYNC:
+                break;
+        }
+        if (us > 0) {
+            std::this_thread::sleep_for(std::chrono::duration<double, std::micro>(us));
+        }
+        return device_.submit(request);
+    }
+    
+    uint32_t erase_size() const override { return device_.erase_size(); }
+    uint64_t capacity() const override { return device_.capacity(); }
+
+private:
+    MmapBlockDevice& device_;
+};
+
+// Recursive lock and condition variable for OsHooks. A task that unlocks
+// and locks again without blocking keeps the lock, as with most OS mutexes.
+class HostMonitor {
+public:
+    HostMonitor() : depth_(0), start_(std::chrono::steady_clock::now()) {
+        hooks_.context = this;
+        hooks_.lock = [](void* context) { static_cast<HostMonitor*>(context)->lock(); };
+        hooks_.unlock = [](void* context) { static_cast<HostMonitor*>(context)->unlock(); };
+        hooks_.wait = [](void* context, uint32_t timeout_ms) { static_cast<HostMonitor*>(context)->wait(timeout_ms); };
+        hooks_.notify_all = [](void* context) { static_cast<HostMonitor*>(context)->notify_all(); };
+        hooks_.tick_ms = [](void* context) { return static_cast<HostMonitor*>(context)->tick_ms(); };
+    }
+    
+    const OsHooks* hooks() const { return &hooks_; }
+
+private:
+    void lock() {
+        std::unique_lock<std::mutex> guard(mutex_);
+        std::thread::id self = std::this_thread::get_id();
+        if (depth_ == 0 || owner_ != self) {
+            free_.wait(guard, [this] { return depth_ == 0; });
+            owner_ = self;
+        }
+        depth_++;
+    }
+    
+    void unlock() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (--depth_ == 0) {
+            free_.notify_one();
+        }
+    }
+    
+    void wait(uint32_t timeout_ms) {
+        std::unique_lock<std::mutex> guard(mutex_);
+        uint32_t depth = depth_;
+        depth_ = 0;
+        free_.notify_one();
+        if (timeout_ms == 0) {
+            signal_.wait(guard);
+        } else {
+            signal_.wait_for(guard, std::chrono::milliseconds(timeout_ms));
+        }
+        free_.wait(guard, [this] { return depth_ == 0; });
+        owner_ = std::this_thread::get_id();
+        depth_ = depth;
+    }
+    
+    void notify_all() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        signal_.notify_all();
+    }
+    
+    uint32_t tick_ms() const {
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start_;
+        return static_cast<uint32_t>(elapsed.count());
+    }
+    
+    std::mutex mutex_;
+    std::condition_variable free_;
+    std::condition_variable signal_;
+    std::thread::id owner_;
+    uint32_t depth_;
+    std::chrono::steady_clock::time_point start_;
+    OsHooks hooks_;
+};
+
+struct RunResult {
+    bool ok;
+    std::vector<double> latencies_us;   // Foreground seek and read
+    uint64_t background_bytes;
+    IoSchedulerStats stats;
+};
+
+static bool write_file(FileSys& fs, const char* path, uint32_t size) {
+    std::vector<uint8_t> data(size);
+    for (uint32_t i = 0; i < size; i++) {
+        data[i] = static_cast<uint8_t>(i * 13);
+    }
+    FileHandle file;
+    size_t written;
+    return fs.open(file, path, OpenMode::WRITE | OpenMode::CREATE | OpenMode::TRUNC) == FSResult::OK &&
+           fs.write(file, data.data(), size, written) == FSResult::OK && written == size &&
+           fs.close(file) == FSResult::OK;
+}
+
+static void background(FileSys& fs, std::atomic<bool>& stop, RunResult& result) {
+    std::vector<uint8_t> chunk(BG_WRITE, 0x5A);
+    FileHandle file;
+    if (fs.open(file, "/bg.bin", OpenMode::WRITE | OpenMode::CREATE | OpenMode::TRUNC) != FSResult::OK ||
+        fs.set_io_priority(file, IoPriority::BACKGROUND) != FSResult::OK) {
+        result.ok = false;
+        return;
+    }
+    uint32_t position = 0;
+    while (!stop) {
+        if (position >= BG_FILE_SIZE) {
+            fs.seek(file, 0, SeekOrigin::SET);
+            position = 0;
+        }
+        size_t written;
+        if (fs.write(file, chunk.data(), chunk.size(), written) != FSResult::OK || written != chunk.size()) {
+            result.ok = false;
+            break;
+        }
+        position += BG_WRITE;
+        result.background_bytes += BG_WRITE;
+    }
+    fs.close(file);
+}
+
+static void foreground(FileSys& fs, std::atomic<bool>& stop, RunResult& result) {
+    std::mt19937 random(1);
+    uint8_t buffer[FG_READ];
+    FileHandle file;
+    if (fs.open(file, "/fg.bin", OpenMode::READ) != FSResult::OK ||
+        fs.set_io_priority(file, IoPriority::FOREGROUND) != FSResult::OK) {
+        result.ok = false;
+        return;
+    }
+    while (!stop) {
+        int32_t offset = static_cast<int32_t>(random() % (FG_FILE_SIZE / FG_READ) * FG_READ);
+        auto start = std::chrono::steady_clock::now();
+        size_t bytes_read;
+        if (fs.seek(file, offset, SeekOrigin::SET) != FSResult::OK ||
+            fs.read(file, buffer, sizeof(buffer), bytes_read) != FSResult::OK || bytes_read != sizeof(buffer)) {
+            result.ok = false;
+            break;
+        }
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        result.latencies_us.push_back(elapsed.count());
+        std::this_thread::sleep_for(std::chrono::milliseconds(FG_PERIOD_MS));
+    }
+    fs.close(file);
+}
+
+// Fresh image, both threads for the given time, scheduler slice (0 = off)
+static RunResult run(const char* path, uint32_t slice_bytes, uint32_t seconds) {
+    RunResult result = {};
+    unlink(path);
+    MmapBlockDevice device(BLOCK_SIZE);
+    if (device.open(path, IMAGE_SIZE, true) != FSResult::OK) {
+        return result;
+    }
+    SlowDevice slow(device);
+    AsyncBlockAdapter adapter(slow, nullptr, 0);
+    
+    lfs_config_t config;
+    std::vector<uint8_t> read_buffer(PROG_SIZE), prog_buffer(PROG_SIZE), lookahead_buffer(16);
+    memset(&config, 0, sizeof(config));
+    adapter.attach(config);
+    config.read_size = PROG_SIZE;
+    config.prog_size = PROG_SIZE;
+    config.block_size = BLOCK_SIZE;
+    config.block_count = static_cast<lfs_size_t>(IMAGE_SIZE / BLOCK_SIZE);
+    config.block_cycles = 500;
+    config.cache_size = PROG_SIZE;
+    config.lookahead_size = static_cast<lfs_size_t>(lookahead_buffer.size());
+    config.read_buffer = read_buffer.data();
+    config.prog_buffer = prog_buffer.data();
+    config.lookahead_buffer = lookahead_buffer.data();
+    
+    HostMonitor monitor;
+    {
+        // A blank image is formatted by mount
+        FileSys fs(&config);
+        fs.set_os_hooks(monitor.hooks());
+        result.ok = fs.mount() == FSResult::OK && write_file(fs, "/fg.bin", FG_FILE_SIZE) &&
+                    fs.enable_io_scheduler(slice_bytes) == FSResult::OK;
+        if (result.ok) {
+            std::atomic<bool> stop(false);
+            std::thread writer(background, std::ref(fs), std::ref(stop), std::ref(result));
+            std::thread reader(foreground, std::ref(fs), std::ref(stop), std::ref(result));
+            std::this_thread::sleep_for(std::chrono::seconds(seconds));
+            stop = true;
+            writer.join();
+            reader.join();
+            result.stats = fs.get_io_stats();
+        }
+        fs.unmount();
+    }
+    device.close();
+    return result;
+}
+
+static void report(const char* label, const RunResult& result, uint32_t seconds) {
+    if (!result.ok || result.latencies_us.empty()) {
+        printf("%-10s failed\n", label);
+        return;
+    }
+    std::vector<double> sorted(result.latencies_us);
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&sorted](double p) { return sorted[static_cast<size_t>(p * (sorted.size() - 1))]; };
+    printf("%-10s %8zu %9.0f %9.0f %9.0f   %9.1f %8u\n", label, sorted.size(), percentile(0.5),
+           percentile(0.99), sorted.back(), result.background_bytes / 1024.0 / seconds, result.stats.slices);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <image-path> [slice-bytes] [seconds]\n", argv[0]);
+        return 2;
+    }
+    const char* path = argv[1];
+    uint32_t slice_bytes = argc > 2 ? static_cast<uint32_t>(strtoul(argv[2], nullptr, 0)) : 4096;
+    uint32_t seconds = argc > 3 ? static_cast<uint32_t>(strtoul(argv[3], nullptr, 0)) : 5;
+    if (slice_bytes == 0 || seconds == 0) {
+        fprintf(stderr, "schedbench: slice and time must be non-zero\n");
+        return 2;
+    }
+    
+    printf("%u KiB background writes, %u-byte foreground reads every %u ms, %u s per run\n",
+           BG_WRITE / 1024, FG_READ, FG_PERIOD_MS, seconds);
+    printf("%-10s %8s %9s %9s %9s   %9s %8s\n", "scheduler", "fg reads", "p50 us", "p99 us", "max us",
+           "bg KiB/s", "slices");
+    
+    RunResult off = run(path, 0, seconds);
+    report("off", off, seconds);
+    char label[32];
+    snprintf(label, sizeof(label), "%u B", slice_bytes);
+    RunResult on = run(path, slice_bytes, seconds);
+    report(label, on, seconds);
+    
+    unlink(path);
+    return off.ok && on.ok ? 0 : 1;
+}
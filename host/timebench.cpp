@@ -0,0 +1,104 @@
+// Timestamp conversion cost of a directory listing: FAT packed times of a
+// synthetic 10k-entry directory converted to Unix seconds by
+// FileSys::fat_to_unix, by plain calendar arithmetic without tables or
+// cache, and by libc timegm; then the reverse direction as get_fattime
+// does it, per write.
+//
+// Usage: timebench [entries] [rounds]
+
+#include "../FileSys.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <random>
+#include <vector>
+
+using namespace EmbeddedFS;
+
+// Reference: the general civil-date algorithm on every call
+static uint32_t civil_to_unix(uint32_t fat_time) {
+    uint32_t date = fat_time >> 16;
+    uint32_t time = fat_time & 0xffff;
+    int32_t year = 1980 + static_cast<int32_t>(date >> 9);
+    uint32_t month = (date >> 5) & 0x0f;
+    uint32_t day = date & 0x1f;
+    
+    year -= month <= 2;
+    int32_t era = (year >= 0 ? year : year - 399) / 400;
+    uint32_t year_of_era = static_cast<uint32_t>(year - era * 400);
+    uint32_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    uint32_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    uint32_t days = static_cast<uint32_t>(era * 146097 + static_cast<int32_t>(day_of_era) - 719468);
+    return days * 86400 + (time >> 11) * 3600 + ((time >> 5) & 0x3f) * 60 + (time & 0x1f) * 2;
+}
+
+static uint32_t libc_to_unix(uint32_t fat_time) {
+    uint32_t date = fat_time >> 16;
+    uint32_t time = fat_time & 0xffff;
+    struct tm t = {};
+    t.tm_year = 80 + static_cast<int>(date >> 9);
+    t.tm_mon = static_cast<int>((date >> 5) & 0x0f) - 1;
+    t.tm_mday = static_cast<int>(date & 0x1f);
+    t.tm_hour = static_cast<int>(time >> 11);
+    t.tm_min = static_cast<int>((time >> 5) & 0x3f);
+    t.tm_sec = static_cast<int>(time & 0x1f) * 2;
+    return static_cast<uint32_t>(timegm(&t));
+}
+
+// Nanoseconds per conversion over all rounds
+template <typename Convert>
+static double measure(const std::vector<uint32_t>& input, uint32_t rounds, Convert convert, uint32_t& sum) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < rounds; round++) {
+        for (uint32_t value : input) {
+            sum += convert(value);
+        }
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (static_cast<double>(input.size()) * rounds);
+}
+
+int main(int argc, char** argv) {
+    uint32_t entries = argc > 1 ? static_cast<uint32_t>(strtoul(argv[1], nullptr, 0)) : 10000;
+    uint32_t rounds = argc > 2 ? static_cast<uint32_t>(strtoul(argv[2], nullptr, 0)) : 100;
+    
+    // A log directory: files written in runs over a couple of years, so
+    // neighbouring entries mostly share a date
+    std::mt19937 random(1);
+    std::vector<uint32_t> listing(entries);
+    std::vector<uint32_t> stamps(entries);
+    uint32_t now = 1700000000;
+    for (uint32_t i = 0; i < entries; i++) {
+        now += random() % 600;
+        stamps[i] = now;
+        listing[i] = FileSys::unix_to_fat(now);
+    }
+    
+    uint32_t sum = 0;
+    double mixed_ns = 0;
+    {
+        // Shuffled order defeats the date cache: worst case
+        std::vector<uint32_t> shuffled(listing);
+        std::shuffle(shuffled.begin(), shuffled.end(), random);
+        mixed_ns = measure(shuffled, rounds, FileSys::fat_to_unix, sum);
+    }
+    double table_ns = measure(listing, rounds, FileSys::fat_to_unix, sum);
+    double civil_ns = measure(listing, rounds, civil_to_unix, sum);
+    double libc_ns = measure(listing, rounds, libc_to_unix, sum);
+    double stamp_ns = measure(stamps, rounds, FileSys::unix_to_fat, sum);
+    
+    uint32_t mismatches = 0;
+    for (uint32_t value : listing) {
+        mismatches += FileSys::fat_to_unix(value) != libc_to_unix(value);
+    }
+    
+    printf("%u entries x %u rounds (checksum %08x, %u mismatches)\n", entries, rounds, sum, mismatches);
+    printf("fat_to_unix, listing order   %6.2f ns/entry  %7.1f us/listing\n", table_ns, table_ns * entries / 1000);
+    printf("fat_to_unix, shuffled        %6.2f ns/entry  %7.1f us/listing\n", mixed_ns, mixed_ns * entries / 1000);
+    printf("civil arithmetic             %6.2f ns/entry  %7.1f us/listing\n", civil_ns, civil_ns * entries / 1000);
+    printf("libc timegm                  %6.2f ns/entry  %7.1f us/listing\n", libc_ns, libc_ns * entries / 1000);
+    printf("unix_to_fat (get_fattime)    %6.2f ns/stamp\n", stamp_ns);
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,282 @@
+// Time of FileSys::mkdir_p and FileSys::remove_tree on a tree of thousands
+// of files, against the per-entry calls they replace, on a fresh LittleFS
+// or FAT image.
+//
+// Usage: treebench <image-path> [lfs|fat] [leaf-dirs] [files-per-dir] [depth]
+//
+// The tree is /t/aNN/bNN/... with leaf-dirs leaf directories depth levels
+// below /t, each holding files-per-dir small files. Creating the
+// directories is timed with one mkdir_p per leaf and with a mkdir per path
+// prefix (tolerating ERROR_EXIST); removing the tree is timed with
+// remove_tree and with a recursive walk that lists each directory, then
+// removes every entry by its full path. Each phase reports host time and
+// the device reads, programs and erases it caused.
+//
+// remove_tree also removes each entry by its full path, one backend call
+// and one metadata commit per entry. What it saves over the walk is the
+// per-directory entry list, at the cost of reopening a directory after
+// each subdirectory; it saves neither path resolution nor commits. mkdir_p
+// saves the mkdir calls for prefixes that already exist.
+
+#include "MmapBlockDevice.h"
+#include "HostDiskio.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace EmbeddedFS;
+
+static constexpr uint32_t BLOCK_SIZE = 4096;
+static constexpr uint32_t PROG_SIZE = 256;
+static constexpr uint64_t IMAGE_SIZE = 64ull << 20;
+static constexpr uint32_t FILE_SIZE = 32;
+
+// Passes requests through to the image and counts them
+class CountingDevice : public IAsyncBlockDevice {
+public:
+    explicit CountingDevice(MmapBlockDevice& device) : device_(device) { reset(); }
+    
+    FSResult submit(BlockRequest& request) override {
+        switch (request.op) {
+            case BlockOp::READ:
+                reads_++;
+                break;
+            case BlockOp::PROGRAM:
+                programs_++;
+                break;
+            case BlockOp::ERASE:
+                erases_++;
+                break;
+            case BlockOp::SYNC:
+                break;
+        }
+        return device_.submit(request);
+    }
+    
+    uint32_t erase_size() const override { return device_.erase_size(); }
+    uint64_t capacity() const override { return device_.capacity(); }
+    
+    void reset() {
+        reads_ = 0;
+        programs_ = 0;
+        erases_ = 0;
+    }
+    uint64_t reads() const { return reads_; }
+    uint64_t programs() const { return programs_; }
+    uint64_t erases() const { return erases_; }
+
+private:
+    MmapBlockDevice& device_;
+    uint64_t reads_;
+    uint64_t programs_;
+    uint64_t erases_;
+};
+
+// Leaf directories of the test tree
+struct Tree {
+    std::vector<std::string> leaves;
+    uint32_t files_per_dir;
+};
+
+static std::chrono::steady_clock::time_point phase_start;
+
+static void begin_phase(CountingDevice& device) {
+    device.reset();
+    phase_start = std::chrono::steady_clock::now();
+}
+
+static void end_phase(CountingDevice& device, const char* name, uint32_t items) {
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - phase_start;
+    printf("%-22s %8u %10.1f %10llu %10llu %8llu\n", name, items, elapsed.count(),
+           static_cast<unsigned long long>(device.reads()), static_cast<unsigned long long>(device.programs()),
+           static_cast<unsigned long long>(device.erases()));
+}
+
+static Tree make_tree(uint32_t leaf_dirs, uint32_t files_per_dir, uint32_t depth) {
+    Tree tree;
+    tree.files_per_dir = files_per_dir;
+    char part[16];
+    for (uint32_t leaf = 0; leaf < leaf_dirs; leaf++) {
+        // Spread the leaves over a tree with up to 8 children per level
+        std::string path = "/t";
+        uint32_t index = leaf;
+        for (uint32_t level = 0; level < depth; level++) {
+            uint32_t fan = level + 1 == depth ? leaf_dirs : 8;
+            snprintf(part, sizeof(part), "/%c%02u", 'a' + level, index % fan);
+            path += part;
+            index /= 8;
+        }
+        tree.leaves.push_back(path);
+    }
+    return tree;
+}
+
+// The per-prefix mkdir an application would do without mkdir_p
+static FSResult mkdir_each(FileSys& fs, const std::string& path) {
+    for (size_t end = 1; end <= path.size(); end++) {
+        if (end == path.size() || path[end] == '/') {
+            FSResult result = fs.mkdir(path.substr(0, end).c_str());
+            if (result != FSResult::OK && result != FSResult::ERROR_EXIST) {
+                return result;
+            }
+        }
+    }
+    return FSResult::OK;
+}
+
+// The recursive remove an application would do without remove_tree
+static FSResult remove_each(FileSys& fs, const std::string& path) {
+    std::vector<std::pair<std::string, bool>> entries;
+    DirHandle dir;
+    FSResult result = fs.opendir(dir, path.c_str());
+    if (result != FSResult::OK) {
+        return result;
+    }
+    FileInfo info;
+    while ((result = fs.readdir(dir, info)) == FSResult::OK && info.name[0] != '\0') {
+        if (strcmp(info.name, ".") != 0 && strcmp(info.name, "..") != 0) {
+            entries.emplace_back(path + "/" + info.name, info.is_directory);
+        }
+    }
+    fs.closedir(dir);
+    if (result != FSResult::OK) {
+        return result;
+    }
+    
+    for (const auto& entry : entries) {
+        result = entry.second ? remove_each(fs, entry.first) : fs.remove(entry.first.c_str());
+        if (result != FSResult::OK) {
+            return result;
+        }
+    }
+    return fs.rmdir(path.c_str());
+}
+
+static bool fill_tree(FileSys& fs, const Tree& tree) {
+    uint8_t data[FILE_SIZE];
+    memset(data, 0x5A, sizeof(data));
+    char path[MAX_PATH_LENGTH];
+    for (const std::string& leaf : tree.leaves) {
+        for (uint32_t i = 0; i < tree.files_per_dir; i++) {
+            snprintf(path, sizeof(path), "%s/f%04u.dat", leaf.c_str(), i);
+            FileHandle file;
+            size_t written;
+            if (fs.open(file, path, OpenMode::WRITE | OpenMode::CREATE | OpenMode::TRUNC) != FSResult::OK ||
+                fs.write(file, data, sizeof(data), written) != FSResult::OK || fs.close(file) != FSResult::OK) {
+                fprintf(stderr, "treebench: cannot write %s\n", path);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Create, fill and remove the tree once with each method
+static bool run(FileSys& fs, CountingDevice& device, const Tree& tree) {
+    uint32_t dirs = static_cast<uint32_t>(tree.leaves.size());
+    uint32_t entries = dirs * tree.files_per_dir;
+    
+    for (int per_entry = 1; per_entry >= 0; per_entry--) {
+        begin_phase(device);
+        for (const std::string& leaf : tree.leaves) {
+            FSResult result = per_entry ? mkdir_each(fs, leaf) : fs.mkdir_p(leaf.c_str());
+            if (result != FSResult::OK) {
+                fprintf(stderr, "treebench: cannot create %s (%d)\n", leaf.c_str(), static_cast<int>(result));
+                return false;
+            }
+        }
+        end_phase(device, per_entry ? "mkdir per prefix" : "mkdir_p", dirs);
+        
+        if (!fill_tree(fs, tree)) {
+            return false;
+        }
+        
+        begin_phase(device);
+        FSResult result = per_entry ? remove_each(fs, "/t") : fs.remove_tree("/t");
+        if (result != FSResult::OK) {
+            fprintf(stderr, "treebench: cannot remove /t (%d)\n", static_cast<int>(result));
+            return false;
+        }
+        end_phase(device, per_entry ? "list and remove each" : "remove_tree", entries);
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <image-path> [lfs|fat] [leaf-dirs] [files-per-dir] [depth]\n", argv[0]);
+        return 2;
+    }
+    const char* path = argv[1];
+    bool fat = argc > 2 && strcmp(argv[2], "fat") == 0;
+    uint32_t leaf_dirs = argc > 3 ? static_cast<uint32_t>(strtoul(argv[3], nullptr, 0)) : 64;
+    uint32_t files_per_dir = argc > 4 ? static_cast<uint32_t>(strtoul(argv[4], nullptr, 0)) : 64;
+    uint32_t depth = argc > 5 ? static_cast<uint32_t>(strtoul(argv[5], nullptr, 0)) : 3;
+    if (leaf_dirs == 0 || leaf_dirs > 100 || depth == 0 || depth > 8) {
+        fprintf(stderr, "treebench: leaf-dirs must be 1..100 and depth 1..8\n");
+        return 2;
+    }
+    
+    unlink(path);
+    MmapBlockDevice image(BLOCK_SIZE);
+    if (image.open(path, IMAGE_SIZE, true) != FSResult::OK) {
+        fprintf(stderr, "treebench: cannot create %s\n", path);
+        return 2;
+    }
+    CountingDevice device(image);
+    AsyncBlockAdapter adapter(device, nullptr, 0);
+    
+    lfs_config_t lfs_cfg;
+    std::vector<uint8_t> read_buffer(PROG_SIZE), prog_buffer(PROG_SIZE), lookahead_buffer(16);
+    std::vector<uint8_t> work(FF_MAX_SS);
+    if (fat) {
+        host_diskio_attach(&adapter);
+        MKFS_PARM parm;
+        memset(&parm, 0, sizeof(parm));
+        parm.fmt = FM_FAT | FM_FAT32;
+        parm.align = BLOCK_SIZE / 512;
+        if (f_mkfs("0:", &parm, work.data(), static_cast<UINT>(work.size())) != FR_OK) {
+            fprintf(stderr, "treebench: f_mkfs failed\n");
+            return 2;
+        }
+    } else {
+        memset(&lfs_cfg, 0, sizeof(lfs_cfg));
+        adapter.attach(lfs_cfg);
+        lfs_cfg.read_size = PROG_SIZE;
+        lfs_cfg.prog_size = PROG_SIZE;
+        lfs_cfg.block_size = BLOCK_SIZE;
+        lfs_cfg.block_count = static_cast<lfs_size_t>(IMAGE_SIZE / BLOCK_SIZE);
+        lfs_cfg.block_cycles = 500;
+        lfs_cfg.cache_size = PROG_SIZE;
+        lfs_cfg.lookahead_size = static_cast<lfs_size_t>(lookahead_buffer.size());
+        lfs_cfg.read_buffer = read_buffer.data();
+        lfs_cfg.prog_buffer = prog_buffer.data();
+        lfs_cfg.lookahead_buffer = lookahead_buffer.data();
+    }
+    
+    // A blank LittleFS image is formatted by mount
+    std::unique_ptr<FileSys> volume(fat ? new FileSys("0:") : new FileSys(&lfs_cfg));
+    if (volume->mount() != FSResult::OK) {
+        fprintf(stderr, "treebench: cannot mount %s\n", path);
+        return 2;
+    }
+    
+    Tree tree = make_tree(leaf_dirs, files_per_dir, depth);
+    printf("%s: %u leaf directories %u deep, %u files each (%u files)\n", fat ? "fat" : "lfs", leaf_dirs, depth,
+           files_per_dir, leaf_dirs * files_per_dir);
+    printf("%-22s %8s %10s %10s %10s %8s\n", "phase", "items", "ms", "reads", "programs", "erases");
+    bool ok = run(*volume, device, tree);
+    
+    volume->unmount();
+    if (fat) {
+        host_diskio_attach(nullptr);
+    }
+    image.close();
+    unlink(path);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,236 @@
+// Commit cost of a multi-file Transaction versus rewriting and syncing each
+// file separately, on a fresh LittleFS or FAT image.
+//
+// Usage: txbench <image-path> [lfs|fat] [files] [file-size] [rounds]
+//
+// A set of files in /cal is updated rounds times each way. "separate"
+// rewrites every file in place and closes it, which syncs it but gives no
+// atomicity across the set. "transaction" stages every file and commits.
+// Each scenario reports host time and the device programs, erases, syncs
+// and bytes programmed per round. On FAT the set is run twice: with short
+// names, whose entries fit one directory sector so the commit is one
+// FileSys::swap_contents write, and with long names, which spread the
+// entries over several sectors so the commit falls back to the journal.
+// On LittleFS the transaction is expected to cost more than "separate"
+// (see Transaction); the scenario shows by how much.
+
+#include "MmapBlockDevice.h"
+#include "HostDiskio.h"
+#include "../Transaction.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <unistd.h>
+#include <vector>
+
+using namespace EmbeddedFS;
+
+static constexpr uint32_t BLOCK_SIZE = 4096;
+static constexpr uint32_t PROG_SIZE = 256;
+static constexpr uint64_t IMAGE_SIZE = 16ull << 20;
+
+// Passes requests through to the image and counts the writes
+class CountingDevice : public IAsyncBlockDevice {
+public:
+    explicit CountingDevice(MmapBlockDevice& device) : device_(device) { reset(); }
+    
+    FSResult submit(BlockRequest& request) override {
+        switch (request.op) {
+            case BlockOp::READ:
+                break;
+            case BlockOp::PROGRAM:
+                programs_++;
+                bytes_ += request.size;
+                break;
+            case BlockOp::ERASE:
+                erases_++;
+                break;
+            case BlockOp::SYNC:
+                syncs_++;
+                break;
+        }
+        return device_.submit(request);
+    }
+    
+    uint32_t erase_size() const override { return device_.erase_size(); }
+    uint64_t capacity() const override { return device_.capacity(); }
+    
+    void reset() {
+        programs_ = 0;
+        erases_ = 0;
+        syncs_ = 0;
+        bytes_ = 0;
+    }
+    uint64_t programs() const { return programs_; }
+    uint64_t erases() const { return erases_; }
+    uint64_t syncs() const { return syncs_; }
+    uint64_t bytes() const { return bytes_; }
+
+private:
+    MmapBlockDevice& device_;
+    uint64_t programs_;
+    uint64_t erases_;
+    uint64_t syncs_;
+    uint64_t bytes_;
+};
+
+struct Scenario {
+    const char* name;
+    const char* file_format;    // Path of file N
+};
+
+static double elapsed_us(std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+static bool write_all(FileSys& fs, FileHandle& file, const std::vector<uint8_t>& data) {
+    size_t written;
+    return fs.write(file, data.data(), data.size(), written) == FSResult::OK && written == data.size();
+}
+
+static void report(const char* scenario, const char* method, CountingDevice& device, double us, uint32_t rounds) {
+    printf("%-12s %-12s %9.0f %9.1f %8.1f %7.1f %10.0f\n", scenario, method, us / rounds,
+           static_cast<double>(device.programs()) / rounds, static_cast<double>(device.erases()) / rounds,
+           static_cast<double>(device.syncs()) / rounds, static_cast<double>(device.bytes()) / rounds);
+}
+
+static bool run(FileSys& fs, CountingDevice& device, const Scenario& scenario, uint32_t files,
+                uint32_t file_size, uint32_t rounds) {
+    std::vector<uint8_t> data(file_size);
+    std::vector<std::vector<char>> paths(files, std::vector<char>(MAX_PATH_LENGTH));
+    for (uint32_t i = 0; i < files; i++) {
+        snprintf(paths[i].data(), MAX_PATH_LENGTH, scenario.file_format, i);
+        FileHandle file;
+        if (fs.open(file, paths[i].data(), OpenMode::WRITE | OpenMode::CREATE | OpenMode::TRUNC) != FSResult::OK ||
+            !write_all(fs, file, data) || fs.close(file) != FSResult::OK) {
+            fprintf(stderr, "txbench: cannot create %s\n", paths[i].data());
+            return false;
+        }
+    }
+    
+    device.reset();
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < rounds; round++) {
+        memset(data.data(), static_cast<int>(round), data.size());
+        for (uint32_t i = 0; i < files; i++) {
+            FileHandle file;
+            if (fs.open(file, paths[i].data(), OpenMode::WRITE | OpenMode::TRUNC) != FSResult::OK ||
+                !write_all(fs, file, data) || fs.close(file) != FSResult::OK) {
+                fprintf(stderr, "txbench: cannot rewrite %s\n", paths[i].data());
+                return false;
+            }
+        }
+    }
+    report(scenario.name, "separate", device, elapsed_us(start), rounds);
+    
+    std::vector<FileHandle> handles(files);
+    device.reset();
+    start = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < rounds; round++) {
+        memset(data.data(), static_cast<int>(round + 1), data.size());
+        Transaction tx(fs, "/cal/journal.txj");
+        bool ok = tx.begin() == FSResult::OK;
+        for (uint32_t i = 0; ok && i < files; i++) {
+            ok = tx.stage(handles[i], paths[i].data()) == FSResult::OK && write_all(fs, handles[i], data);
+        }
+        if (!ok || tx.commit() != FSResult::OK) {
+            fprintf(stderr, "txbench: transaction failed in round %u\n", round);
+            return false;
+        }
+    }
+    report(scenario.name, "transaction", device, elapsed_us(start), rounds);
+    
+    for (uint32_t i = 0; i < files; i++) {
+        fs.remove(paths[i].data());
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <image-path> [lfs|fat] [files] [file-size] [rounds]\n", argv[0]);
+        return 2;
+    }
+    const char* path = argv[1];
+    bool fat = argc > 2 && strcmp(argv[2], "fat") == 0;
+    uint32_t files = argc > 3 ? static_cast<uint32_t>(strtoul(argv[3], nullptr, 0)) : 6;
+    uint32_t file_size = argc > 4 ? static_cast<uint32_t>(strtoul(argv[4], nullptr, 0)) : 512;
+    uint32_t rounds = argc > 5 ? static_cast<uint32_t>(strtoul(argv[5], nullptr, 0)) : 100;
+    if (files == 0 || files > MAX_TRANSACTION_FILES || rounds == 0) {
+        fprintf(stderr, "txbench: files must be 1..%u and rounds non-zero\n",
+                static_cast<unsigned>(MAX_TRANSACTION_FILES));
+        return 2;
+    }
+    
+    unlink(path);
+    MmapBlockDevice image(BLOCK_SIZE);
+    if (image.open(path, IMAGE_SIZE, true) != FSResult::OK) {
+        fprintf(stderr, "txbench: cannot create %s\n", path);
+        return 2;
+    }
+    CountingDevice device(image);
+    AsyncBlockAdapter adapter(device, nullptr, 0);
+    
+    lfs_config_t lfs_cfg;
+    std::vector<uint8_t> read_buffer(PROG_SIZE), prog_buffer(PROG_SIZE), lookahead_buffer(16);
+    std::vector<uint8_t> work(FF_MAX_SS);
+    if (fat) {
+        host_diskio_attach(&adapter);
+        MKFS_PARM parm;
+        memset(&parm, 0, sizeof(parm));
+        parm.fmt = FM_FAT | FM_FAT32;
+        parm.align = BLOCK_SIZE / 512;
+        if (f_mkfs("0:", &parm, work.data(), static_cast<UINT>(work.size())) != FR_OK) {
+            fprintf(stderr, "txbench: f_mkfs failed\n");
+            return 2;
+        }
+    } else {
+        memset(&lfs_cfg, 0, sizeof(lfs_cfg));
+        adapter.attach(lfs_cfg);
+        lfs_cfg.read_size = PROG_SIZE;
+        lfs_cfg.prog_size = PROG_SIZE;
+        lfs_cfg.block_size = BLOCK_SIZE;
+        lfs_cfg.block_count = static_cast<lfs_size_t>(IMAGE_SIZE / BLOCK_SIZE);
+        lfs_cfg.block_cycles = 500;
+        lfs_cfg.cache_size = PROG_SIZE;
+        lfs_cfg.lookahead_size = static_cast<lfs_size_t>(lookahead_buffer.size());
+        lfs_cfg.read_buffer = read_buffer.data();
+        lfs_cfg.prog_buffer = prog_buffer.data();
+        lfs_cfg.lookahead_buffer = lookahead_buffer.data();
+    }
+    
+    // A blank LittleFS image is formatted by mount
+    std::unique_ptr<FileSys> volume(fat ? new FileSys("0:") : new FileSys(&lfs_cfg));
+    FileSys& fs = *volume;
+    if (fs.mount() != FSResult::OK || fs.mkdir("/cal") != FSResult::OK) {
+        fprintf(stderr, "txbench: cannot mount %s\n", path);
+        return 2;
+    }
+    
+    static const Scenario scenarios[] = {
+        { "short-names", "/cal/f%u.bin" },
+        { "long-names", "/cal/calibration-table-%u.bin" },
+    };
+    printf("%s: %u files of %u bytes, %u rounds; per round:\n", fat ? "fat" : "lfs", files, file_size, rounds);
+    printf("%-12s %-12s %9s %9s %8s %7s %10s\n", "scenario", "method", "us", "programs", "erases", "syncs",
+           "bytes");
+    bool ok = true;
+    for (const Scenario& scenario : scenarios) {
+        // LittleFS commits the same way whatever the names
+        if (!fat && &scenario != &scenarios[0]) {
+            break;
+        }
+        ok = run(fs, device, scenario, files, file_size, rounds) && ok;
+    }
+    
+    fs.unmount();
+    if (fat) {
+        host_diskio_attach(nullptr);
+    }
+    image.close();
+    unlink(path);
+    return ok ? 0 : 1;
+}
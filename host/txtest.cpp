@@ -0,0 +1,200 @@
+// Transaction test on a fresh LittleFS or FAT image: swap_contents with a
+// directory index on the directory (sizes seen by stat afterwards), commit,
+// abort, two transactions with their own journals in one directory, and
+// recover() discarding the shadows of a commit that never happened.
+//
+// Usage: txtest <image-path> [lfs|fat]
+//
+// Exit status is 0 if every check passed.
+
+#include "MmapBlockDevice.h"
+#include "HostDiskio.h"
+#include "../Transaction.h"
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace EmbeddedFS;
+
+static constexpr uint32_t BLOCK_SIZE = 4096;
+static constexpr uint32_t PROG_SIZE = 256;
+static constexpr uint64_t IMAGE_SIZE = 16ull << 20;
+
+static uint32_t failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static bool write_file(FileSys& fs, const char* path, const std::string& data) {
+    FileHandle file;
+    size_t written;
+    return fs.open(file, path, OpenMode::WRITE | OpenMode::CREATE | OpenMode::TRUNC) == FSResult::OK &&
+           fs.write(file, data.data(), data.size(), written) == FSResult::OK && written == data.size() &&
+           fs.close(file) == FSResult::OK;
+}
+
+// stat reports the size of data and the file holds exactly data
+static bool holds(FileSys& fs, const char* path, const std::string& data) {
+    FileInfo info;
+    if (fs.stat(path, info) != FSResult::OK || info.size != data.size()) {
+        return false;
+    }
+    
+    FileHandle file;
+    std::vector<char> buffer(data.size() + 1);
+    size_t read;
+    bool ok = fs.open(file, path, OpenMode::READ) == FSResult::OK &&
+              fs.read(file, buffer.data(), buffer.size(), read) == FSResult::OK && read == data.size() &&
+              memcmp(buffer.data(), data.data(), data.size()) == 0;
+    return fs.close(file) == FSResult::OK && ok;
+}
+
+static bool stage_write(FileSys& fs, Transaction& tx, FileHandle& handle, const char* path, const std::string& data) {
+    size_t written;
+    return tx.stage(handle, path) == FSResult::OK &&
+           fs.write(handle, data.data(), data.size(), written) == FSResult::OK && written == data.size();
+}
+
+static void test_transaction(FileSys& fs, bool fat) {
+    std::string old_a(10, 'a');
+    std::string old_b(100, 'b');
+    
+    check(fs.mkdir("/cal") == FSResult::OK, "mkdir /cal");
+    DirIndexEntry slots[64];
+    FSResult result = fs.enable_dir_index("/cal", slots, 64);
+    check(result == (fat ? FSResult::OK : FSResult::ERROR_NOT_SUPPORTED), "enable directory index");
+    check(write_file(fs, "/cal/a.bin", old_a) && write_file(fs, "/cal/b.bin", old_b), "write files");
+    check(holds(fs, "/cal/a.bin", old_a) && holds(fs, "/cal/b.bin", old_b), "stat before swap");
+    
+    // Both entries change size in one write; stat must not answer from
+    // index entries taken before it
+    const char* paths[] = { "/cal/a.bin" };
+    const char* others[] = { "/cal/b.bin" };
+    result = fs.swap_contents(paths, others, 1);
+    check(result == (fat ? FSResult::OK : FSResult::ERROR_NOT_SUPPORTED), "swap_contents");
+    if (result == FSResult::OK) {
+        check(holds(fs, "/cal/a.bin", old_b), "stat swapped a.bin");
+        check(holds(fs, "/cal/b.bin", old_a), "stat swapped b.bin");
+        std::swap(old_a, old_b);
+    }
+    
+    // Commit publishes new sizes and leaves no shadow or journal behind
+    std::string new_a(33, 'x');
+    std::string new_b(77, 'y');
+    FileHandle handle_a;
+    FileHandle handle_b;
+    {
+        Transaction tx(fs, "/cal/one.txj");
+        check(tx.begin() == FSResult::OK, "begin");
+        check(stage_write(fs, tx, handle_a, "/cal/a.bin", new_a), "stage a.bin");
+        check(stage_write(fs, tx, handle_b, "/cal/b.bin", new_b), "stage b.bin");
+        check(tx.commit() == FSResult::OK, "commit");
+    }
+    check(holds(fs, "/cal/a.bin", new_a), "committed a.bin");
+    check(holds(fs, "/cal/b.bin", new_b), "committed b.bin");
+    check(!fs.exists("/cal/one.txj"), "journal removed");
+    check(!fs.exists("/cal/one.txj.0") && !fs.exists("/cal/one.txj.1"), "shadows removed");
+    
+    // Abort leaves the targets alone
+    {
+        Transaction tx(fs, "/cal/one.txj");
+        check(tx.begin() == FSResult::OK, "begin abort");
+        check(stage_write(fs, tx, handle_a, "/cal/a.bin", old_a), "stage aborted a.bin");
+        check(tx.abort() == FSResult::OK, "abort");
+    }
+    check(holds(fs, "/cal/a.bin", new_a), "aborted a.bin");
+    check(!fs.exists("/cal/one.txj.0"), "aborted shadow removed");
+    
+    // Two journals in one directory stage at the same time without their
+    // shadows colliding
+    {
+        Transaction first(fs, "/cal/one.txj");
+        Transaction second(fs, "/cal/two.txj");
+        check(first.begin() == FSResult::OK && second.begin() == FSResult::OK, "begin both");
+        check(stage_write(fs, first, handle_a, "/cal/a.bin", old_a), "stage first");
+        check(stage_write(fs, second, handle_b, "/cal/b.bin", old_b), "stage second");
+        check(first.commit() == FSResult::OK, "commit first");
+        check(second.commit() == FSResult::OK, "commit second");
+    }
+    check(holds(fs, "/cal/a.bin", old_a), "first journal's a.bin");
+    check(holds(fs, "/cal/b.bin", old_b), "second journal's b.bin");
+    
+    // A shadow without a journal is a commit that never happened
+    check(write_file(fs, "/cal/one.txj.0", new_a), "write stray shadow");
+    check(Transaction::recover(fs, "/cal/one.txj") == FSResult::OK, "recover");
+    check(!fs.exists("/cal/one.txj.0"), "stray shadow removed");
+    check(holds(fs, "/cal/a.bin", old_a), "a.bin after recover");
+    
+    if (fat) {
+        check(fs.disable_dir_index("/cal") == FSResult::OK, "disable directory index");
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <image-path> [lfs|fat]\n", argv[0]);
+        return 2;
+    }
+    const char* path = argv[1];
+    bool fat = argc > 2 && strcmp(argv[2], "fat") == 0;
+    
+    unlink(path);
+    MmapBlockDevice device(BLOCK_SIZE);
+    if (device.open(path, IMAGE_SIZE, true) != FSResult::OK) {
+        fprintf(stderr, "txtest: cannot create %s\n", path);
+        return 2;
+    }
+    AsyncBlockAdapter adapter(device, nullptr, 0);
+    
+    lfs_config_t lfs_cfg;
+    std::vector<uint8_t> read_buffer(PROG_SIZE), prog_buffer(PROG_SIZE), lookahead_buffer(16);
+    std::vector<uint8_t> work(FF_MAX_SS);
+    if (fat) {
+        host_diskio_attach(&adapter);
+        MKFS_PARM parm;
+        memset(&parm, 0, sizeof(parm));
+        parm.fmt = FM_FAT | FM_FAT32;
+        parm.align = BLOCK_SIZE / 512;
+        if (f_mkfs("0:", &parm, work.data(), static_cast<UINT>(work.size())) != FR_OK) {
+            fprintf(stderr, "txtest: f_mkfs failed\n");
+            return 2;
+        }
+    } else {
+        memset(&lfs_cfg, 0, sizeof(lfs_cfg));
+        adapter.attach(lfs_cfg);
+        lfs_cfg.read_size = PROG_SIZE;
+        lfs_cfg.prog_size = PROG_SIZE;
+        lfs_cfg.block_size = BLOCK_SIZE;
+        lfs_cfg.block_count = static_cast<lfs_size_t>(IMAGE_SIZE / BLOCK_SIZE);
+        lfs_cfg.block_cycles = 500;
+        lfs_cfg.cache_size = PROG_SIZE;
+        lfs_cfg.lookahead_size = static_cast<lfs_size_t>(lookahead_buffer.size());
+        lfs_cfg.read_buffer = read_buffer.data();
+        lfs_cfg.prog_buffer = prog_buffer.data();
+        lfs_cfg.lookahead_buffer = lookahead_buffer.data();
+    }
+    
+    // A blank LittleFS image is formatted by mount
+    std::unique_ptr<FileSys> volume(fat ? new FileSys("0:") : new FileSys(&lfs_cfg));
+    if (volume->mount() != FSResult::OK) {
+        fprintf(stderr, "txtest: cannot mount %s\n", path);
+        return 2;
+    }
+    test_transaction(*volume, fat);
+    volume->unmount();
+    if (fat) {
+        host_diskio_attach(nullptr);
+    }
+    device.close();
+    unlink(path);
+    
+    printf("%s: %s\n", fat ? "fat" : "lfs", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}